@@ -0,0 +1,135 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare batch lookups with looking up translations one by one. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#define CATALOG "libgtr_bench_batch.mo"
+#define ROWS 1000
+#define GROUP 64
+
+static void run(const char *name, unsigned int flags, unsigned int count,
+	unsigned int rounds)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+	if (libgtr_load_msgcat_file(gtr, "bench", CATALOG) != GTREOK)
+	{
+		fprintf(stderr, "%s: failed to load catalog\n", name);
+		exit(1);
+	}
+
+	/* One msgid for a list view full of counts */
+	char row_msgid[64];
+	bench_msgid(row_msgid, sizeof(row_msgid), count / 2);
+	int ns[ROWS];
+	const char *out[ROWS];
+	for (int i = 0; i < ROWS; ++i)
+		ns[i] = i * 3;
+
+	size_t found = 0;
+	double start = bench_now();
+	for (unsigned int r = 0; r < rounds * 100; ++r)
+	{
+		for (int i = 0; i < ROWS; ++i)
+		{
+			found += libgtr_get_translation(gtr, "bench", row_msgid,
+				ns[i]) != NULL;
+		}
+	}
+	double rows_single = bench_now() - start;
+
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds * 100; ++r)
+	{
+		libgtr_get_translations_n(gtr, "bench", row_msgid, ns, ROWS, out);
+		for (int i = 0; i < ROWS; ++i)
+			found += out[i] != NULL;
+	}
+	double rows_batch = bench_now() - start;
+
+	/* Many msgids, in a scattered order */
+	char (*msgids)[64] = malloc(count * sizeof(*msgids));
+	const char **ptrs = malloc(count * sizeof(const char*));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		bench_msgid(msgids[i], sizeof(msgids[i]),
+			(unsigned int)(i * 2654435761u) % count);
+		ptrs[i] = msgids[i];
+	}
+
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			found += libgtr_get_translation(gtr, "bench", ptrs[i], 1)
+				!= NULL;
+		}
+	}
+	double msgids_single = bench_now() - start;
+
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < count; i += GROUP)
+		{
+			unsigned int group = count - i < GROUP ? count - i : GROUP;
+			libgtr_get_translations(gtr, "bench", ptrs + i, NULL, group,
+				out);
+			for (unsigned int j = 0; j < group; ++j)
+				found += out[j] != NULL;
+		}
+	}
+	double msgids_batch = bench_now() - start;
+
+	printf("%-14s rows: single %6.2f ns  batch %6.2f ns   "
+		"msgids: single %6.2f ns  batch %6.2f ns  (%zu found)\n", name,
+		rows_single / ((double)rounds * 100 * ROWS) * 1e9,
+		rows_batch / ((double)rounds * 100 * ROWS) * 1e9,
+		msgids_single / ((double)rounds * count) * 1e9,
+		msgids_batch / ((double)rounds * count) * 1e9, found);
+
+	free(ptrs);
+	free(msgids);
+	libgtr_destroy(gtr);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	unsigned int rounds = argc > 2 ? (unsigned int)atoi(argv[2]) : 10;
+
+	if (bench_write_catalog(CATALOG, count,
+		"nplurals=3; plural=(n%10==1 && n%100!=11 ? 0 : n%10>=2 && "
+		"n%10<=4 && (n%100<10 || n%100>=20) ? 1 : 2);", 3) != 0)
+	{
+		fprintf(stderr, "failed to write catalog\n");
+		return 1;
+	}
+	printf("%u strings, %u rounds, time per translation\n", count, rounds);
+
+	run("uthash", 0, count, rounds);
+	run("mo hash table", GTRF_MO_HASH, count, rounds);
+	run("perfect hash", GTRF_PERFECT_HASH, count, rounds);
+
+	remove(CATALOG);
+	return 0;
+}
@@ -0,0 +1,286 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Shared helpers for the libgtr benchmarks: a wall clock timer and a
+generator for synthetic message catalogs. */
+
+#ifndef _LIBGTR_BENCH_H
+#define _LIBGTR_BENCH_H
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* Current time in seconds, from a monotonic clock. */
+static inline double bench_now(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* Minimal thread wrappers. */
+#if defined(_WIN32)
+typedef HANDLE bench_thread_t;
+typedef CRITICAL_SECTION bench_mutex_t;
+#else
+typedef pthread_t bench_thread_t;
+typedef pthread_mutex_t bench_mutex_t;
+#endif
+
+typedef void (*bench_thread_fn)(void *arg);
+
+struct _bench_thread_start
+{
+	bench_thread_fn fn;
+	void *arg;
+};
+
+#if defined(_WIN32)
+static inline DWORD WINAPI _bench_thread_main(LPVOID p)
+#else
+static inline void *_bench_thread_main(void *p)
+#endif
+{
+	struct _bench_thread_start start = *(struct _bench_thread_start*)p;
+	free(p);
+	start.fn(start.arg);
+	return 0;
+}
+
+static inline int bench_thread_create(bench_thread_t *thread, bench_thread_fn fn,
+	void *arg)
+{
+	struct _bench_thread_start *start = malloc(sizeof(*start));
+	if (!start)
+		return -1;
+	start->fn = fn;
+	start->arg = arg;
+#if defined(_WIN32)
+	*thread = CreateThread(NULL, 0, _bench_thread_main, start, 0, NULL);
+	if (*thread == NULL)
+#else
+	if (pthread_create(thread, NULL, _bench_thread_main, start) != 0)
+#endif
+	{
+		free(start);
+		return -1;
+	}
+	return 0;
+}
+
+static inline void bench_thread_join(bench_thread_t thread)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+static inline void bench_mutex_init(bench_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static inline void bench_mutex_destroy(bench_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+static inline void bench_mutex_lock(bench_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void bench_mutex_unlock(bench_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+/* Number of processors available. */
+static inline unsigned int bench_cpu_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int)n : 1;
+#endif
+}
+
+/* msgid of the synthetic string with the given number. */
+static inline void bench_msgid(char *buf, size_t size, unsigned int i)
+{
+	snprintf(buf, size, "Synthetic message number %u, for testing", i);
+}
+
+static inline void _bench_put_u32(unsigned char *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+/* The hash function msgfmt uses for the catalog hash table. */
+static inline uint32_t _bench_hashpjw(const char *str)
+{
+	uint32_t hash = 0;
+	while (*str)
+	{
+		hash = (hash << 4) + (unsigned char)*str++;
+		uint32_t g = hash & 0xF0000000;
+		if (g)
+		{
+			hash ^= g >> 24;
+			hash ^= g;
+		}
+	}
+	return hash;
+}
+
+static inline uint32_t _bench_next_prime(uint32_t n)
+{
+	for (n |= 1;; n += 2)
+	{
+		uint32_t d;
+		for (d = 3; d * d <= n && n % d != 0; d += 2)
+			;
+		if (d * d > n)
+			return n;
+	}
+}
+
+/* Write a message catalog with count strings (plus the header) to file,
+laid out like msgfmt does, including the hash table. The header declares
+the given Plural-Forms; every string carries that many plural forms. */
+static inline int bench_write_catalog(const char *file, unsigned int count,
+	const char *plural_forms, unsigned int plurals)
+{
+	uint32_t strings = count + 1;
+	uint32_t hash_size = _bench_next_prime(strings * 4 / 3 > 3 ?
+		strings * 4 / 3 : 3);
+	char header[256];
+	snprintf(header, sizeof(header),
+		"Content-Type: text/plain; charset=UTF-8\n"
+		"Plural-Forms: %s\n", plural_forms);
+
+	/* Generous upper bound for the string data. */
+	size_t string_data = strlen(header) + 1 + (size_t)count * 64 * (plurals + 2);
+	size_t size = 28 + (size_t)strings * 16 + hash_size * 4 + string_data;
+	unsigned char *mo = calloc(1, size);
+	if (!mo)
+		return -1;
+
+	uint32_t ost = 28, tst = ost + strings * 8, hash = tst + strings * 8;
+	size_t off = hash + hash_size * 4;
+	_bench_put_u32(mo + 0, 0x950412de);
+	_bench_put_u32(mo + 8, strings);
+	_bench_put_u32(mo + 12, ost);
+	_bench_put_u32(mo + 16, tst);
+	_bench_put_u32(mo + 20, hash_size);
+	_bench_put_u32(mo + 24, hash);
+
+	char msgid[64];
+	for (uint32_t i = 0; i < strings; ++i)
+	{
+		/* String 0 is the header with the empty msgid. */
+		if (i == 0)
+			msgid[0] = '\0';
+		else
+			bench_msgid(msgid, sizeof(msgid), i - 1);
+		size_t len = strlen(msgid);
+		_bench_put_u32(mo + ost + i * 8, (uint32_t)len);
+		_bench_put_u32(mo + ost + i * 8 + 4, (uint32_t)off);
+		memcpy(mo + off, msgid, len + 1);
+		off += len + 1;
+
+		size_t ts_start = off;
+		if (i == 0)
+		{
+			memcpy(mo + off, header, strlen(header) + 1);
+			off += strlen(header) + 1;
+		}
+		else
+		{
+			for (unsigned int p = 0; p < plurals; ++p)
+				off += sprintf((char*)mo + off, "Translation %u, form %u",
+					i - 1, p) + 1;
+		}
+		_bench_put_u32(mo + tst + i * 8, (uint32_t)(off - ts_start - 1));
+		_bench_put_u32(mo + tst + i * 8 + 4, (uint32_t)ts_start);
+
+		uint32_t h = _bench_hashpjw(msgid);
+		uint32_t idx = h % hash_size, incr = 1 + h % (hash_size - 2);
+		while (mo[hash + idx * 4] || mo[hash + idx * 4 + 1] ||
+			mo[hash + idx * 4 + 2] || mo[hash + idx * 4 + 3])
+		{
+			idx = idx >= hash_size - incr ?
+				idx - (hash_size - incr) : idx + incr;
+		}
+		_bench_put_u32(mo + hash + idx * 4, i + 1);
+	}
+
+	FILE *f = fopen(file, "wb");
+	int result = -1;
+	if (f)
+	{
+		if (fwrite(mo, 1, off, f) == off)
+			result = 0;
+		fclose(f);
+	}
+	free(mo);
+	return result;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare loading many small catalogs from separate files with mounting
+them all from one bundle. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#define BUNDLE "libgtr_bench_bundle.gtrb"
+
+/* Time to load every catalog, plus the first lookup in each domain. */
+static void run(const char *name, libgtr_msgcat_file_t *files,
+	unsigned int count, unsigned int flags, int bundle)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+	double start = bench_now();
+	if (bundle)
+	{
+		if (libgtr_load_bundle(gtr, BUNDLE) != GTREOK)
+		{
+			fprintf(stderr, "failed to mount bundle\n");
+			exit(1);
+		}
+	}
+	else
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (libgtr_load_msgcat_file(gtr, files[i].domain,
+				files[i].file) != GTREOK)
+			{
+				fprintf(stderr, "failed to load %s\n", files[i].file);
+				exit(1);
+			}
+		}
+	}
+	double load = bench_now() - start;
+
+	/* A process typically only needs a few of the domains. */
+	char msgid[64];
+	bench_msgid(msgid, sizeof(msgid), 1);
+	unsigned int few = count < 10 ? count : 10;
+	start = bench_now();
+	for (unsigned int i = 0; i < few; ++i)
+	{
+		if (!libgtr_get_translation(gtr, files[i].domain, msgid, 1))
+			exit(1);
+	}
+	double first = bench_now() - start;
+	for (unsigned int i = few; i < count; ++i)
+	{
+		if (!libgtr_get_translation(gtr, files[i].domain, msgid, 1))
+			exit(1);
+	}
+	double all = bench_now() - start;
+
+	printf("%-18s load %8.2f ms  +%u domains %8.2f ms  "
+		"+all domains %8.2f ms\n", name, load * 1e3, few, first * 1e3,
+		all * 1e3);
+	libgtr_destroy(gtr);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 1000;
+	unsigned int strings = argc > 2 ? (unsigned int)atoi(argv[2]) : 500;
+
+	libgtr_msgcat_file_t *files = calloc(count, sizeof(*files));
+	char (*names)[2][64] = malloc(count * sizeof(*names));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		snprintf(names[i][0], sizeof(names[i][0]), "locale%u/messages", i);
+		snprintf(names[i][1], sizeof(names[i][1]),
+			"libgtr_bench_bundle_%u.mo", i);
+		files[i].domain = names[i][0];
+		files[i].file = names[i][1];
+		if (bench_write_catalog(files[i].file, strings,
+			"nplurals=2; plural=(n != 1);", 2) != 0)
+		{
+			fprintf(stderr, "failed to write catalog\n");
+			return 1;
+		}
+	}
+
+	double start = bench_now();
+	if (libgtr_write_bundle(BUNDLE, files, count) != GTREOK)
+	{
+		fprintf(stderr, "failed to write bundle\n");
+		return 1;
+	}
+	printf("%u catalogs, %u strings each, packed in %.2f ms\n", count,
+		strings, (bench_now() - start) * 1e3);
+
+	run("files", files, count, 0, 0);
+	run("files, perfect", files, count, GTRF_PERFECT_HASH, 0);
+	run("files, lazy", files, count, GTRF_LAZY_INDEX, 0);
+	run("bundle", files, count, 0, 1);
+
+	for (unsigned int i = 0; i < count; ++i)
+		remove(files[i].file);
+	remove(BUNDLE);
+	free(names);
+	free(files);
+	return 0;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measure lookups that mostly miss, with and without a filter in front
+of the string index, and report the statistics of the domain. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#define CATALOG "libgtr_bench_filter.mo"
+
+static void run(const char *name, unsigned int flags, unsigned int strings,
+	unsigned int hit_percent, unsigned int lookups)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags | GTRF_LOOKUP_STATS);
+	if (libgtr_load_msgcat_file(gtr, "bench", CATALOG) != GTREOK)
+	{
+		fprintf(stderr, "failed to load catalog\n");
+		exit(1);
+	}
+
+	/* Missing msgids look just like the ones in the catalog. */
+	char msgid[64];
+	unsigned int found = 0;
+	double start = bench_now();
+	for (unsigned int i = 0; i < lookups; ++i)
+	{
+		unsigned int n = (i * 7919u) % strings;
+		if (i % 100 >= hit_percent)
+			n += strings;
+		bench_msgid(msgid, sizeof(msgid), n);
+		found += libgtr_get_translation(gtr, "bench", msgid, 1) != NULL;
+	}
+	double elapsed = bench_now() - start;
+
+	libgtr_domain_stats_t stats;
+	libgtr_get_domain_stats(gtr, "bench", &stats);
+	printf("%-16s %3u%% hits %8.1f ns/lookup  hits %llu  misses %llu  "
+		"filtered %llu\n", name, hit_percent, elapsed * 1e9 / lookups,
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+		(unsigned long long)stats.filtered);
+	if (found != stats.hits)
+		exit(1);
+	libgtr_destroy(gtr);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int strings = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	unsigned int lookups = 2000000;
+	if (bench_write_catalog(CATALOG, strings, "nplurals=2; plural=(n != 1);",
+		2) != 0)
+	{
+		fprintf(stderr, "failed to write catalog\n");
+		return 1;
+	}
+	printf("%u strings, %u lookups\n", strings, lookups);
+
+	static const unsigned int hit_percents[] = { 10, 50, 90 };
+	for (size_t i = 0; i < sizeof(hit_percents) / sizeof(*hit_percents);
+		++i)
+	{
+		run("descriptors", 0, strings, hit_percents[i], lookups);
+		run("with filter", GTRF_MISS_FILTER, strings, hit_percents[i],
+			lookups);
+	}
+
+	remove(CATALOG);
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare load time, memory use and lookup throughput of the string
+index types on a large synthetic catalog. */
+
+#include "bench.h"
+
+#include "gtr.h"
+#include "../src/gtrP.h"
+
+#define CATALOG "libgtr_bench_index.mo"
+
+/* Heap memory used by the index of a loaded domain, in bytes. */
+static size_t index_memory(const libgtr_domain_t *dom)
+{
+	if (dom->mph)
+	{
+		return sizeof(libgtr_mph_t) + sizeof(uint32_t) *
+			((size_t)dom->mph->bucket_count + dom->mph->slot_count);
+	}
+	if (dom->strings)
+	{
+		const UT_hash_table *tbl = dom->strings->hh.tbl;
+		return dom->string_count * (sizeof(libgtr_string_descriptor_t) +
+			dom->plurals * sizeof(char*)) +
+			tbl->num_buckets * sizeof(UT_hash_bucket) +
+			sizeof(UT_hash_table);
+	}
+	return 0;
+}
+
+static void run(const char *name, unsigned int flags, unsigned int count,
+	unsigned int rounds)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+
+	double start = bench_now();
+	if (libgtr_load_msgcat_file(gtr, "bench", CATALOG) != GTREOK)
+	{
+		fprintf(stderr, "%s: failed to load catalog\n", name);
+		exit(1);
+	}
+	double load = bench_now() - start;
+
+	/* Pre-generate the msgids, so the loop only measures lookups. */
+	char (*msgids)[64] = malloc(count * sizeof(*msgids));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		/* Look up every string in a scattered order, and every eighth
+		lookup misses. */
+		unsigned int s = (unsigned int)(i * 2654435761u) % count;
+		if (i % 8 == 7)
+			snprintf(msgids[i], sizeof(msgids[i]), "Missing %u", s);
+		else
+			bench_msgid(msgids[i], sizeof(msgids[i]), s);
+	}
+
+	size_t found = 0;
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			found += libgtr_get_translation(gtr, "bench",
+				msgids[i], 1) != NULL;
+		}
+	}
+	double all = bench_now() - start;
+
+	/* The same again for a working set of 1000 strings that stays in
+	the cache. */
+	unsigned int hot = count < 1000 ? count : 1000;
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds * (count / hot); ++r)
+	{
+		for (unsigned int i = 0; i < hot; ++i)
+		{
+			found += libgtr_get_translation(gtr, "bench",
+				msgids[i], 1) != NULL;
+		}
+	}
+	double cached = bench_now() - start;
+
+	/* And once more with prepared keys. */
+	libgtr_key_t *keys = malloc(hot * sizeof(libgtr_key_t));
+	for (unsigned int i = 0; i < hot; ++i)
+		libgtr_key_init(&keys[i], msgids[i]);
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds * (count / hot); ++r)
+	{
+		for (unsigned int i = 0; i < hot; ++i)
+		{
+			found += libgtr_get_translation_key(gtr, "bench",
+				&keys[i], 1) != NULL;
+		}
+	}
+	double keyed = bench_now() - start;
+	free(keys);
+
+	size_t memory = index_memory(gtr->domains);
+	printf("%-14s load %7.2f ms  index %5.1f bytes/string  "
+		"all %6.2f M/s  hot %6.2f M/s  keys %6.2f M/s\n",
+		name, load * 1e3, (double)memory / (count + 1),
+		(double)count * rounds / all * 1e-6,
+		(double)hot * rounds * (count / hot) / cached * 1e-6,
+		(double)hot * rounds * (count / hot) / keyed * 1e-6);
+
+	free(msgids);
+	libgtr_destroy(gtr);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	unsigned int rounds = argc > 2 ? (unsigned int)atoi(argv[2]) : 20;
+
+	if (bench_write_catalog(CATALOG, count,
+		"nplurals=2; plural=(n != 1);", 2) != 0)
+	{
+		fprintf(stderr, "failed to write catalog\n");
+		return 1;
+	}
+	printf("%u strings, %u rounds\n", count, rounds);
+
+	run("uthash", 0, count, rounds);
+	run("mo hash table", GTRF_MO_HASH, count, rounds);
+	run("perfect hash", GTRF_PERFECT_HASH, count, rounds);
+	/* Loading only checks the header; the first lookup builds the
+	index. */
+	run("lazy uthash", GTRF_LAZY_INDEX, count, rounds);
+	run("lazy mph", GTRF_LAZY_INDEX | GTRF_PERFECT_HASH, count, rounds);
+	/* The first load writes the index file, the second one maps it. */
+	remove(CATALOG ".gtri");
+	run("index file new", GTRF_INDEX_FILE, count, rounds);
+	run("index file", GTRF_INDEX_FILE, count, rounds);
+	remove(CATALOG ".gtri");
+
+	remove(CATALOG);
+	return 0;
+}
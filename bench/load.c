@@ -0,0 +1,111 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare loading many catalogs one by one with the parallel bulk
+loader. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+static double load_serial(libgtr_msgcat_file_t *files, unsigned int count,
+	unsigned int flags)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+	double start = bench_now();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (libgtr_load_msgcat_file(gtr, files[i].domain, files[i].file) !=
+			GTREOK)
+		{
+			fprintf(stderr, "failed to load %s\n", files[i].file);
+			exit(1);
+		}
+	}
+	double elapsed = bench_now() - start;
+	libgtr_destroy(gtr);
+	return elapsed;
+}
+
+static double load_bulk(libgtr_msgcat_file_t *files, unsigned int count,
+	unsigned int flags, unsigned int threads)
+{
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+	double start = bench_now();
+	if (libgtr_load_msgcat_files(gtr, files, count, threads) != GTREOK)
+	{
+		fprintf(stderr, "bulk load failed\n");
+		exit(1);
+	}
+	double elapsed = bench_now() - start;
+	libgtr_destroy(gtr);
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 100;
+	unsigned int strings = argc > 2 ? (unsigned int)atoi(argv[2]) : 5000;
+	unsigned int max_threads = argc > 3 ? (unsigned int)atoi(argv[3]) :
+		bench_cpu_count();
+
+	libgtr_msgcat_file_t *files = calloc(count, sizeof(*files));
+	char (*names)[2][64] = malloc(count * sizeof(*names));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		snprintf(names[i][0], sizeof(names[i][0]), "domain%u", i);
+		snprintf(names[i][1], sizeof(names[i][1]),
+			"libgtr_bench_load_%u.mo", i);
+		files[i].domain = names[i][0];
+		files[i].file = names[i][1];
+		if (bench_write_catalog(files[i].file, strings,
+			"nplurals=2; plural=(n != 1);", 2) != 0)
+		{
+			fprintf(stderr, "failed to write catalog\n");
+			return 1;
+		}
+	}
+
+	printf("%u catalogs, %u strings each\n", count, strings);
+	static const struct { const char *name; unsigned int flags; } modes[] = {
+		{ "uthash", 0 },
+		{ "perfect hash", GTRF_PERFECT_HASH },
+	};
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+	{
+		printf("%-14s serial %8.2f ms", modes[m].name,
+			load_serial(files, count, modes[m].flags) * 1e3);
+		for (unsigned int threads = 1; threads <= max_threads; )
+		{
+			printf("  bulk/%u %8.2f ms", threads,
+				load_bulk(files, count, modes[m].flags, threads) * 1e3);
+			if (threads < max_threads && threads * 2 > max_threads)
+				threads = max_threads;
+			else
+				threads *= 2;
+		}
+		printf("\n");
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		remove(files[i].file);
+	free(names);
+	free(files);
+	return 0;
+}
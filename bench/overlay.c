@@ -0,0 +1,117 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measure attaching a small catalog on top of a large one, and the cost
+of lookups through the merged index of layers and of fallback chains. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#define BASE "libgtr_bench_overlay_base.mo"
+#define PATCH "libgtr_bench_overlay_patch.mo"
+
+static double lookups(libgtr_t *gtr, const char *domain, unsigned int count,
+	unsigned int rounds)
+{
+	char msgid[64];
+	double start = bench_now();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			bench_msgid(msgid, sizeof(msgid), (i * 7919u) % count);
+			if (!libgtr_get_translation(gtr, domain, msgid, 1))
+				exit(1);
+		}
+	}
+	return (bench_now() - start) * 1e9 / ((double)count * rounds);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int strings = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	unsigned int patch = argc > 2 ? (unsigned int)atoi(argv[2]) : 100;
+	unsigned int rounds = 10;
+	if (bench_write_catalog(BASE, strings, "nplurals=2; plural=(n != 1);",
+		2) != 0 || bench_write_catalog(PATCH, patch,
+		"nplurals=2; plural=(n != 1);", 2) != 0)
+	{
+		fprintf(stderr, "failed to write catalogs\n");
+		return 1;
+	}
+	printf("%u strings, %u patched\n", strings, patch);
+
+	libgtr_t *gtr = libgtr_new();
+	double start = bench_now();
+	if (libgtr_load_msgcat_file(gtr, "single", BASE) != GTREOK)
+		exit(1);
+	printf("load single catalog   %8.2f ms\n", (bench_now() - start) * 1e3);
+	start = bench_now();
+	if (libgtr_attach_msgcat_file(gtr, "layered", "base", BASE) != GTREOK)
+		exit(1);
+	printf("attach base layer     %8.2f ms\n", (bench_now() - start) * 1e3);
+	start = bench_now();
+	if (libgtr_attach_msgcat_file(gtr, "layered", "patch", PATCH) !=
+		GTREOK)
+	{
+		exit(1);
+	}
+	printf("attach patch layer    %8.2f ms\n", (bench_now() - start) * 1e3);
+
+	printf("lookup single catalog %8.1f ns\n",
+		lookups(gtr, "single", strings, rounds));
+	printf("lookup two layers     %8.1f ns\n",
+		lookups(gtr, "layered", strings, rounds));
+
+	/* A fallback chain with the small catalog first, compared to trying
+	each catalog in turn. */
+	const char *chain[] = { PATCH, BASE };
+	if (libgtr_load_msgcat_chain(gtr, "chain", chain, 2) != GTREOK ||
+		libgtr_load_msgcat_file(gtr, "patch", PATCH) != GTREOK)
+	{
+		exit(1);
+	}
+	char msgid[64];
+	start = bench_now();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < strings; ++i)
+		{
+			bench_msgid(msgid, sizeof(msgid), (i * 7919u) % strings);
+			if (!libgtr_get_translation(gtr, "patch", msgid, 1) &&
+				!libgtr_get_translation(gtr, "single", msgid, 1))
+			{
+				exit(1);
+			}
+		}
+	}
+	printf("lookup fallback calls %8.1f ns\n",
+		(bench_now() - start) * 1e9 / ((double)strings * rounds));
+	printf("lookup fallback chain %8.1f ns\n",
+		lookups(gtr, "chain", strings, rounds));
+
+	start = bench_now();
+	if (libgtr_detach_msgcat(gtr, "layered", "patch") != GTREOK)
+		exit(1);
+	printf("detach patch layer    %8.2f ms\n", (bench_now() - start) * 1e3);
+
+	libgtr_destroy(gtr);
+	remove(BASE);
+	remove(PATCH);
+	return 0;
+}
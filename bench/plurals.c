@@ -0,0 +1,101 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare plural form evaluation from the expression tree with the
+compiled program, the native evaluators and the precomputed tables of
+plural rules. */
+
+#include "bench.h"
+
+#include "gtr.h"
+#include "../src/gtrP.h"
+
+static const struct
+{
+	const char *language;
+	const char *formula;
+} formulas[] = {
+	{ "Russian", "(n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && "
+		"(n%100<10 || n%100>=20) ? 1 : 2)" },
+	{ "Polish", "(n==1 ? 0 : n%10>=2 && n%10<=4 && "
+		"(n%100<10 || n%100>=20) ? 1 : 2)" },
+	{ "Arabic", "(n==0 ? 0 : n==1 ? 1 : n==2 ? 2 : "
+		"n%100>=3 && n%100<=10 ? 3 : n%100>=11 ? 4 : 5)" },
+	{ "Slovenian", "(n%100==1 ? 0 : n%100==2 ? 1 : "
+		"n%100==3 || n%100==4 ? 2 : 3)" },
+};
+
+int main(int argc, char **argv)
+{
+	int count = argc > 1 ? atoi(argv[1]) : 10000000;
+	printf("%d evaluations per formula\n", count);
+
+	for (size_t f = 0; f < sizeof(formulas) / sizeof(formulas[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr =
+			libgtr_plural_expr_parse(formulas[f].formula);
+		libgtr_plural_program_t *program =
+			libgtr_plural_program_compile(expr);
+		libgtr_plural_fn native = libgtr_plural_native(expr);
+		libgtr_plural_rule_t *rule = libgtr_plural_rule_new(
+			libgtr_plural_expr_parse(formulas[f].formula));
+		if (!expr || !program || !native || !rule || !rule->period)
+		{
+			fprintf(stderr, "%s: failed to compile\n", formulas[f].language);
+			return 1;
+		}
+
+		/* Sum the results so the compiler can't drop the calls. */
+		long sum_tree = 0, sum_program = 0, sum_native = 0, sum_table = 0;
+		double start = bench_now();
+		for (int n = 0; n < count; ++n)
+			sum_tree += libgtr_plural_expr_eval(expr, n);
+		double tree = bench_now() - start;
+
+		start = bench_now();
+		for (int n = 0; n < count; ++n)
+			sum_program += libgtr_plural_program_eval(program, n);
+		double compiled = bench_now() - start;
+
+		start = bench_now();
+		for (int n = 0; n < count; ++n)
+			sum_native += native(n);
+		double hand_written = bench_now() - start;
+
+		start = bench_now();
+		for (int n = 0; n < count; ++n)
+			sum_table += libgtr_plural_rule_eval(rule, n);
+		double table = bench_now() - start;
+
+		if (sum_tree != sum_program || sum_tree != sum_native ||
+			sum_tree != sum_table)
+		{
+			fprintf(stderr, "%s: results differ\n", formulas[f].language);
+			return 1;
+		}
+		printf("%-10s tree %6.2f ns  program %6.2f ns  native %6.2f ns  "
+			"table %6.2f ns\n",
+			formulas[f].language, tree / count * 1e9,
+			compiled / count * 1e9, hand_written / count * 1e9,
+			table / count * 1e9);
+
+		libgtr_plural_rule_free(rule);
+		libgtr_plural_program_free(program);
+		libgtr_plural_expr_free(expr);
+	}
+	return 0;
+}
@@ -0,0 +1,179 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Compare the memory that worker processes loading the same large catalog
+keep to themselves, with and without a shared index. Linux only: the
+numbers come from /proc. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#define CATALOG "libgtr_bench_shared.mo"
+
+#if defined(__linux__)
+/* Memory only mapped by this process, in kilobytes. */
+static long private_kb(void)
+{
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return -1;
+	char line[256];
+	long total = 0, kb;
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "Private_Clean: %ld kB", &kb) == 1 ||
+			sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+		{
+			total += kb;
+		}
+	}
+	fclose(f);
+	return total;
+}
+
+struct result
+{
+	double load;
+	long private_kb;
+};
+
+/* Load the catalog, touch every string, then wait until all workers are
+done loading before measuring, so shared memory is shared by then. */
+static void worker(unsigned int flags, unsigned int count, int ready,
+	int go, int out)
+{
+	long before = private_kb();
+	libgtr_t *gtr = libgtr_new();
+	libgtr_set_flags(gtr, flags);
+	double start = bench_now();
+	if (libgtr_load_msgcat_file(gtr, "bench", CATALOG) != GTREOK)
+		_exit(1);
+	double load = bench_now() - start;
+
+	char msgid[64];
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		bench_msgid(msgid, sizeof(msgid), i);
+		if (!libgtr_get_translation(gtr, "bench", msgid, 1))
+			_exit(1);
+	}
+
+	char c = 0;
+	if (write(ready, &c, 1) != 1 || read(go, &c, 1) < 0)
+		_exit(1);
+	struct result result = { load, private_kb() - before };
+	if (write(out, &result, sizeof(result)) != sizeof(result))
+		_exit(1);
+	libgtr_destroy(gtr);
+	_exit(0);
+}
+
+static void run(const char *name, unsigned int flags, unsigned int count,
+	unsigned int workers)
+{
+	int ready[2], go[2], out[2];
+	if (pipe(ready) != 0 || pipe(go) != 0 || pipe(out) != 0)
+		exit(1);
+	for (unsigned int w = 0; w < workers; ++w)
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+			exit(1);
+		if (pid == 0)
+		{
+			close(go[1]);
+			worker(flags, count, ready[1], go[0], out[1]);
+		}
+	}
+	close(ready[1]);
+	close(go[0]);
+	close(out[1]);
+
+	/* Closing the pipe lets all of them go at once. */
+	char c;
+	for (unsigned int w = 0; w < workers; ++w)
+	{
+		if (read(ready[0], &c, 1) != 1)
+		{
+			fprintf(stderr, "%s: worker failed\n", name);
+			exit(1);
+		}
+	}
+	close(go[1]);
+
+	double load = 0, max_load = 0;
+	long kb = 0;
+	struct result result;
+	for (unsigned int w = 0; w < workers; ++w)
+	{
+		if (read(out[0], &result, sizeof(result)) != sizeof(result))
+			exit(1);
+		load += result.load;
+		if (result.load > max_load)
+			max_load = result.load;
+		kb += result.private_kb;
+	}
+	close(ready[0]);
+	close(out[0]);
+	while (wait(NULL) > 0)
+		;
+
+	printf("%-14s load %7.2f ms (max %7.2f ms)  "
+		"private %7ld kB/process  %8ld kB total\n",
+		name, load / workers * 1e3, max_load * 1e3, kb / (long)workers, kb);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#if defined(__linux__)
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	unsigned int workers = argc > 2 ? (unsigned int)atoi(argv[2]) : 16;
+
+	if (bench_write_catalog(CATALOG, count,
+		"nplurals=2; plural=(n != 1);", 2) != 0)
+	{
+		fprintf(stderr, "failed to write catalog\n");
+		return 1;
+	}
+	printf("%u strings, %u processes\n", count, workers);
+
+	run("uthash", 0, count, workers);
+	run("perfect hash", GTRF_PERFECT_HASH, count, workers);
+	/* All workers start at once: one of them builds the index, the
+	others wait for it. Then a second round of workers, as after a
+	restart, finds it already published. */
+	libgtr_remove_shared_index(CATALOG);
+	run("shared index", GTRF_SHARED_INDEX, count, workers);
+	run("shared attach", GTRF_SHARED_INDEX, count, workers);
+	libgtr_remove_shared_index(CATALOG);
+
+	remove(CATALOG);
+	return 0;
+#else
+	(void)argc;
+	(void)argv;
+	fprintf(stderr, "this benchmark needs Linux\n");
+	return 1;
+#endif
+}
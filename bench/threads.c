@@ -0,0 +1,148 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measure how lookup throughput scales with the number of threads,
+compared to serializing all lookups on a mutex. */
+
+#include "bench.h"
+
+#include "gtr.h"
+
+#define CATALOG "libgtr_bench_threads.mo"
+
+typedef struct worker
+{
+	libgtr_t *gtr;
+	/* mutex to take around every lookup, or NULL */
+	bench_mutex_t *mutex;
+	libgtr_key_t *keys;
+	unsigned int key_count;
+	unsigned int offset;
+	unsigned int lookups;
+	size_t found;
+} worker_t;
+
+static void work(void *arg)
+{
+	worker_t *w = arg;
+	size_t found = 0;
+	for (unsigned int i = 0; i < w->lookups; ++i)
+	{
+		libgtr_key_t *key = &w->keys[(w->offset + i) % w->key_count];
+		if (w->mutex)
+			bench_mutex_lock(w->mutex);
+		found += libgtr_get_translation_key(w->gtr, "bench", key, 1) !=
+			NULL;
+		if (w->mutex)
+			bench_mutex_unlock(w->mutex);
+	}
+	w->found = found;
+}
+
+/* Run lookups on the given number of threads, and return the total
+throughput in lookups per second. */
+static double run(libgtr_t *gtr, bench_mutex_t *mutex, libgtr_key_t *keys,
+	unsigned int key_count, unsigned int threads, unsigned int lookups)
+{
+	worker_t *workers = calloc(threads, sizeof(worker_t));
+	bench_thread_t *handles = calloc(threads, sizeof(bench_thread_t));
+	if (!workers || !handles)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	double start = bench_now();
+	for (unsigned int t = 0; t < threads; ++t)
+	{
+		workers[t].gtr = gtr;
+		workers[t].mutex = mutex;
+		workers[t].keys = keys;
+		workers[t].key_count = key_count;
+		workers[t].offset = t * (key_count / threads);
+		workers[t].lookups = lookups;
+		if (bench_thread_create(&handles[t], work, &workers[t]) != 0)
+		{
+			fprintf(stderr, "failed to start thread\n");
+			exit(1);
+		}
+	}
+	for (unsigned int t = 0; t < threads; ++t)
+		bench_thread_join(handles[t]);
+	double elapsed = bench_now() - start;
+
+	free(handles);
+	free(workers);
+	return (double)threads * lookups / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 10000;
+	unsigned int lookups = argc > 2 ? (unsigned int)atoi(argv[2]) :
+		2000000;
+	unsigned int max_threads = argc > 3 ? (unsigned int)atoi(argv[3]) :
+		bench_cpu_count();
+
+	if (bench_write_catalog(CATALOG, count,
+		"nplurals=2; plural=(n != 1);", 2) != 0)
+	{
+		fprintf(stderr, "failed to write catalog\n");
+		return 1;
+	}
+
+	libgtr_t *gtr = libgtr_new();
+	if (libgtr_load_msgcat_file(gtr, "bench", CATALOG) != GTREOK)
+	{
+		fprintf(stderr, "failed to load catalog\n");
+		return 1;
+	}
+
+	char (*msgids)[64] = malloc(count * sizeof(*msgids));
+	libgtr_key_t *keys = malloc(count * sizeof(libgtr_key_t));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		unsigned int s = (unsigned int)(i * 2654435761u) % count;
+		bench_msgid(msgids[i], sizeof(msgids[i]), s);
+		libgtr_key_init(&keys[i], msgids[i]);
+	}
+
+	bench_mutex_t mutex;
+	bench_mutex_init(&mutex);
+
+	printf("%u strings, %u lookups per thread\n", count, lookups);
+	printf("threads   lock-free M/s   mutex M/s\n");
+	for (unsigned int threads = 1; threads <= max_threads; )
+	{
+		double lock_free = run(gtr, NULL, keys, count, threads, lookups);
+		double locked = run(gtr, &mutex, keys, count, threads, lookups);
+		printf("%7u   %13.2f   %9.2f\n", threads,
+			lock_free * 1e-6, locked * 1e-6);
+		/* Double the thread count, but always end with all of them. */
+		if (threads < max_threads && threads * 2 > max_threads)
+			threads = max_threads;
+		else
+			threads *= 2;
+	}
+
+	bench_mutex_destroy(&mutex);
+	free(keys);
+	free(msgids);
+	libgtr_destroy(gtr);
+	remove(CATALOG);
+	return 0;
+}
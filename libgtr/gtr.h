@@ -23,11 +23,19 @@ can load message catalogs (.mo files) from memory or arbitrary
 filesystem locations.
 */
 
-/* Thread safety: Unless specified otherwise, operations on the same
-libgtr_t instance must be externally serialized. Operations on
-different libgtr_t instances may be issued simultaneously. */
+/* Thread safety: Translation lookups never block, other than on the
+on-demand loader (see libgtr_set_msgcat_loader), and may be issued from
+any number of threads at once, also while other threads load or
+unload domains. Loading and unloading is serialized internally. A
+returned translation stays valid until its domain is unloaded or
+reloaded; see libgtr_read_begin for holding on to it safely.
+libgtr_set_msgcat_loader must be called before the instance is shared
+between threads, and libgtr_destroy after all other operations have
+finished. Operations on different libgtr_t instances are independent.
+*/
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
 Potential error return codes from the library.
@@ -50,6 +58,54 @@ Potential error return codes from the library.
 /* Not supported */
 #define GTRENOTSUPP (-129)
 
+/*
+Flags modifying how message catalogs are loaded.
+*/
+
+/* Answer lookups from the hash table stored inside the message catalog
+instead of building an index at load time. Catalogs that were written
+without a hash table are indexed as usual. */
+#define GTRF_MO_HASH 0x0001
+/* Index the strings of a message catalog with a minimal perfect hash
+function instead of a general purpose hash table. This takes a little
+longer to build, but uses far less memory and needs only a single probe
+per lookup. */
+#define GTRF_PERFECT_HASH 0x0002
+/* Only check the header of a message catalog when loading it, and build
+the string index on the first lookup in the domain instead. This makes
+loading domains that are never used cheap. Errors in the string tables
+are only found by that first lookup; if there are any, the domain acts
+as if it had no translations. */
+#define GTRF_LAZY_INDEX 0x0008
+/* Keep the perfect hash index of a message catalog loaded from a file in
+an index file next to it (the name of the catalog with ".gtri"
+appended), and map that file instead of building the index when the
+catalog is loaded again. Index files that don't match the catalog, or
+are damaged, are replaced. Implies GTRF_PERFECT_HASH; catalogs with this
+flag are always indexed at load time, even with GTRF_LAZY_INDEX. */
+#define GTRF_INDEX_FILE 0x0010
+/* Share the perfect hash index of a message catalog loaded from a file
+with other processes that load the same file with this flag. The first
+process to load it publishes its index in named shared memory, and the
+others map that read-only instead of building their own. Indexes of
+outdated catalogs are replaced. Implies GTRF_PERFECT_HASH; like
+GTRF_INDEX_FILE, catalogs are always indexed at load time. */
+#define GTRF_SHARED_INDEX 0x0020
+/* Put a small filter in front of the string index of a message catalog
+that rejects most msgids the catalog doesn't have without probing the
+index. This speeds up lookups that usually miss, like those in domains
+that are searched before others, at the cost of about 2 to 4 bytes per
+string. Only the default index uses a filter; with GTRF_MO_HASH or
+GTRF_PERFECT_HASH, misses already cost a single probe. */
+#define GTRF_MISS_FILTER 0x0040
+/* Count the hits and misses of lookups in domains loaded with this flag,
+see libgtr_get_domain_stats. Domains made of several catalogs count
+lookups in all of them together, and keep counting when catalogs are
+attached or detached. Threads that look up strings in the same
+domain at the same time update the same counters, which slows them
+down. */
+#define GTRF_LOOKUP_STATS 0x0080
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -58,11 +114,46 @@ extern "C"
 /* Handle to a library instance. */
 typedef struct libgtr libgtr_t;
 
+/*
+A msgid prepared for repeated lookups. Initialize keys with
+libgtr_key_init or libgtr_key_init_ctx, or statically from a string
+literal with LIBGTR_KEY. All fields except msgid and len are private to
+libgtr. Statically initialized keys compute their hash values on first
+use and store them in the key, so they must not be declared const.
+*/
+typedef struct libgtr_key
+{
+	const char *msgid;
+	size_t len;
+
+	unsigned int hashed;
+	uint32_t mo_hash;
+	uint64_t hash;
+	/* message context, or NULL */
+	const char *ctxt;
+	size_t ctxt_len;
+} libgtr_key_t;
+
+#define LIBGTR_KEY(msgid) { (msgid), sizeof(msgid) - 1, 0, 0, 0, NULL, 0 }
+
+/*
+Handle to a domain of a library instance, see libgtr_domain_ref.
+*/
+typedef struct libgtr_domain_ref libgtr_domain_ref_t;
+
 /* Create a new instance of libgtr */
 libgtr_t *libgtr_new(void);
 /* Free allocated resources of libgtr */
 void libgtr_destroy(libgtr_t*);
 
+/*
+Set the GTRF_* flags to use for message catalogs loaded after this call.
+Catalogs that are already loaded are not affected.
+Returns 0 if the flags were successfully set, or nonzero in case of
+error.
+*/
+int libgtr_set_flags(libgtr_t*, unsigned int flags);
+
 /*
 Load a message catalog into a domain from a file. If the domain did not
 exist before, create it.
@@ -86,6 +177,35 @@ already has a catalog attached, the function will return GTREEXIST.
 int libgtr_load_msgcat_mem(libgtr_t*, const char *domain, size_t size,
 	const void *data);
 
+/* Ownership of the buffer passed to libgtr_load_msgcat_mem_ex */
+/* Copy the buffer, like libgtr_load_msgcat_mem */
+#define GTRM_COPY 0
+/* Use the buffer in place. The caller keeps it valid and unchanged until
+the domain is unloaded, or the library instance destroyed. */
+#define GTRM_BORROW 1
+/* Use the buffer in place, and release it with the free callback once
+the domain is unloaded. */
+#define GTRM_TAKE 2
+
+/*
+Signature of a callback releasing a buffer loaded with GTRM_TAKE.
+*/
+typedef void (*libgtr_free_cb)(void *data, size_t size, void *opaque);
+/*
+Load a message catalog into a domain from a memory buffer, like
+libgtr_load_msgcat_mem, without necessarily copying it. mode is one of
+the GTRM_* constants. With GTRM_TAKE, free_cb is called with data, size
+and opaque when libgtr no longer needs the buffer; it may be called from
+any thread. Buffers used in place must be aligned to 4 bytes.
+Ownership only passes to libgtr if the function succeeds; if it fails,
+the buffer still belongs to the caller.
+Returns 0 if the message catalog was successfully loaded, or nonzero in
+case of error.
+*/
+int libgtr_load_msgcat_mem_ex(libgtr_t*, const char *domain, size_t size,
+	const void *data, unsigned int mode, libgtr_free_cb free_cb,
+	void *opaque);
+
 /*
 Unload a domain. This will remove all attached message catalogs. If an
 on-demand domain loader is registered, it will be invoked next time a
@@ -95,6 +215,171 @@ in case of error.
 */
 int libgtr_unload_domain(libgtr_t*, const char *domain);
 
+/*
+Replace the message catalog of a domain with one loaded from a file. If
+the domain did not exist before, create it. Lookups keep using the old
+catalog until the new one is fully loaded, and never see the domain
+unloaded in between. The old catalog is freed once no thread is using it
+anymore.
+Domains made of several catalogs, with libgtr_attach_msgcat_file or
+libgtr_load_msgcat_chain, can't be reloaded this way; attach and detach
+their layers, or unload the domain first.
+Returns 0 if the message catalog was successfully loaded, or nonzero in
+case of error (GTREEXIST for domains made of several catalogs). On
+error, the old catalog stays in place.
+*/
+int libgtr_reload_domain(libgtr_t*, const char *domain, const char *file);
+
+/*
+Remove the shared index of a message catalog file (see
+GTRF_SHARED_INDEX), for example when uninstalling it. Processes that use
+the index keep it until they unload the catalog. Not supported on
+Windows, where shared indexes go away with the last process using them.
+Returns 0 if the index was removed, GTRENOENT if there was none, or
+another nonzero value in case of error.
+*/
+int libgtr_remove_shared_index(const char *file);
+
+/*
+Attach a message catalog from a file to a domain as a named layer. A
+domain can have several layers; lookups find each string in the layer
+attached last that has it, through a single index over all of them.
+Translations use the plural rule of the catalog they come from. Lookups
+see the new layer only once it is fully attached. Domains loaded with
+libgtr_load_msgcat_* can't take layers, and layers only go to domains
+that have none or already have some.
+Returns 0 if the catalog was successfully attached, GTREEXIST if the
+domain already has a layer with that name or a single catalog, or
+another nonzero value in case of error.
+*/
+int libgtr_attach_msgcat_file(libgtr_t*, const char *domain,
+	const char *layer, const char *file);
+/*
+Detach a layer from a domain. Detaching the last layer unloads the
+domain. Like unloading, this waits for lookups that may still use it.
+Returns 0 if the layer was detached, GTRENOENT if the domain has no such
+layer, or another nonzero value in case of error.
+*/
+int libgtr_detach_msgcat(libgtr_t*, const char *domain, const char *layer);
+/*
+Load the catalogs of a locale fallback chain as one domain, like
+"de_AT", then "de". Lookups find each string in the first catalog of the
+chain that has it, at the cost of a single lookup. Files of the chain
+that don't exist are skipped. The domain can't take layers.
+Returns 0 if the chain was successfully loaded, GTRENOENT if none of the
+files exist, or a nonzero value in case of error.
+*/
+int libgtr_load_msgcat_chain(libgtr_t*, const char *domain,
+	const char *const *files, size_t count);
+
+/*
+A message catalog to load with libgtr_load_msgcat_files.
+*/
+typedef struct libgtr_msgcat_file
+{
+	const char *domain;
+	const char *file;
+	/* set to the result of loading this catalog */
+	int result;
+} libgtr_msgcat_file_t;
+/*
+Load many message catalogs from files at once. The files are mapped and
+indexed in parallel on the given number of threads (including the
+calling one; 0 uses one thread per processor), then all catalogs that
+loaded successfully are added in a single step. Each entry receives its
+own result, like from libgtr_load_msgcat_file.
+Returns 0 if all message catalogs were successfully loaded, or the first
+nonzero result otherwise.
+*/
+int libgtr_load_msgcat_files(libgtr_t*, libgtr_msgcat_file_t *files,
+	size_t count, unsigned int threads);
+
+/*
+Mount a bundle file: many message catalogs packed into one file with
+libgtr_write_bundle. The whole bundle is mapped at once, but the domains
+in it are only set up when they are first used, like with the on-demand
+loader, which is only asked for domains that aren't in any bundle. If
+several bundles contain the same domain, the one mounted last wins.
+Domains that are already loaded aren't taken from bundles. Bundles stay
+mounted for the lifetime of the library instance.
+Returns 0 if the bundle was successfully mounted, or nonzero in case of
+error.
+*/
+int libgtr_load_bundle(libgtr_t*, const char *file);
+/*
+Pack message catalogs into a bundle file for libgtr_load_bundle,
+together with their string indexes. The domain of each entry is the name
+of the domain it is mounted as; there is no separate notion of locales,
+so bundles with several locales use names like "de_AT/messages". Each
+entry receives the result of loading its catalog, like from
+libgtr_load_msgcat_file. The bundle is only written if all of them
+loaded, and every domain name is unique.
+Returns 0 if the bundle was successfully written, or nonzero in case of
+error.
+*/
+int libgtr_write_bundle(const char *file, libgtr_msgcat_file_t *catalogs,
+	size_t count);
+
+/*
+Signature of a callback notified when a background load has finished.
+result is 0 if the message catalog was successfully loaded, or nonzero
+in case of error. The callback runs on a worker thread of the library.
+*/
+typedef void (*libgtr_load_done_cb)(libgtr_t*, const char *domain,
+	int result, void *opaque);
+/*
+Load a message catalog into a domain from a file, like
+libgtr_load_msgcat_file, but on a worker thread of the library instance.
+The callback, if any, is invoked once loading has finished. Until then,
+lookups in the domain fail as if it had no translations, unless they
+are allowed to wait for it (see libgtr_set_load_timeout).
+libgtr_destroy waits for all queued loads to finish.
+Returns 0 if the load was queued, or nonzero in case of error.
+*/
+int libgtr_load_msgcat_file_async(libgtr_t*, const char *domain,
+	const char *file, libgtr_load_done_cb callback, void *opaque);
+/*
+Set the number of worker threads for background loads. The default is
+one. The number of threads can only be increased.
+Returns 0 if the number was successfully set, or nonzero in case of
+error.
+*/
+int libgtr_set_load_threads(libgtr_t*, unsigned int count);
+
+/* Timeout for libgtr_set_load_timeout that never expires */
+#define LIBGTR_WAIT_FOREVER ((unsigned int)-1)
+/*
+Set how long lookups wait for a domain that is being loaded by another
+thread or in the background, in milliseconds. When the timeout expires,
+the lookup fails as if the domain had no translations. The default is 0:
+lookups don't wait, so they never block on a slow load.
+Returns 0 if the timeout was successfully set, or nonzero in case of
+error.
+*/
+int libgtr_set_load_timeout(libgtr_t*, unsigned int milliseconds);
+
+/*
+Begin a read section. Translations returned by lookups stay valid until
+the matching call to libgtr_read_end, even if their domain is unloaded
+or reloaded by another thread in the meantime; unloading and reloading
+wait for the section to end. Read sections may be nested, but the thread
+must not load, reload or unload domains inside one.
+Returns a token to pass to libgtr_read_end.
+*/
+unsigned int libgtr_read_begin(libgtr_t*);
+/* End a read section started by libgtr_read_begin. */
+void libgtr_read_end(libgtr_t*, unsigned int token);
+
+/*
+Resolve a domain name to a handle that can be used for repeated lookups
+without finding the domain by name every time. The domain does not need
+to be loaded yet. A handle stays valid for the lifetime of the library
+instance and always refers to whatever catalog is currently loaded into
+the domain, so it remains usable across unloading and reloading.
+Returns NULL in case of error.
+*/
+libgtr_domain_ref_t *libgtr_domain_ref(libgtr_t*, const char *domain);
+
 /*
 Signature of a domain loader callback.
 Should return 0 if the domain was successfully loaded, or nonzero in
@@ -107,6 +392,13 @@ Define a callback to be invoked when libgtr needs to load specific
 domain. The callback should use one of the libgtr_load_msgcat_*
 functions to load the catalog. If no callback is installed, libgtr will
 not load domains on demand.
+When several threads need the same domain at once, the callback runs in
+only one of them. The others fail as if the domain had no translations,
+unless they are allowed to wait for it (see libgtr_set_load_timeout).
+The callback must not look up translations from the domain it loads.
+Domains the callback fails to load are remembered, so lookups in them
+don't call it again, until the domain is unloaded or another callback is
+installed. Only a limited number of them is remembered.
 Returns 0 if the callback was successfully installed, or nonzero in case
 of error.
 */
@@ -123,6 +415,106 @@ found, the return value is NULL.
 const char *libgtr_get_translation(libgtr_t*, const char *domain,
 	const char *msgid, int n);
 
+/*
+Return a translation like libgtr_get_translation, for a domain given as
+a handle from libgtr_domain_ref.
+*/
+const char *libgtr_get_translation_ref(libgtr_t*,
+	libgtr_domain_ref_t *domain, const char *msgid, int n);
+
+/*
+Return a translation like libgtr_get_translation, for a msgid with a
+message context (msgctxt). A NULL ctxt looks up the msgid without a
+context.
+*/
+const char *libgtr_get_translation_ctx(libgtr_t*, const char *domain,
+	const char *ctxt, const char *msgid, int n);
+
+/*
+Prepare a key for msgid. The key refers to msgid, which has to stay
+valid for as long as the key is used.
+*/
+void libgtr_key_init(libgtr_key_t *key, const char *msgid);
+/*
+Prepare a key for msgid in a message context, like libgtr_key_init. The
+key refers to both strings.
+*/
+void libgtr_key_init_ctx(libgtr_key_t *key, const char *ctxt,
+	const char *msgid);
+
+/*
+Return a translation like libgtr_get_translation, for a msgid given as a
+key. This skips measuring and hashing the msgid on every call.
+*/
+const char *libgtr_get_translation_key(libgtr_t*, const char *domain,
+	libgtr_key_t *key, int n);
+/*
+Return a translation for a domain given as a handle and a msgid given as
+a key.
+*/
+const char *libgtr_get_translation_ref_key(libgtr_t*,
+	libgtr_domain_ref_t *domain, libgtr_key_t *key, int n);
+
+/*
+Return a translation like libgtr_get_translation, and store its length
+in *len, without the terminating NUL. The lengths come from the catalog,
+so callers that copy translations don't need to measure them again. If
+there is no translation, *len is set to 0.
+*/
+const char *libgtr_get_translation_len(libgtr_t*, const char *domain,
+	const char *msgid, int n, size_t *len);
+/*
+Return a translation and its length like libgtr_get_translation_len, for
+a msgid given as a key.
+*/
+const char *libgtr_get_translation_key_len(libgtr_t*, const char *domain,
+	libgtr_key_t *key, int n, size_t *len);
+
+/*
+Look up the translations of msgid for count numbers at once, like
+calling libgtr_get_translation with each of ns[0] to ns[count - 1], and
+store them in out[0] to out[count - 1]. The domain and the string are
+only looked up once.
+Returns 0 on success, or nonzero in case of error.
+*/
+int libgtr_get_translations_n(libgtr_t*, const char *domain,
+	const char *msgid, const int *ns, size_t count, const char **out);
+/*
+Look up the translations of count msgids at once, like calling
+libgtr_get_translation with msgids[i] and ns[i], and store them in
+out[i]. If ns is NULL, 1 is used for every msgid. Lookups of different
+msgids are overlapped, which is faster than looking them up one by one.
+Returns 0 on success, or nonzero in case of error.
+*/
+int libgtr_get_translations(libgtr_t*, const char *domain,
+	const char *const *msgids, const int *ns, size_t count,
+	const char **out);
+
+/*
+Lookup statistics of a domain, see libgtr_get_domain_stats.
+*/
+typedef struct libgtr_domain_stats
+{
+	/* lookups that found the string */
+	uint64_t hits;
+	/* lookups that didn't */
+	uint64_t misses;
+	/* misses that the filter of GTRF_MISS_FILTER answered without
+	probing the string index */
+	uint64_t filtered;
+} libgtr_domain_stats_t;
+
+/*
+Get the lookup statistics of a domain loaded with GTRF_LOOKUP_STATS.
+The counts start over when the domain is reloaded. This does not load
+the domain.
+Returns 0 on success, GTRENOENT if the domain isn't loaded, GTRENOTSUPP
+if it doesn't keep statistics, or another nonzero value in case of
+error.
+*/
+int libgtr_get_domain_stats(libgtr_t*, const char *domain,
+	libgtr_domain_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
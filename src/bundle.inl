@@ -0,0 +1,178 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* bundles: many message catalogs packed into one file together with
+their perfect hash indexes, so a process can map all of them at once.
+Domains are only set up from a mounted bundle when they are first used.
+*/
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* "GTRB" in little endian order. Like index files, bundles are written
+in host byte order; bundles from hosts with the other order are refused.
+*/
+#define GTRB_MAGIC 0x42525447
+#define GTRB_VERSION 1
+/* Alignment of the catalogs and indexes inside a bundle */
+#define GTRB_ALIGN 8
+
+/* Header of a bundle. The directory follows it directly, sorted by
+domain name, then the names, then the catalogs and their indexes. All
+offsets are from the start of the bundle. */
+typedef struct libgtr_gtrb_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t reserved;
+	uint64_t size;
+} libgtr_gtrb_header_t;
+
+/* Directory entry of a bundle. Names are NUL-terminated; name_size
+doesn't include the NUL. Indexes are laid out like index files (see
+indexfile.inl), with a modification time of 0. Entries without an index
+have an index_size of 0. */
+typedef struct libgtr_gtrb_entry
+{
+	uint32_t name_offset;
+	uint32_t name_size;
+	uint32_t mo_offset;
+	uint32_t mo_size;
+	uint32_t index_offset;
+	uint32_t index_size;
+} libgtr_gtrb_entry_t;
+
+static const libgtr_gtrb_entry_t *_gtrb_entries(const libgtr_bundle_t *b)
+{
+	return (const libgtr_gtrb_entry_t*)
+		((const libgtr_gtrb_header_t*)b->data + 1);
+}
+
+static const char *_gtrb_name(const libgtr_bundle_t *bundle,
+	const libgtr_gtrb_entry_t *entry)
+{
+	return (const char*)bundle->data + entry->name_offset;
+}
+
+/* Check whether a block of size bytes at offset lies inside the bundle.
+*/
+static bool _gtrb_contains(size_t bundle_size, uint32_t offset,
+	uint32_t size, size_t align)
+{
+	return offset % align == 0 && offset <= bundle_size &&
+		size <= bundle_size - offset;
+}
+
+/* Validate the header and directory of a bundle, so lookups can trust
+them. The catalogs themselves are checked when their domains are set up,
+like any other catalog. */
+static int _gtrb_check(const void *data, size_t size)
+{
+	const libgtr_gtrb_header_t *hdr = data;
+	if (size < sizeof(*hdr) || hdr->magic != GTRB_MAGIC)
+		return GTREINVAL;
+	if (hdr->version != GTRB_VERSION)
+		return GTRENOTSUPP;
+	if (hdr->size != size || hdr->entry_count >
+		(size - sizeof(*hdr)) / sizeof(libgtr_gtrb_entry_t))
+	{
+		return GTREINVAL;
+	}
+
+	const libgtr_gtrb_entry_t *entries =
+		(const libgtr_gtrb_entry_t*)(hdr + 1);
+	const char *prev = NULL;
+	for (uint32_t i = 0; i < hdr->entry_count; ++i)
+	{
+		const libgtr_gtrb_entry_t *e = &entries[i];
+		if (!_gtrb_contains(size, e->name_offset, e->name_size, 1) ||
+			e->name_size == size - e->name_offset ||
+			!_gtrb_contains(size, e->mo_offset, e->mo_size, GTRB_ALIGN) ||
+			!_gtrb_contains(size, e->index_offset, e->index_size,
+				GTRB_ALIGN))
+		{
+			return GTREINVAL;
+		}
+		const char *name = (const char*)data + e->name_offset;
+		if (name[e->name_size] != '\0' ||
+			strlen(name) != e->name_size ||
+			(prev && strcmp(prev, name) >= 0))
+		{
+			return GTREINVAL;
+		}
+		prev = name;
+	}
+	return GTREOK;
+}
+
+/* Find the directory entry of a domain in a bundle. */
+static const libgtr_gtrb_entry_t *_gtrb_find(const libgtr_bundle_t *bundle,
+	const char *name)
+{
+	const libgtr_gtrb_entry_t *entries = _gtrb_entries(bundle);
+	uint32_t lo = 0;
+	uint32_t hi = ((const libgtr_gtrb_header_t*)bundle->data)->entry_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name, _gtrb_name(bundle, &entries[mid]));
+		if (cmp == 0)
+			return &entries[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* Find a domain in the bundles mounted into a library instance, latest
+first. Bundles are never removed, so this is safe without any lock. */
+static const libgtr_gtrb_entry_t *_gtr_bundle_find(libgtr_t *gtr,
+	const char *name, libgtr_bundle_t **bundle)
+{
+	for (libgtr_bundle_t *b = GTR_ATOMIC_LOAD_PTR(&gtr->bundles);
+		b != NULL; b = b->next)
+	{
+		const libgtr_gtrb_entry_t *entry = _gtrb_find(b, name);
+		if (entry)
+		{
+			*bundle = b;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Drop a reference to a bundle: the library instance holds one, and so
+does every domain set up from it. Also used as the libgtr_free_cb of
+those domains. */
+static void _gtrb_release(void *data, size_t size, void *opaque)
+{
+	(void)data;
+	(void)size;
+	libgtr_bundle_t *bundle = opaque;
+	if (_gtr_atomic_add_u32(&bundle->refs, (uint32_t)-1) == 1)
+	{
+		_gtr_unmap_file(bundle->data, bundle->size);
+		free(bundle);
+	}
+}
@@ -0,0 +1,226 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* file access for libgtr: read-only mappings and atomic replacement */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+/* Convert a file name from UTF-8 to a wide string. Returns NULL if the
+name isn't valid UTF-8 or there's not enough memory. */
+static LPWSTR _gtr_widen(const char *file)
+{
+	int file_w_sz = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+		file, -1, NULL, 0);
+	if (file_w_sz == 0)
+		return NULL;
+
+	LPWSTR file_w = malloc(sizeof(WCHAR) * file_w_sz);
+	if (!file_w)
+		return NULL;
+	MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+		file, -1, file_w, file_w_sz);
+	return file_w;
+}
+#endif
+
+/* Map a whole file into memory, read-only. mtime receives the time of
+the last modification, in some platform-specific unit. */
+static int _gtr_map_file(const char *file, void **data, size_t *size,
+	int64_t *mtime)
+{
+#if defined(_WIN32)
+	LPWSTR file_w = _gtr_widen(file);
+	if (!file_w)
+		return GTREINVAL;
+
+	HANDLE fh = CreateFileW(file_w, GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, 0, NULL);
+	free(file_w);
+	if (fh == INVALID_HANDLE_VALUE)
+		return GTRENOENT;
+
+	LARGE_INTEGER file_size;
+	FILETIME write_time;
+	if (!GetFileSizeEx(fh, &file_size) ||
+		!GetFileTime(fh, NULL, NULL, &write_time))
+	{
+		CloseHandle(fh);
+		return GTRENOMEM;
+	}
+	if (file_size.HighPart != 0)
+	{
+		/* We're not supporting files >4G for the moment. */
+		CloseHandle(fh);
+		return GTRENOMEM;
+	}
+	*size = file_size.LowPart;
+	*mtime = ((int64_t)write_time.dwHighDateTime << 32) |
+		write_time.dwLowDateTime;
+
+	/* Mapping the file into memory increases the reference count on the
+	file mapping object, so we don't have to keep a handle to it around.
+	*/
+	HANDLE mapping = CreateFileMapping(fh, NULL,
+		PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(fh);
+	if (mapping == NULL)
+		return GTRENOMEM;
+	*data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (*data == NULL)
+		return GTRENOMEM;
+	return GTREOK;
+#elif defined(__unix__)
+	int fh = open(file, O_RDONLY);
+	if (fh < 0)
+	{
+		switch (errno)
+		{
+		case EACCES: return GTREACCES;
+		default:
+		case ENOENT: return GTRENOENT;
+		}
+	}
+	/* Unfortunately there isn't a flag that says "map the whole file",
+	so we have to figure out how big it is first. */
+	struct stat st;
+	if (fstat(fh, &st) == -1)
+	{
+		close(fh);
+		return GTREACCES;
+	}
+	*size = st.st_size;
+	*mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+	*data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
+	close(fh);
+	if (*data == MAP_FAILED)
+	{
+		*data = NULL;
+		return GTRENOMEM;
+	}
+	return GTREOK;
+#else
+#error Some code for non-win32/non-UNIX systems should go here.
+#endif
+}
+
+static void _gtr_unmap_file(void *data, size_t size)
+{
+#if defined(_WIN32)
+	(void)size;
+	UnmapViewOfFile(data);
+#elif defined(__unix__)
+	munmap(data, size);
+#endif
+}
+
+/* Replace a file with the concatenation of count blocks of data. The
+data is written to a temporary file first, which is then renamed, so
+other processes either see the old file or the complete new one. */
+static int _gtr_replace_file(const char *file, const void *const *blocks,
+	const size_t *sizes, size_t count)
+{
+	static uint32_t serial;
+	size_t len = strlen(file);
+	char *tmp = malloc(len + 40);
+	if (!tmp)
+		return GTRENOMEM;
+#if defined(_WIN32)
+	snprintf(tmp, len + 40, "%s.%lu.%u.tmp", file,
+		(unsigned long)GetCurrentProcessId(),
+		_gtr_atomic_add_u32(&serial, 1));
+	LPWSTR file_w = _gtr_widen(file);
+	LPWSTR tmp_w = _gtr_widen(tmp);
+	free(tmp);
+	int result = GTRENOMEM;
+	if (!file_w || !tmp_w)
+		goto _gtr_replace_file_cleanup;
+
+	HANDLE fh = CreateFileW(tmp_w, GENERIC_WRITE, 0, NULL, CREATE_NEW,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	result = GTREACCES;
+	if (fh == INVALID_HANDLE_VALUE)
+		goto _gtr_replace_file_cleanup;
+	bool written = true;
+	for (size_t i = 0; i < count && written; ++i)
+	{
+		DWORD done;
+		written = WriteFile(fh, blocks[i], (DWORD)sizes[i], &done, NULL) &&
+			done == sizes[i];
+	}
+	CloseHandle(fh);
+	if (written &&
+		MoveFileExW(tmp_w, file_w, MOVEFILE_REPLACE_EXISTING))
+	{
+		result = GTREOK;
+	}
+	else
+	{
+		DeleteFileW(tmp_w);
+	}
+
+_gtr_replace_file_cleanup:
+	free(tmp_w);
+	free(file_w);
+	return result;
+#elif defined(__unix__)
+	snprintf(tmp, len + 40, "%s.%ld.%u.tmp", file, (long)getpid(),
+		_gtr_atomic_add_u32(&serial, 1));
+	int fh = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fh < 0)
+	{
+		free(tmp);
+		return GTREACCES;
+	}
+	bool written = true;
+	for (size_t i = 0; i < count && written; ++i)
+	{
+		const char *p = blocks[i];
+		size_t left = sizes[i];
+		while (left > 0)
+		{
+			ssize_t done = write(fh, p, left);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+			{
+				written = false;
+				break;
+			}
+			p += done;
+			left -= (size_t)done;
+		}
+	}
+	if (close(fh) != 0)
+		written = false;
+	int result = GTREOK;
+	if (!written || rename(tmp, file) != 0)
+	{
+		unlink(tmp);
+		result = GTREACCES;
+	}
+	free(tmp);
+	return result;
+#endif
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* filters that reject most msgids missing from a domain before the
+string index is probed */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <stdlib.h>
+
+/* Bits set per msgid. About 16 bits of filter per msgid and 6 bits each
+keep false positives well below 1%. */
+#define GTR_FILTER_BITS 6
+#define GTR_FILTER_KEYS_PER_WORD 4
+/* The word is picked with the top bits of the mixed hash, which leaves
+the bottom ones for the bits in the word. */
+#define GTR_FILTER_MAX_WORDS (UINT32_C(1) << 24)
+
+/* Create an empty filter with room for count msgids. */
+static libgtr_filter_t *_filter_new(uint32_t count)
+{
+	uint32_t words = 1;
+	while (words < GTR_FILTER_MAX_WORDS &&
+		words * GTR_FILTER_KEYS_PER_WORD < count)
+	{
+		words *= 2;
+	}
+	libgtr_filter_t *filter = calloc(1,
+		sizeof(libgtr_filter_t) + (size_t)words * sizeof(uint64_t));
+	if (filter)
+		filter->mask = words - 1;
+	return filter;
+}
+
+/* Filters use the same 32 bit hash as the descriptor table, so the
+hash values it already stores can fill them. */
+static uint64_t _filter_bits(const libgtr_filter_t *filter, unsigned hashv,
+	uint32_t *word)
+{
+	uint64_t h = _gtr_hash_mix(hashv ^ UINT64_C(0x2545f4914f6cdd1d));
+	*word = (uint32_t)(h >> 40) & filter->mask;
+	uint64_t bits = 0;
+	for (int i = 0; i < GTR_FILTER_BITS; ++i)
+		bits |= UINT64_C(1) << ((h >> (6 * i)) & 63);
+	return bits;
+}
+
+static void _filter_add(libgtr_filter_t *filter, unsigned hashv)
+{
+	uint32_t word;
+	uint64_t bits = _filter_bits(filter, hashv, &word);
+	filter->words[word] |= bits;
+}
+
+/* Returns false if the msgid with the given hash is certainly not in the
+filter. */
+static bool _filter_check(const libgtr_filter_t *filter, unsigned hashv)
+{
+	uint32_t word;
+	uint64_t bits = _filter_bits(filter, hashv, &word);
+	return (filter->words[word] & bits) == bits;
+}
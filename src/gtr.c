@@ -15,7 +15,8 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-#define _POSIX_C_SOURCE 200809L
+/* realpath is an XSI extension. */
+#define _XOPEN_SOURCE 700
 
 #include "../libgtr/gtr.h"
 #include "gtrP.h"
@@ -49,6 +50,8 @@
 #define MO_HDR_0_0_OFF_STRCOUNT (2 * sizeof(uint32_t))
 #define MO_HDR_0_0_OFF_OSTRTABLE (3 * sizeof(uint32_t))
 #define MO_HDR_0_0_OFF_TSTRTABLE (4 * sizeof(uint32_t))
+#define MO_HDR_0_0_OFF_HASHSIZE (5 * sizeof(uint32_t))
+#define MO_HDR_0_0_OFF_HASHTABLE (6 * sizeof(uint32_t))
 
 #define MO_STRDESC_SIZE (2 * sizeof(uint32_t))
 
@@ -58,8 +61,26 @@
 	((ULONG_MAX / fac2 < fac1 ? \
 	false : (*(prod) = fac1 * fac2)) || true)
 
+/* Synchronization of lookups with loading and unloading */
+#include "sync.inl"
 /* Plural evaluation */
 #include "plurals.inl"
+/* Lookups through the message catalog's hash table */
+#include "mohash.inl"
+/* Filters for strings that aren't in a domain */
+#include "filter.inl"
+/* Minimal perfect hash index */
+#include "mph.inl"
+/* File access */
+#include "file.inl"
+/* Persistent index files */
+#include "indexfile.inl"
+/* Indexes shared between processes */
+#include "shmindex.inl"
+/* Bundles of message catalogs */
+#include "bundle.inl"
+/* Merged indexes over several message catalogs */
+#include "overlay.inl"
 
 /* Internal domain handling functions */
 /* Create and initialize a new, empty domain. */
@@ -75,27 +96,41 @@ static libgtr_domain_t *_domain_new(const char *name)
 		free(dom);
 		return NULL;
 	}
+	_gtr_mutex_init(&dom->index_lock);
 
 	return dom;
 }
 
 /* Free all resources allocated for a domain. */
+static void _gtr_layer_release(libgtr_layer_t *layer);
+
 static void _domain_free(libgtr_domain_t *domain)
 {
 	if (!domain)
 		return;
 
-	libgtr_plural_expr_free(domain->plural_expr);
+	if (domain->overlay)
+	{
+		for (uint32_t l = 0; l < domain->overlay->layer_count; ++l)
+		{
+			if (domain->overlay->layers[l])
+				_gtr_layer_release(domain->overlay->layers[l]);
+		}
+		_overlay_free(domain->overlay);
+	}
+
+	libgtr_plural_rule_release(domain->plural_rule);
 
 	if (domain->mmaped)
 	{
-#if defined(_WIN32)
-		UnmapViewOfFile(domain->data);
-#elif defined(UNIX)
-		munmap(domain->data, domain->data_size);
-#endif
+		_gtr_unmap_file(domain->data, domain->data_size);
 	}
-	else
+	else if (domain->data_free)
+	{
+		domain->data_free(domain->data, domain->data_size,
+			domain->data_free_opaque);
+	}
+	else if (!domain->borrowed)
 	{
 		free(domain->data);
 	}
@@ -103,12 +138,20 @@ static void _domain_free(libgtr_domain_t *domain)
 	free(domain->name);
 	HASH_CLEAR(hh, domain->strings);
 	free(domain->string_descriptor_block);
+	free(domain->filter);
+	free(domain->stats);
+	free(domain->mph);
+	if (domain->index_map)
+		_gtr_unmap_file(domain->index_map, domain->index_map_size);
+	_gtr_mutex_destroy(&domain->index_lock);
 	free(domain);
 }
 
-/* Parse the plural specification out of a message catalog header. */
+/* Find the plural specification in a message catalog header. The
+expression is left to libgtr_plural_rule_acquire, which only parses it
+if no other catalog uses the same one. */
 static int _domain_parse_plurals(const char *str,
-	uint32_t *plural_count, libgtr_plural_expr_t **plural_expr)
+	uint32_t *plural_count, const char **plural_spec)
 {
 #define NPLURALS "nplurals="
 #define PLURALS "plural="
@@ -118,48 +161,60 @@ static int _domain_parse_plurals(const char *str,
 	{
 		*plural_count = strtoul(nplural_str + sizeof(NPLURALS) - 1,
 			NULL, 10);
-		*plural_expr = _plural_expr_parse(
-			plurals_str + sizeof(PLURALS) - 1);
-	}
-	if (*plural_count == 0 || *plural_expr == NULL)
-	{
-		*plural_count = 2;
-		*plural_expr = NULL;
+		*plural_spec = plurals_str + sizeof(PLURALS) - 1;
 	}
+	if (*plural_count == 0)
+		*plural_spec = NULL;
 	return GTREOK;
 #undef PLURALS
 #undef NPLURALS
 }
 
-#define READ_DOM_DATA(type, off) \
-	(*((type*)((char*)domain->data + (off))))
 #define READ_DOM_STR(off) \
 	(memchr((char*)domain->data + (off), 0, domain->data_size - (off))\
 	? (char*)domain->data + (off) : NULL)
 #define READ_DOM_STR_DESC(off, s, d) \
 	do { \
-		uint32_t soffs = READ_DOM_DATA(uint32_t, (off) + sizeof(uint32_t)); \
-		s = READ_DOM_DATA(uint32_t, (off)); \
+		uint32_t soffs = _mo_read_u32(domain, (off) + sizeof(uint32_t)); \
+		s = _mo_read_u32(domain, (off)); \
 		d = READ_DOM_STR(soffs); \
 	} while(0)
+/* Return the lengths of the plural forms of a string descriptor. */
+static uint32_t *_descriptor_lengths(
+	const libgtr_string_descriptor_t *descriptor,
+	const libgtr_domain_t *domain)
+{
+	return (uint32_t*)&descriptor->msgstr[domain->plurals];
+}
+
 /* Read the message catalog string descriptor table. */
 static int _domain_parse_string_table(libgtr_domain_t *domain,
 	uint32_t count, uint32_t ost_offset, uint32_t tst_offset)
 {
 	assert(domain);
 
-	uint32_t *ost = (uint32_t*)((char*)domain->data + ost_offset);
-	uint32_t *tst = (uint32_t*)((char*)domain->data + tst_offset);
 	const char *end = (char*)domain->data + domain->data_size;
 
 	/* We know how many plural forms there are, and we know how many
 	messages to parse. Allocate one big memory block to store the hash
-	table. */
+	table. The lengths of the forms come right after their pointers;
+	the .mo format limits strings to 32 bits. */
 	size_t descriptor_size = sizeof(libgtr_string_descriptor_t) +
-		sizeof(char*) * domain->plurals;
+		sizeof(char*) * domain->plurals +
+		sizeof(uint32_t) * domain->plurals;
+	descriptor_size = (descriptor_size + sizeof(char*) - 1) &
+		~(sizeof(char*) - 1);
 	
 	char *descriptor_block = calloc(count, descriptor_size);
+	if (count != 0 && !descriptor_block)
+		return GTRENOMEM;
 	domain->string_descriptor_block = descriptor_block;
+	if (domain->index_flags & GTRF_MISS_FILTER)
+	{
+		domain->filter = _filter_new(count);
+		if (!domain->filter)
+			return GTRENOMEM;
+	}
 	
 	int result = GTREOK;
 	/* Fill the hash table. */
@@ -169,8 +224,10 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 			(libgtr_string_descriptor_t*)descriptor_block;
 		
 		/* untranslated string */
-		uint32_t os_size = ost[i * 2 + 0];
-		const char *os_data = (char*)domain->data + ost[i * 2 + 1];
+		size_t os_desc = ost_offset + (size_t)i * MO_STRDESC_SIZE;
+		uint32_t os_size = _mo_read_u32(domain, os_desc);
+		const char *os_data = (char*)domain->data +
+			_mo_read_u32(domain, os_desc + sizeof(uint32_t));
 		/* The length of the untranslated string contains the
 		untranslated plural form. That form is only of interest for
 		decompiling the .mo file, which we don't do. */
@@ -178,9 +235,12 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 		descriptor->msgid = os_data;
 
 		/* translated strings */
-		uint32_t ts_size = tst[i * 2 + 0];
-		const char *ts_base = (char*)domain->data + tst[i * 2 + 1];
+		size_t ts_desc = tst_offset + (size_t)i * MO_STRDESC_SIZE;
+		uint32_t ts_size = _mo_read_u32(domain, ts_desc);
+		const char *ts_base = (char*)domain->data +
+			_mo_read_u32(domain, ts_desc + sizeof(uint32_t));
 		const char *ts_data = ts_base;
+		uint32_t *lengths = _descriptor_lengths(descriptor, domain);
 
 		for (uint32_t p = 0; p < domain->plurals; ++p)
 		{
@@ -190,6 +250,9 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 			on lookup. */
 			descriptor->msgstr[p] = ts_data;
 			ts_data = memchr(ts_data, '\0', ts_base + ts_size - ts_data);
+			/* The last form ends at the end of the string. */
+			lengths[p] = (uint32_t)((ts_data ? ts_data : ts_base + ts_size) -
+				descriptor->msgstr[p]);
 			if (!ts_data)
 			{
 				/* We ran out of plurals. Fill the rest of the plural
@@ -197,6 +260,7 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 				for (uint32_t p2 = p + 1; p2 < domain->plurals; ++p2)
 				{
 					descriptor->msgstr[p2] = ts_base;
+					lengths[p2] = lengths[0];
 				}
 				break;
 			}
@@ -217,6 +281,8 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 		HASH_ADD_KEYPTR(hh, domain->strings,
 			os_data, os_size,
 			descriptor);
+		if (domain->filter)
+			_filter_add(domain->filter, descriptor->hh.hashv);
 
 		descriptor_block += descriptor_size;
 	}
@@ -225,17 +291,89 @@ static int _domain_parse_string_table(libgtr_domain_t *domain,
 
 _domain_parse_string_table_err:
 	HASH_CLEAR(hh, domain->strings);
-	free(descriptor_block);
+	free(domain->string_descriptor_block);
 	domain->string_descriptor_block = NULL;
+	free(domain->filter);
+	domain->filter = NULL;
+	return result;
+}
+
+/* Build the string index of a domain whose header has been parsed. */
+static int _domain_build_index(libgtr_domain_t *domain)
+{
+	int result = GTRENOTSUPP;
+	if (domain->index_flags & GTRF_PERFECT_HASH)
+	{
+		result = _mph_build(domain);
+	}
+	/* If no perfect hash function could be found, fall back to the
+	regular index. We know how many plural forms there are: go and parse
+	the string tables. */
+	if (result == GTRENOTSUPP)
+	{
+		result = _domain_parse_string_table(domain, domain->string_count,
+			domain->ost_offset, domain->tst_offset);
+	}
 	return result;
 }
 
-/* Validate the header of the data block, then parse it into the string
-descriptor table. */
-static int _domain_parse_data(libgtr_domain_t *domain)
+/* Make sure the string index of a domain loaded with GTRF_LAZY_INDEX has
+been built. Must be called inside a read section. Returns false if the
+index couldn't be built. */
+static bool _domain_ensure_index(libgtr_domain_t *domain)
+{
+	uint32_t state = _gtr_atomic_load_u32(&domain->index_state);
+	if (state != GTR_INDEX_PENDING)
+		return state == GTR_INDEX_READY;
+
+	/* The first lookup builds the index, and concurrent lookups wait for
+	it. The read section keeps the domain from being freed meanwhile. */
+	_gtr_mutex_lock(&domain->index_lock);
+	state = _gtr_atomic_load_u32(&domain->index_state);
+	if (state == GTR_INDEX_PENDING)
+	{
+		/* Publish the state only after the index is complete, so other
+		readers that see it also see the index. */
+		state = _domain_build_index(domain) == GTREOK ?
+			GTR_INDEX_READY : GTR_INDEX_FAILED;
+		_gtr_atomic_store_u32(&domain->index_state, state);
+	}
+	_gtr_mutex_unlock(&domain->index_lock);
+	return state == GTR_INDEX_READY;
+}
+
+/* Give a domain lookup statistics if the flags ask for them. A new
+version of a domain made of several catalogs continues the counts of the
+previous one, if there is one. Returns GTREOK or GTRENOMEM. */
+static int _domain_init_stats(libgtr_domain_t *domain, unsigned int flags,
+	const libgtr_domain_t *prev)
+{
+	if (!(flags & GTRF_LOOKUP_STATS))
+		return GTREOK;
+	domain->stats = calloc(1, sizeof(libgtr_stats_t));
+	if (!domain->stats)
+		return GTRENOMEM;
+	if (prev && prev->stats)
+	{
+		domain->stats->hits = _gtr_counter_load(&prev->stats->hits);
+		domain->stats->misses = _gtr_counter_load(&prev->stats->misses);
+		domain->stats->filtered =
+			_gtr_counter_load(&prev->stats->filtered);
+	}
+	return GTREOK;
+}
+
+/* Validate the header of the data block, then build the string
+index, unless that is left to the first lookup. */
+static int _domain_parse_data(libgtr_t *gtr, libgtr_domain_t *domain,
+	unsigned int flags)
 {
 	assert(domain->data);
 
+	int result = _domain_init_stats(domain, flags, NULL);
+	if (result != GTREOK)
+		return result;
+
 	/* The .mo file format specifies that all strings have to end with
 	a NUL byte, even though we have an explicit length. This means we
 	don't have to copy every string to append a NUL. */
@@ -247,9 +385,18 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 		return GTREINVAL;
 	}
 	/* Check the file magic */
-	if (READ_DOM_DATA(uint32_t, 0) == MO_MAGIC)
+	uint32_t magic = *(const uint32_t*)domain->data;
+	if (magic == MO_MAGIC)
 	{
 		/* Standard byte order, everything fine. */
+		domain->swapped = false;
+	}
+	else if (magic == MO_MAGIC_REVERSE)
+	{
+		/* Written on a host with the other byte order. Rather than
+		converting the file, swap every number as it is read; the
+		strings themselves don't need it. */
+		domain->swapped = true;
 	}
 	else
 	{
@@ -259,7 +406,7 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 
 	/* Read the revision. */
 	uint32_t mo_revision =
-		READ_DOM_DATA(uint32_t, MO_HDR_0_0_OFF_REVISION);
+		_mo_read_u32(domain, MO_HDR_0_0_OFF_REVISION);
 
 	/* We currently only support files with major == 0. */
 	if (((mo_revision & 0xFFFF0000) >> 16) != 0)
@@ -278,11 +425,11 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 	}
 
 	uint32_t strings =
-		READ_DOM_DATA(uint32_t, MO_HDR_0_0_OFF_STRCOUNT);
+		_mo_read_u32(domain, MO_HDR_0_0_OFF_STRCOUNT);
 	uint32_t ost_offset =
-		READ_DOM_DATA(uint32_t, MO_HDR_0_0_OFF_OSTRTABLE);
+		_mo_read_u32(domain, MO_HDR_0_0_OFF_OSTRTABLE);
 	uint32_t tst_offset =
-		READ_DOM_DATA(uint32_t, MO_HDR_0_0_OFF_TSTRTABLE);
+		_mo_read_u32(domain, MO_HDR_0_0_OFF_TSTRTABLE);
 
 	/* Make sure the string descriptor tables are inside the data
 	block */
@@ -291,6 +438,9 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 	{
 		return GTREINVAL;
 	}
+	domain->string_count = strings;
+	domain->ost_offset = ost_offset;
+	domain->tst_offset = tst_offset;
 
 	/* All basic sanity checks succeeded. Time to start parsing. */
 
@@ -299,10 +449,11 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 	header. If there is no header, assume english-style plurals: two
 	forms, singular if n == 1, plural otherwise. */
 	domain->plurals = 2;
+	const char *plural_spec = NULL;
 
 	for (uint32_t i = 0; i < strings; ++i)
 	{
-		uint32_t msgid_size = READ_DOM_DATA(uint32_t,
+		uint32_t msgid_size = _mo_read_u32(domain,
 			ost_offset + i * MO_STRDESC_SIZE);
 		if (msgid_size == 0)
 		{
@@ -318,7 +469,7 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 				return GTREINVAL;
 			}
 			if (_domain_parse_plurals(msgstr_data,
-				&domain->plurals, &domain->plural_expr) < 0)
+				&domain->plurals, &plural_spec) < 0)
 			{
 				return GTREINVAL;
 			}
@@ -326,6 +477,14 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 		}
 	}
 
+	domain->plural_rule =
+		libgtr_plural_rule_acquire(&gtr->plural_rules, plural_spec);
+	if (!domain->plural_rule)
+		return GTRENOMEM;
+	/* Without a usable expression, fall back to English-style plurals.
+	*/
+	if (domain->plural_rule->expr == NULL)
+		domain->plurals = 2;
 	assert(domain->plurals > 0);
 
 	/* If there's more than a handful of plural forms, somebody is
@@ -335,14 +494,117 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 		return GTREINVAL;
 	}
 
-	/* We know how many plural forms there are: go and parse the string
-	tables. */
-	return _domain_parse_string_table(domain, strings,
-		ost_offset, tst_offset);
+	/* If we were asked to, and the file has a usable hash table, use it
+	for lookups instead of building our own index. The table is probed
+	with a secondary hash modulo (size - 2), so it needs at least three
+	slots. */
+	if (flags & GTRF_MO_HASH)
+	{
+		uint32_t hash_size =
+			_mo_read_u32(domain, MO_HDR_0_0_OFF_HASHSIZE);
+		uint32_t hash_offset =
+			_mo_read_u32(domain, MO_HDR_0_0_OFF_HASHTABLE);
+		if (hash_size > 2 && hash_offset % sizeof(uint32_t) == 0 &&
+			hash_offset <= domain->data_size &&
+			(domain->data_size - hash_offset) / sizeof(uint32_t) >=
+				hash_size)
+		{
+			domain->hash_size = hash_size;
+			domain->hash_offset = hash_offset;
+			domain->index_state = GTR_INDEX_READY;
+			return GTREOK;
+		}
+	}
+
+	domain->index_flags = flags;
+	if (flags & GTRF_LAZY_INDEX)
+		return GTREOK;
+	result = _domain_build_index(domain);
+	if (result == GTREOK)
+		domain->index_state = GTR_INDEX_READY;
+	return result;
 
 #undef READ_DOM_STR_DESC
 #undef READ_DOM_STR
-#undef READ_DOM_DATA
+}
+
+/* Find the handle for a domain name, creating it if needed. Must be
+called with the write lock held. */
+static libgtr_domain_ref_t *_gtr_get_ref(libgtr_t *gtr, const char *name)
+{
+	size_t len = strlen(name);
+	uint64_t hash = _gtr_hash(name, len);
+	libgtr_domain_ref_t *ref = _gtr_ref_find(gtr, name, len, hash);
+	if (!ref)
+		ref = _gtr_ref_create(gtr, name, len, hash);
+	return ref;
+}
+
+/* Check whether the on-demand loader failed to load the domain with
+the given name hash. May be called without any lock. */
+static bool _gtr_missing_find(libgtr_t *gtr, uint64_t hash)
+{
+	/* 0 marks an empty slot; a name hashing to it is never remembered. */
+	return hash != 0 && _gtr_counter_load(
+		&gtr->missing[hash % GTR_MISSING_DOMAINS]) == hash;
+}
+
+/* Remember that the on-demand loader failed to load the domain with the
+given name hash, or forget it. A domain remembered in the same slot
+before is forgotten, and will be tried again on its next lookup. Must be
+called with the write lock held. */
+static void _gtr_missing_set(libgtr_t *gtr, uint64_t hash, bool missing)
+{
+	volatile uint64_t *slot = &gtr->missing[hash % GTR_MISSING_DOMAINS];
+	if (missing)
+		_gtr_counter_store(slot, hash);
+	else if (_gtr_counter_load(slot) == hash)
+		_gtr_counter_store(slot, 0);
+}
+
+/* Forget all the domains the on-demand loader failed to load, because
+the sources it loads from changed. Must be called with the write lock
+held. */
+static void _gtr_missing_clear(libgtr_t *gtr)
+{
+	for (size_t i = 0; i < GTR_MISSING_DOMAINS; i++)
+		_gtr_counter_store(&gtr->missing[i], 0);
+}
+
+/* Add a parsed domain to the library instance, and point its handle to
+it. Must be called with the write lock held. */
+static int _gtr_add_domain(libgtr_t *gtr, libgtr_domain_t *dom)
+{
+	libgtr_domain_t *prev;
+	HASH_FIND_STR(gtr->domains, dom->name, prev);
+	if (prev)
+		return GTREEXIST;
+
+	libgtr_domain_ref_t *ref = _gtr_get_ref(gtr, dom->name);
+	if (!ref)
+		return GTRENOMEM;
+
+	HASH_ADD_KEYPTR(hh, gtr->domains,
+		dom->name, strlen(dom->name), dom);
+	/* Readers may pick up the domain from here on. */
+	GTR_ATOMIC_STORE_PTR(&ref->domain, dom);
+	_gtr_missing_set(gtr, ref->hash, false);
+	return GTREOK;
+}
+
+/* Remove a domain from the library instance and free it once no reader
+can be using it anymore. Must be called with the write lock held. */
+static void _gtr_remove_domain(libgtr_t *gtr, libgtr_domain_t *dom)
+{
+	size_t len = strlen(dom->name);
+	libgtr_domain_ref_t *ref = _gtr_ref_find(gtr, dom->name, len,
+		_gtr_hash(dom->name, len));
+	if (ref)
+		GTR_ATOMIC_STORE_PTR(&ref->domain, NULL);
+
+	HASH_DEL(gtr->domains, dom);
+	_gtr_synchronize(gtr);
+	_domain_free(dom);
 }
 
 /* Implementation follows */
@@ -350,6 +612,15 @@ static int _domain_parse_data(libgtr_domain_t *domain)
 libgtr_t *libgtr_new(void)
 {
 	libgtr_t *gtr = calloc(1, sizeof(libgtr_t));
+	if (gtr)
+	{
+		_gtr_mutex_init(&gtr->write_lock);
+		_gtr_cond_init(&gtr->loaded);
+		_gtr_cond_init(&gtr->jobs_queued);
+		_gtr_mutex_init(&gtr->plural_rules.lock);
+		gtr->load_timeout = 0;
+		gtr->worker_limit = 1;
+	}
 	return gtr;
 }
 
@@ -359,6 +630,15 @@ void libgtr_destroy(libgtr_t *gtr)
 	if (gtr == NULL)
 		return;
 
+	/* Let the workers finish the queued background loads. */
+	_gtr_mutex_lock(&gtr->write_lock);
+	gtr->shutdown = true;
+	_gtr_cond_broadcast(&gtr->jobs_queued);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	for (unsigned int i = 0; i < gtr->worker_count; ++i)
+		_gtr_thread_join(gtr->workers[i]);
+	free(gtr->workers);
+
 	/* Clear all loaded domains. */
 	libgtr_domain_t *domain, *domain_tmp;
 	HASH_ITER(hh, gtr->domains, domain, domain_tmp)
@@ -366,7 +646,38 @@ void libgtr_destroy(libgtr_t *gtr)
 		HASH_DEL(gtr->domains, domain);
 		_domain_free(domain);
 	}
+	if (gtr->refs)
+	{
+		for (size_t i = 0; i <= gtr->refs->mask; ++i)
+		{
+			libgtr_domain_ref_t *ref = gtr->refs->refs[i];
+			if (ref)
+			{
+				free(ref->name);
+				free(ref);
+			}
+		}
+		_gtr_ref_table_free(gtr->refs);
+	}
+	while (gtr->retired_refs)
+	{
+		libgtr_ref_table_t *table = gtr->retired_refs;
+		gtr->retired_refs = table->retired;
+		_gtr_ref_table_free(table);
+	}
+
+	/* Bundles stay mapped until the last domain from them is gone. */
+	while (gtr->bundles)
+	{
+		libgtr_bundle_t *bundle = gtr->bundles;
+		gtr->bundles = bundle->next;
+		_gtrb_release(bundle->data, bundle->size, bundle);
+	}
 
+	_gtr_mutex_destroy(&gtr->plural_rules.lock);
+	_gtr_cond_destroy(&gtr->jobs_queued);
+	_gtr_cond_destroy(&gtr->loaded);
+	_gtr_mutex_destroy(&gtr->write_lock);
 	free(gtr);
 }
 
@@ -375,74 +686,172 @@ int libgtr_unload_domain(libgtr_t *gtr, const char *domain)
 	if (!gtr || domain == NULL)
 		return GTREINVAL;
 
+	_gtr_mutex_lock(&gtr->write_lock);
 	libgtr_domain_t *dom;
 	HASH_FIND_STR(gtr->domains, domain, dom);
 
 	if (dom)
 	{
-		HASH_DEL(gtr->domains, dom);
-		_domain_free(dom);
+		_gtr_remove_domain(gtr, dom);
 	}
+	/* Let the on-demand loader try again, too. */
+	_gtr_missing_set(gtr, _gtr_hash(domain, strlen(domain)), false);
+	_gtr_mutex_unlock(&gtr->write_lock);
+
+	return GTREOK;
+}
 
+/* Parse the catalog of a domain and build its index, with the flags
+set at the time. For catalogs loaded from a file, file is its name and
+mtime the time of its last modification. */
+static int _domain_parse(libgtr_t *gtr, libgtr_domain_t *dom,
+	const char *file, int64_t mtime)
+{
+	/* Build the index without holding the write lock, so other loads
+	and unloads can proceed in the meantime. */
+	_gtr_mutex_lock(&gtr->write_lock);
+	unsigned int flags = gtr->flags;
+	_gtr_mutex_unlock(&gtr->write_lock);
+	if (file == NULL || !(flags & (GTRF_INDEX_FILE | GTRF_SHARED_INDEX)))
+		return _domain_parse_data(gtr, dom, flags);
+
+	/* Only parse the header, then take the index from shared memory or
+	the index file. If there is none, or it is outdated, build the index
+	and publish it. Failing to publish it isn't an error: the directory
+	may well be read-only, and another process may have been faster. */
+	int result = _domain_parse_data(gtr, dom,
+		flags | GTRF_LAZY_INDEX | GTRF_PERFECT_HASH);
+	if (result != GTREOK || dom->index_state == GTR_INDEX_READY)
+		return result;
+	if (!((flags & GTRF_SHARED_INDEX) && _gtrs_attach(dom, file, mtime)) &&
+		!((flags & GTRF_INDEX_FILE) && _gtri_attach(dom, file, mtime)))
+	{
+		void *shared = NULL;
+		if (flags & GTRF_SHARED_INDEX)
+			shared = _gtrs_claim(dom, file);
+		result = _domain_build_index(dom);
+		if (result != GTREOK)
+		{
+			if (shared)
+				_gtrs_abandon(dom, file, shared);
+			return result;
+		}
+		if (dom->mph && (flags & GTRF_INDEX_FILE))
+		{
+			_gtri_write(dom, file, mtime,
+				_gtri_catalog_checksum(dom));
+		}
+		if (shared)
+			_gtrs_publish(dom, file, shared, mtime);
+	}
+	dom->index_state = GTR_INDEX_READY;
 	return GTREOK;
 }
 
+int libgtr_remove_shared_index(const char *file)
+{
+	if (!file)
+		return GTREINVAL;
+	char name[GTRS_NAME_SIZE];
+	_gtrs_name(file, name);
+	return _gtrs_remove(name);
+}
+
 int libgtr_load_msgcat_mem(libgtr_t *gtr, const char *domain,
 	size_t size, const void *data)
+{
+	return libgtr_load_msgcat_mem_ex(gtr, domain, size, data, GTRM_COPY,
+		NULL, NULL);
+}
+
+int libgtr_load_msgcat_mem_ex(libgtr_t *gtr, const char *domain,
+	size_t size, const void *data, unsigned int mode,
+	libgtr_free_cb free_cb, void *opaque)
 {
 	if (gtr == NULL || domain == NULL || size == 0 || data == NULL)
 		return GTREINVAL;
+	/* The string tables are read a word at a time. */
+	if (mode != GTRM_COPY &&
+		(uintptr_t)data % sizeof(uint32_t) != 0)
+	{
+		return GTREINVAL;
+	}
+	if (mode != GTRM_COPY && mode != GTRM_BORROW &&
+		(mode != GTRM_TAKE || free_cb == NULL))
+	{
+		return GTREINVAL;
+	}
 
 	libgtr_domain_t *dom = _domain_new(domain);
-	void *data_clone = malloc(size);
-	
-	if (!dom || !data_clone)
-	{
-		/* Not enough memory. Clean up and return error. */
-		_domain_free(dom);
-		free(data_clone);
+	if (!dom)
 		return GTRENOMEM;
-	}
 
-	dom->data = data_clone;
 	dom->data_size = size;
-	return _domain_parse_data(dom);
-}
-
-#ifdef _WIN32
-static int _msgcat_map_file_w32(libgtr_t *gtr, libgtr_domain_t *dom,
-	HANDLE file)
-{
-	/* Retrieve the size of the file. */
-	LARGE_INTEGER size;
-	if (!GetFileSizeEx(file, &size))
+	if (mode == GTRM_COPY)
 	{
-		return GTRENOMEM;
+		dom->data = malloc(size);
+		if (!dom->data)
+		{
+			_domain_free(dom);
+			return GTRENOMEM;
+		}
+		memcpy(dom->data, data, size);
 	}
-	if (size.HighPart != 0)
+	else
 	{
-		/* We're not supporting files >4G for the moment. */
-		return GTRENOMEM;
+		dom->data = (void*)data;
+		dom->borrowed = true;
 	}
-	dom->data_size = size.LowPart;
 
-	/* Map the data into memory. We may want to use a copy-on-write 
-	mapping later in case we want to do endianness fixups, but those are
-	unsupported at the moment. */
-	HANDLE mapping = CreateFileMapping(file, NULL,
-		PAGE_READONLY, 0, 0, NULL);
-	dom->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	int result = _domain_parse(gtr, dom, NULL, 0);
+	if (result == GTREOK)
+	{
+		if (mode == GTRM_TAKE)
+		{
+			dom->data_free = free_cb;
+			dom->data_free_opaque = opaque;
+		}
+		_gtr_mutex_lock(&gtr->write_lock);
+		result = _gtr_add_domain(gtr, dom);
+		_gtr_mutex_unlock(&gtr->write_lock);
+	}
+	if (result != GTREOK)
+	{
+		/* If loading fails, the buffer still belongs to the caller. */
+		dom->data_free = NULL;
+		_domain_free(dom);
+	}
+	return result;
+}
 
-	/* Mapping the file into memory increases the reference count on the
-	file mapping object, so we don't have to keep a handle to it around.
-	*/
-	CloseHandle(mapping);
+/* Load a message catalog from a file into a new domain that isn't
+added to the library instance yet. */
+static int _domain_load_file(libgtr_t *gtr, const char *domain,
+	const char *file, libgtr_domain_t **out)
+{
+	libgtr_domain_t *dom = _domain_new(domain);
+	if (!dom)
+		return GTRENOMEM;
 
+	/* Catalogs in the other byte order are read in place, too (see
+	_mo_read_u32), so the mapping stays read-only. */
+	int64_t mtime;
+	int result = _gtr_map_file(file, &dom->data, &dom->data_size, &mtime);
+	if (result != GTREOK)
+		goto _domain_load_file_cleanup;
 	dom->mmaped = true;
-	
-	return GTREOK;
+
+	result = _domain_parse(gtr, dom, file, mtime);
+
+_domain_load_file_cleanup:
+	if (result != GTREOK)
+	{
+		_domain_free(dom);
+		dom = NULL;
+	}
+	*out = dom;
+	return result;
 }
-#endif
 
 int libgtr_load_msgcat_file(libgtr_t *gtr, const char *domain,
 	const char *file)
@@ -450,153 +859,1415 @@ int libgtr_load_msgcat_file(libgtr_t *gtr, const char *domain,
 	if (gtr == NULL || domain == NULL || file == NULL)
 		return GTREINVAL;
 
+	libgtr_domain_t *dom;
+	int result = _domain_load_file(gtr, domain, file, &dom);
+	if (result != GTREOK)
+		return result;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	result = _gtr_add_domain(gtr, dom);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	if (result != GTREOK)
+		_domain_free(dom);
+	return result;
+}
+
+int libgtr_reload_domain(libgtr_t *gtr, const char *domain,
+	const char *file)
+{
+	if (gtr == NULL || domain == NULL || file == NULL)
+		return GTREINVAL;
+
+	/* Readers keep using the current catalog while the new one is
+	loaded. */
+	libgtr_domain_t *dom;
+	int result = _domain_load_file(gtr, domain, file, &dom);
+	if (result != GTREOK)
+		return result;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_t *prev;
+	HASH_FIND_STR(gtr->domains, domain, prev);
+	if (prev && prev->overlay)
+	{
+		/* A single catalog can't stand in for layers or a fallback
+		chain. */
+		_domain_free(dom);
+		result = GTREEXIST;
+	}
+	else if (prev)
+	{
+		/* Swap in the new catalog, then wait for the readers that may
+		still be using the old one. */
+		HASH_DEL(gtr->domains, prev);
+		result = _gtr_add_domain(gtr, dom);
+		assert(result == GTREOK);
+		_gtr_synchronize(gtr);
+		_domain_free(prev);
+	}
+	else
+	{
+		result = _gtr_add_domain(gtr, dom);
+		if (result != GTREOK)
+			_domain_free(dom);
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return result;
+}
+
+int libgtr_load_bundle(libgtr_t *gtr, const char *file)
+{
+	if (gtr == NULL || file == NULL)
+		return GTREINVAL;
+
+	libgtr_bundle_t *bundle = calloc(1, sizeof(libgtr_bundle_t));
+	if (!bundle)
+		return GTRENOMEM;
+	int64_t mtime;
+	int result = _gtr_map_file(file, &bundle->data, &bundle->size, &mtime);
+	if (result != GTREOK)
+	{
+		free(bundle);
+		return result;
+	}
+	result = _gtrb_check(bundle->data, bundle->size);
+	if (result != GTREOK)
+	{
+		_gtr_unmap_file(bundle->data, bundle->size);
+		free(bundle);
+		return result;
+	}
+	bundle->refs = 1;
+
+	/* Lookups find the domains of the bundle from here on, and set them
+	up on first use. */
+	_gtr_mutex_lock(&gtr->write_lock);
+	bundle->next = gtr->bundles;
+	GTR_ATOMIC_STORE_PTR(&gtr->bundles, bundle);
+	_gtr_missing_clear(gtr);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return GTREOK;
+}
+
+/* Set up a domain from its catalog in a mounted bundle, and add it to
+the library instance. The catalog is used in place, and so is its
+prebuilt index, if it has one that fits. */
+static int _gtr_load_bundle_domain(libgtr_t *gtr, libgtr_bundle_t *bundle,
+	const libgtr_gtrb_entry_t *entry, const char *domain)
+{
 	libgtr_domain_t *dom = _domain_new(domain);
 	if (!dom)
 		return GTRENOMEM;
-
-	int result = GTREOK;
-
-#if defined(_WIN32)
-	/* Convert the file name from UTF-8 to a wide string. */
-	int file_w_sz = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
-		file, -1, NULL, 0);
-	if (file_w_sz == 0)
+	dom->data = (char*)bundle->data + entry->mo_offset;
+	dom->data_size = entry->mo_size;
+	dom->borrowed = true;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	unsigned int flags = gtr->flags;
+	_gtr_mutex_unlock(&gtr->write_lock);
+	bool prebuilt = entry->index_size != 0;
+	int result = _domain_parse_data(gtr, dom, prebuilt ?
+		flags | GTRF_LAZY_INDEX | GTRF_PERFECT_HASH : flags);
+	if (result == GTREOK && prebuilt &&
+		dom->index_state != GTR_INDEX_READY)
 	{
-		result = GTREINVAL;
-		goto libgtr_load_msgcat_file_cleanup;
+		dom->mph = _gtri_check(dom,
+			(char*)bundle->data + entry->index_offset, entry->index_size,
+			0, false);
+		if (dom->mph)
+			dom->index_state = GTR_INDEX_READY;
+		else if (!(flags & GTRF_LAZY_INDEX))
+		{
+			result = _domain_build_index(dom);
+			if (result == GTREOK)
+				dom->index_state = GTR_INDEX_READY;
+		}
 	}
 
-	LPWSTR file_w = malloc(sizeof(WCHAR) * file_w_sz);
-	if (!file_w)
+	if (result == GTREOK)
 	{
-		result = GTRENOMEM;
-		goto libgtr_load_msgcat_file_cleanup;
+		_gtr_atomic_add_u32(&bundle->refs, 1);
+		dom->data_free = _gtrb_release;
+		dom->data_free_opaque = bundle;
+		_gtr_mutex_lock(&gtr->write_lock);
+		result = _gtr_add_domain(gtr, dom);
+		_gtr_mutex_unlock(&gtr->write_lock);
 	}
-	MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
-		file, -1, file_w, file_w_sz);
+	if (result != GTREOK)
+		_domain_free(dom);
+	return result;
+}
+
+/* A catalog on its way into a bundle */
+typedef struct libgtr_bundle_item
+{
+	libgtr_domain_t *dom;
+	libgtr_gtri_header_t index;
+} libgtr_bundle_item_t;
+
+static int _gtr_bundle_item_compare(const void *a, const void *b)
+{
+	return strcmp(((const libgtr_bundle_item_t*)a)->dom->name,
+		((const libgtr_bundle_item_t*)b)->dom->name);
+}
 
-	/* Open the file - in case we have to convert endianness we'll set
-	the mapping to copy-on-write later, so we don't have to set that
-	flag here. */
-	HANDLE fh = CreateFileW(file_w, GENERIC_READ, FILE_SHARE_READ,
-		NULL, OPEN_EXISTING, 0, NULL);
-	free(file_w);
-	if (fh == INVALID_HANDLE_VALUE)
+int libgtr_write_bundle(const char *file, libgtr_msgcat_file_t *catalogs,
+	size_t count)
+{
+	if (file == NULL || (catalogs == NULL && count != 0) ||
+		count > UINT32_MAX / sizeof(libgtr_gtrb_entry_t))
 	{
-		result = GTRENOENT;
-		goto libgtr_load_msgcat_file_cleanup;
+		return GTREINVAL;
 	}
 
-	result = _msgcat_map_file_w32(gtr, dom, fh);
-	CloseHandle(fh);
-#elif defined(__unix__)
-	int fh = open(file, O_RDONLY);
-	if (fh < 0)
+	/* Load every catalog like libgtr_load_msgcat_file would, which
+	checks it and builds its index. */
+	libgtr_t *gtr = libgtr_new();
+	libgtr_bundle_item_t *items = calloc(count + 1, sizeof(*items));
+	libgtr_gtrb_entry_t *entries = calloc(count + 1, sizeof(*entries));
+	/* header, directory and names, then padding, catalog, padding,
+	index header and index for every catalog */
+	const void **blocks = calloc(3 + 5 * count, sizeof(void*));
+	size_t *sizes = calloc(3 + 5 * count, sizeof(size_t));
+	char *names = NULL;
+	int result = GTRENOMEM;
+	if (!gtr || !items || !entries || !blocks || !sizes)
+		goto _libgtr_write_bundle_cleanup;
+	libgtr_set_flags(gtr, GTRF_PERFECT_HASH);
+
+	result = GTREOK;
+	size_t names_size = 0;
+	for (size_t i = 0; i < count; ++i)
 	{
-		switch (errno)
+		catalogs[i].result = GTREINVAL;
+		if (catalogs[i].domain && catalogs[i].file)
+		{
+			catalogs[i].result = _domain_load_file(gtr, catalogs[i].domain,
+				catalogs[i].file, &items[i].dom);
+		}
+		if (catalogs[i].result != GTREOK)
 		{
-		case EACCES: result = GTREACCES; break;
-		default:
-		case ENOENT: result = GTRENOENT; break;
+			if (result == GTREOK)
+				result = catalogs[i].result;
+			continue;
 		}
-		goto libgtr_load_msgcat_file_cleanup;
+		names_size += strlen(catalogs[i].domain) + 1;
 	}
-	/* Unfortunately there isn't a flag that says "map the whole file",
-	so we have to figure out how big it is first. */
-	struct stat st;
-	if (fstat(fh, &st) == -1)
+	if (result != GTREOK)
+		goto _libgtr_write_bundle_cleanup;
+
+	qsort(items, count, sizeof(*items), _gtr_bundle_item_compare);
+	for (size_t i = 1; i < count; ++i)
 	{
-		close(fh);
-		result = GTREACCES;
-		goto libgtr_load_msgcat_file_cleanup;
+		if (strcmp(items[i - 1].dom->name, items[i].dom->name) == 0)
+		{
+			result = GTREEXIST;
+			goto _libgtr_write_bundle_cleanup;
+		}
 	}
-	dom->data_size = st.st_size;
 
-	/* Map the file. If we want to do endianness fixups later, we'd have
-	to make this mapping copy-on-write. */
-	dom->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
-	close(fh);
-	if (dom->data == MAP_FAILED)
+	/* Lay out the bundle. */
+	static const char padding[GTRB_ALIGN];
+	libgtr_gtrb_header_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = GTRB_MAGIC;
+	hdr.version = GTRB_VERSION;
+	hdr.entry_count = (uint32_t)count;
+	names = malloc(names_size + 1);
+	result = GTRENOMEM;
+	if (!names)
+		goto _libgtr_write_bundle_cleanup;
+
+	size_t block = 0;
+	blocks[block] = &hdr;
+	sizes[block++] = sizeof(hdr);
+	blocks[block] = entries;
+	sizes[block++] = count * sizeof(*entries);
+	uint64_t offset = sizeof(hdr) + count * sizeof(*entries);
+	char *name = names;
+	for (size_t i = 0; i < count; ++i)
 	{
-		dom->data = NULL;
-		result = GTRENOMEM;
-		goto libgtr_load_msgcat_file_cleanup;
+		size_t len = strlen(items[i].dom->name);
+		memcpy(name, items[i].dom->name, len + 1);
+		entries[i].name_offset = (uint32_t)(offset + (name - names));
+		entries[i].name_size = (uint32_t)len;
+		name += len + 1;
 	}
-	dom->mmaped = true;
-#else
-#error Some code for non-win32/non-UNIX systems should go here.
-#endif
+	blocks[block] = names;
+	sizes[block++] = names_size;
+	offset += names_size;
 
-	result = _domain_parse_data(dom);
-	if (result != GTREOK)
+	for (size_t i = 0; i < count; ++i)
 	{
-		goto libgtr_load_msgcat_file_cleanup;
+		libgtr_domain_t *dom = items[i].dom;
+		size_t pad = (size_t)((GTRB_ALIGN - offset % GTRB_ALIGN) %
+			GTRB_ALIGN);
+		blocks[block] = padding;
+		sizes[block++] = pad;
+		offset += pad;
+		entries[i].mo_offset = (uint32_t)offset;
+		entries[i].mo_size = (uint32_t)dom->data_size;
+		blocks[block] = dom->data;
+		sizes[block++] = dom->data_size;
+		offset += dom->data_size;
+		if (!dom->mph)
+			continue;
+
+		pad = (size_t)((GTRB_ALIGN - offset % GTRB_ALIGN) % GTRB_ALIGN);
+		blocks[block] = padding;
+		sizes[block++] = pad;
+		offset += pad;
+		_gtri_fill_header(dom, 0, _gtri_catalog_checksum(dom),
+			&items[i].index);
+		entries[i].index_offset = (uint32_t)offset;
+		entries[i].index_size = (uint32_t)_gtri_size(dom->string_count);
+		blocks[block] = &items[i].index;
+		sizes[block++] = sizeof(items[i].index);
+		blocks[block] = dom->mph->pilots;
+		sizes[block++] = entries[i].index_size - sizeof(items[i].index);
+		offset += entries[i].index_size;
 	}
+	hdr.size = offset;
+	result = GTRENOTSUPP;
+	if (offset > UINT32_MAX)
+		goto _libgtr_write_bundle_cleanup;
 
-	HASH_ADD_KEYPTR(hh, gtr->domains,
-		dom->name, strlen(dom->name), dom);
+	result = _gtr_replace_file(file, (const void *const*)blocks, sizes,
+		block);
 
-libgtr_load_msgcat_file_cleanup:
-	if (result != GTREOK)
+_libgtr_write_bundle_cleanup:
+	if (items)
 	{
-		_domain_free(dom);
+		for (size_t i = 0; i < count; ++i)
+			_domain_free(items[i].dom);
 	}
+	free(names);
+	free(sizes);
+	free(blocks);
+	free(entries);
+	free(items);
+	libgtr_destroy(gtr);
 	return result;
 }
 
-/* Find requested domain. If the domain is not loaded yet, try to load.
-If loading fails, cache this failure. */
-libgtr_domain_t *_gtr_get_domain(libgtr_t *gtr, const char *domain)
+/* Drop a reference to a layer, freeing it with the last one. Layers are
+only released with the write lock held, or once the instance is gone. */
+static void _gtr_layer_release(libgtr_layer_t *layer)
 {
-	libgtr_domain_t *dom;
-	HASH_FIND_STR(gtr->domains, domain, dom);
-	if (!dom && gtr->dom_loader != NULL)
-	{
-		/* Hand off to loader callback. */
-		if (gtr->dom_loader(gtr, domain, gtr->dom_loader_opaque) != 0)
-		{
-			/* If the callback fails, add a dummy domain to cache the
-			failure. */
-			dom = _domain_new(domain);
-			if (dom == NULL)
-				return NULL;
-			HASH_ADD_KEYPTR(hh, gtr->domains,
-				dom->name, strlen(dom->name), dom);
-		}
-	}
-	if (dom == NULL || dom->data == NULL)
-		return NULL;
+	if (--layer->refs != 0)
+		return;
+	_domain_free(layer->catalog);
+	free(layer->hashes);
+	free(layer->name);
+	free(layer);
+}
 
-	return dom;
+/* Load a message catalog from a file as a layer. Only the header is
+parsed; the merged index of the domain takes the place of an index of
+its own. */
+static int _gtr_layer_new(libgtr_t *gtr, const char *name,
+	const char *file, libgtr_layer_t **out)
+{
+	libgtr_layer_t *layer = calloc(1, sizeof(libgtr_layer_t));
+	if (!layer)
+		return GTRENOMEM;
+	layer->refs = 1;
+	layer->name = strdup(name);
+	layer->catalog = _domain_new(name);
+	int result = GTRENOMEM;
+	if (!layer->name || !layer->catalog)
+		goto _gtr_layer_new_cleanup;
+
+	libgtr_domain_t *dom = layer->catalog;
+	int64_t mtime;
+	result = _gtr_map_file(file, &dom->data, &dom->data_size, &mtime);
+	if (result != GTREOK)
+		goto _gtr_layer_new_cleanup;
+	dom->mmaped = true;
+	result = _domain_parse_data(gtr, dom, GTRF_LAZY_INDEX);
+	if (result != GTREOK)
+		goto _gtr_layer_new_cleanup;
+
+	result = GTRENOMEM;
+	layer->hashes = malloc((dom->string_count + 1) * sizeof(uint64_t));
+	if (!layer->hashes)
+		goto _gtr_layer_new_cleanup;
+	result = GTREINVAL;
+	if (!_mo_hash_msgids(dom, layer->hashes))
+		goto _gtr_layer_new_cleanup;
+	*out = layer;
+	return GTREOK;
+
+_gtr_layer_new_cleanup:
+	_gtr_layer_release(layer);
+	return result;
 }
 
-const char *libgtr_get_translation(libgtr_t *gtr, const char *domain,
-	const char *msgid, int n)
+/* Replace the current version of a domain with a new one, or add it if
+there is none. Must be called with the write lock held. */
+static int _gtr_replace_domain(libgtr_t *gtr, libgtr_domain_t *prev,
+	libgtr_domain_t *dom)
 {
-	if (gtr == NULL)
-		return NULL;
+	if (!prev)
+		return _gtr_add_domain(gtr, dom);
+
+	HASH_DEL(gtr->domains, prev);
+	int result = _gtr_add_domain(gtr, dom);
+	assert(result == GTREOK);
+	_gtr_synchronize(gtr);
+	_domain_free(prev);
+	return result;
+}
 
-	/* Find the bound domain. */
-	libgtr_domain_t *dom = _gtr_get_domain(gtr, domain);
-	if (dom == NULL)
+int libgtr_attach_msgcat_file(libgtr_t *gtr, const char *domain,
+	const char *layer, const char *file)
+{
+	if (gtr == NULL || domain == NULL || layer == NULL || file == NULL)
+		return GTREINVAL;
+
+	/* Load the catalog first, without holding the write lock. */
+	libgtr_layer_t *new_layer;
+	int result = _gtr_layer_new(gtr, layer, file, &new_layer);
+	if (result != GTREOK)
+		return result;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_t *prev;
+	HASH_FIND_STR(gtr->domains, domain, prev);
+	/* Domains loaded from a single catalog or a fallback chain can't
+	take layers. Failed on-demand loads are replaced, though. */
+	const libgtr_overlay_t *old = prev ? prev->overlay : NULL;
+	result = GTREEXIST;
+	if (prev && ((!old && prev->data) || (old && old->resolved)))
+		goto _libgtr_attach_msgcat_file_cleanup;
+	for (uint32_t l = 0; old && l < old->layer_count; ++l)
 	{
-		return NULL;
+		if (old->layers[l] && strcmp(old->layers[l]->name, layer) == 0)
+			goto _libgtr_attach_msgcat_file_cleanup;
 	}
 
-	/* Find the requested string inside the domain. */
-	libgtr_string_descriptor_t *str;
-	HASH_FIND_STR(dom->strings, msgid, str);
+	result = GTRENOMEM;
+	libgtr_domain_t *dom = _domain_new(domain);
+	if (!dom || _domain_init_stats(dom, gtr->flags, prev) != GTREOK)
+	{
+		_domain_free(dom);
+		goto _libgtr_attach_msgcat_file_cleanup;
+	}
+	dom->overlay = _overlay_copy(old, new_layer->catalog->string_count);
+	if (!dom->overlay)
+	{
+		_domain_free(dom);
+		goto _libgtr_attach_msgcat_file_cleanup;
+	}
+	libgtr_overlay_t *ov = dom->overlay;
+	for (uint32_t l = 0; l < ov->layer_count; ++l)
+	{
+		if (ov->layers[l])
+			++ov->layers[l]->refs;
+	}
+	ov->layers[ov->layer_count] = new_layer;
+	_overlay_add_layer(ov, ov->layer_count++);
+	new_layer = NULL;
+	dom->index_state = GTR_INDEX_READY;
+
+	result = _gtr_replace_domain(gtr, prev, dom);
+	if (result != GTREOK)
+		_domain_free(dom);
+
+_libgtr_attach_msgcat_file_cleanup:
+	if (new_layer)
+		_gtr_layer_release(new_layer);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return result;
+}
+
+int libgtr_detach_msgcat(libgtr_t *gtr, const char *domain,
+	const char *layer)
+{
+	if (gtr == NULL || domain == NULL || layer == NULL)
+		return GTREINVAL;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_t *prev;
+	HASH_FIND_STR(gtr->domains, domain, prev);
+	const libgtr_overlay_t *old = prev ? prev->overlay : NULL;
+	if (old && old->resolved)
+		old = NULL;
+	uint32_t live = 0;
+	int result = GTRENOENT;
+	for (uint32_t l = 0; old && l < old->layer_count; ++l)
+	{
+		if (!old->layers[l])
+			continue;
+		++live;
+		if (strcmp(old->layers[l]->name, layer) == 0)
+			result = GTREOK;
+	}
+	if (result != GTREOK)
+		goto _libgtr_detach_msgcat_cleanup;
+	if (live == 1)
+	{
+		/* That was the last one. */
+		_gtr_remove_domain(gtr, prev);
+		goto _libgtr_detach_msgcat_cleanup;
+	}
+
+	result = GTRENOMEM;
+	libgtr_domain_t *dom = _domain_new(domain);
+	if (!dom || _domain_init_stats(dom, gtr->flags, prev) != GTREOK)
+	{
+		_domain_free(dom);
+		goto _libgtr_detach_msgcat_cleanup;
+	}
+	dom->overlay = _overlay_copy(old, 0);
+	if (!dom->overlay)
+	{
+		_domain_free(dom);
+		goto _libgtr_detach_msgcat_cleanup;
+	}
+	/* Copying may have moved the layer to another slot. */
+	libgtr_overlay_t *ov = dom->overlay;
+	uint32_t slot = 0;
+	while (!ov->layers[slot] || strcmp(ov->layers[slot]->name, layer) != 0)
+		++slot;
+	result = _overlay_remove_layer(ov, slot);
+	if (result != GTREOK)
+	{
+		/* The copy doesn't hold references to the layers yet. */
+		ov->layer_count = 0;
+		_domain_free(dom);
+		goto _libgtr_detach_msgcat_cleanup;
+	}
+	ov->layers[slot] = NULL;
+	/* Drop holes at the end right away. */
+	while (ov->layers[ov->layer_count - 1] == NULL)
+		--ov->layer_count;
+	for (uint32_t l = 0; l < ov->layer_count; ++l)
+	{
+		if (ov->layers[l])
+			++ov->layers[l]->refs;
+	}
+	dom->index_state = GTR_INDEX_READY;
+	result = _gtr_replace_domain(gtr, prev, dom);
+
+_libgtr_detach_msgcat_cleanup:
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return result;
+}
+
+int libgtr_load_msgcat_chain(libgtr_t *gtr, const char *domain,
+	const char *const *files, size_t count)
+{
+	if (gtr == NULL || domain == NULL || (count != 0 && files == NULL) ||
+		count >= GTR_OVERLAY_EMPTY)
+	{
+		return GTREINVAL;
+	}
+
+	libgtr_domain_t *dom = _domain_new(domain);
+	libgtr_overlay_t *ov = calloc(1, sizeof(libgtr_overlay_t));
+	int result = GTRENOMEM;
+	if (!dom || !ov)
+		goto _libgtr_load_msgcat_chain_cleanup;
+	dom->overlay = ov;
+	ov->layers = malloc((count + 1) * sizeof(libgtr_layer_t*));
+	if (!ov->layers ||
+		_domain_init_stats(dom, gtr->flags, NULL) != GTREOK)
+	{
+		goto _libgtr_load_msgcat_chain_cleanup;
+	}
+
+	/* Locales of the chain don't need to have a catalog. */
+	for (size_t i = 0; i < count; ++i)
+	{
+		libgtr_layer_t *layer;
+		result = _gtr_layer_new(gtr, files[i], files[i], &layer);
+		if (result == GTRENOENT)
+			continue;
+		if (result != GTREOK)
+			goto _libgtr_load_msgcat_chain_cleanup;
+		ov->layers[ov->layer_count++] = layer;
+	}
+	result = GTRENOENT;
+	if (ov->layer_count == 0)
+		goto _libgtr_load_msgcat_chain_cleanup;
+	result = _overlay_resolve(ov);
+	if (result != GTREOK)
+		goto _libgtr_load_msgcat_chain_cleanup;
+	dom->index_state = GTR_INDEX_READY;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	result = _gtr_add_domain(gtr, dom);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	if (result == GTREOK)
+		return result;
+
+_libgtr_load_msgcat_chain_cleanup:
+	if (dom)
+		_domain_free(dom);
+	else
+		free(ov);
+	return result;
+}
+
+/* Shared state of the threads of a bulk load */
+typedef struct libgtr_bulk_load
+{
+	libgtr_t *gtr;
+	libgtr_msgcat_file_t *files;
+	libgtr_domain_t **doms;
+	size_t count;
+	/* index of the next file to load */
+	uint32_t next;
+} libgtr_bulk_load_t;
+
+/* Load files of a bulk load until there are none left. */
+static void _gtr_bulk_worker(void *arg)
+{
+	libgtr_bulk_load_t *bulk = arg;
+	for (;;)
+	{
+		size_t i = _gtr_atomic_add_u32(&bulk->next, 1);
+		if (i >= bulk->count)
+			break;
+		libgtr_msgcat_file_t *file = &bulk->files[i];
+		if (file->domain == NULL || file->file == NULL)
+			file->result = GTREINVAL;
+		else
+			file->result = _domain_load_file(bulk->gtr, file->domain,
+				file->file, &bulk->doms[i]);
+	}
+}
+
+int libgtr_load_msgcat_files(libgtr_t *gtr, libgtr_msgcat_file_t *files,
+	size_t count, unsigned int threads)
+{
+	if (gtr == NULL || (files == NULL && count != 0) || count > UINT32_MAX)
+		return GTREINVAL;
+	if (count == 0)
+		return GTREOK;
+
+	libgtr_bulk_load_t bulk = { gtr, files, NULL, count, 0 };
+	bulk.doms = calloc(count, sizeof(libgtr_domain_t*));
+	if (!bulk.doms)
+		return GTRENOMEM;
+
+	if (threads == 0)
+		threads = _gtr_cpu_count();
+	if (threads > count)
+		threads = (unsigned int)count;
+
+	/* The calling thread is one of the loaders. If fewer helpers than
+	asked for can be started, the others just get more files each. */
+	libgtr_thread_t *helpers = NULL;
+	unsigned int helper_count = 0;
+	if (threads > 1)
+		helpers = malloc((threads - 1) * sizeof(libgtr_thread_t));
+	while (helpers && helper_count < threads - 1 &&
+		_gtr_thread_create(&helpers[helper_count], _gtr_bulk_worker,
+			&bulk) == GTREOK)
+	{
+		++helper_count;
+	}
+	_gtr_bulk_worker(&bulk);
+	for (unsigned int t = 0; t < helper_count; ++t)
+		_gtr_thread_join(helpers[t]);
+	free(helpers);
+
+	/* Publish everything that loaded in one go. */
+	int result = GTREOK;
+	_gtr_mutex_lock(&gtr->write_lock);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (files[i].result == GTREOK)
+		{
+			files[i].result = _gtr_add_domain(gtr, bulk.doms[i]);
+			if (files[i].result != GTREOK)
+				_domain_free(bulk.doms[i]);
+		}
+		if (result == GTREOK)
+			result = files[i].result;
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+
+	free(bulk.doms);
+	return result;
+}
+
+/* Load the catalog of a background load job and add it, then notify
+the caller. */
+static void _gtr_run_load_job(libgtr_t *gtr, libgtr_load_job_t *job)
+{
+	libgtr_domain_t *dom;
+	int result = _domain_load_file(gtr, job->domain, job->file, &dom);
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	if (result == GTREOK)
+	{
+		result = _gtr_add_domain(gtr, dom);
+		if (result != GTREOK)
+			_domain_free(dom);
+	}
+	if (job->marked)
+	{
+		_gtr_atomic_store_u32(&job->marked->loading, 0);
+		_gtr_cond_broadcast(&gtr->loaded);
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+
+	if (job->callback)
+		job->callback(gtr, job->domain, result, job->opaque);
+
+	free(job->domain);
+	free(job->file);
+	free(job);
+}
+
+/* Worker thread: run background loads until the instance is destroyed
+and the queue is empty. */
+static void _gtr_worker(void *arg)
+{
+	libgtr_t *gtr = arg;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	for (;;)
+	{
+		while (gtr->jobs == NULL && !gtr->shutdown)
+			_gtr_cond_wait(&gtr->jobs_queued, &gtr->write_lock);
+		libgtr_load_job_t *job = gtr->jobs;
+		if (job == NULL)
+			break;
+		gtr->jobs = job->next;
+		if (gtr->jobs == NULL)
+			gtr->jobs_tail = NULL;
+		_gtr_mutex_unlock(&gtr->write_lock);
+
+		_gtr_run_load_job(gtr, job);
+
+		_gtr_mutex_lock(&gtr->write_lock);
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+}
+
+/* Start worker threads up to the configured number. Must be called
+with the write lock held. Returns GTREOK if at least one worker is
+running. */
+static int _gtr_start_workers(libgtr_t *gtr)
+{
+	if (gtr->worker_count >= gtr->worker_limit)
+		return GTREOK;
+
+	libgtr_thread_t *workers = realloc(gtr->workers,
+		gtr->worker_limit * sizeof(libgtr_thread_t));
+	if (workers)
+	{
+		gtr->workers = workers;
+		while (gtr->worker_count < gtr->worker_limit &&
+			_gtr_thread_create(&workers[gtr->worker_count],
+				_gtr_worker, gtr) == GTREOK)
+		{
+			++gtr->worker_count;
+		}
+	}
+	return gtr->worker_count > 0 ? GTREOK : GTRENOMEM;
+}
+
+int libgtr_load_msgcat_file_async(libgtr_t *gtr, const char *domain,
+	const char *file, libgtr_load_done_cb callback, void *opaque)
+{
+	if (gtr == NULL || domain == NULL || file == NULL)
+		return GTREINVAL;
+
+	libgtr_load_job_t *job = calloc(1, sizeof(libgtr_load_job_t));
+	if (job)
+	{
+		job->domain = strdup(domain);
+		job->file = strdup(file);
+	}
+	if (!job || !job->domain || !job->file)
+	{
+		if (job)
+		{
+			free(job->domain);
+			free(job->file);
+		}
+		free(job);
+		return GTRENOMEM;
+	}
+	job->callback = callback;
+	job->opaque = opaque;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_ref_t *ref = _gtr_get_ref(gtr, domain);
+	int result = ref ? _gtr_start_workers(gtr) : GTRENOMEM;
+	if (result == GTREOK)
+	{
+		/* Let lookups know the domain is on its way. */
+		if (ref->domain == NULL && !ref->loading)
+		{
+			_gtr_atomic_store_u32(&ref->loading, 1);
+			job->marked = ref;
+		}
+		if (gtr->jobs_tail)
+			gtr->jobs_tail->next = job;
+		else
+			gtr->jobs = job;
+		gtr->jobs_tail = job;
+		_gtr_cond_signal(&gtr->jobs_queued);
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+
+	if (result != GTREOK)
+	{
+		free(job->domain);
+		free(job->file);
+		free(job);
+	}
+	return result;
+}
+
+int libgtr_set_load_threads(libgtr_t *gtr, unsigned int count)
+{
+	if (gtr == NULL || count == 0)
+		return GTREINVAL;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	int result = GTREOK;
+	if (count > gtr->worker_limit)
+	{
+		gtr->worker_limit = count;
+		/* Workers are started with the first background load. */
+		if (gtr->worker_count > 0)
+			result = _gtr_start_workers(gtr);
+	}
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return result;
+}
+
+int libgtr_set_load_timeout(libgtr_t *gtr, unsigned int milliseconds)
+{
+	if (gtr == NULL)
+		return GTREINVAL;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	gtr->load_timeout = milliseconds;
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return GTREOK;
+}
+
+unsigned int libgtr_read_begin(libgtr_t *gtr)
+{
+	if (gtr == NULL)
+		return 0;
+	return _gtr_read_lock(gtr);
+}
+
+void libgtr_read_end(libgtr_t *gtr, unsigned int token)
+{
+	if (gtr == NULL)
+		return;
+	_gtr_read_unlock(gtr, token);
+}
+
+/* Find the domain a handle points to. Call from a read-side critical
+section. */
+static libgtr_domain_t *_gtr_ref_domain(libgtr_domain_ref_t *ref)
+{
+	return ref ? GTR_ATOMIC_LOAD_PTR(&ref->domain) : NULL;
+}
+
+/* Find the handle of the requested domain, if there is one. Call from a
+read-side critical section. */
+static libgtr_domain_ref_t *_gtr_find_ref(libgtr_t *gtr, const char *domain)
+{
+	size_t len = strlen(domain);
+	return _gtr_ref_find(gtr, domain, len, _gtr_hash(domain, len));
+}
+
+/* Wait until a load in progress has finished, for as long as the caller
+is willing to wait. Must be called with the write lock held. */
+static void _gtr_wait_loading(libgtr_t *gtr, const uint32_t *loading)
+{
+	if (gtr->load_timeout == 0)
+		return;
+
+	if (gtr->load_timeout == LIBGTR_WAIT_FOREVER)
+	{
+		while (*loading)
+			_gtr_cond_wait(&gtr->loaded, &gtr->write_lock);
+		return;
+	}
+
+	uint64_t deadline = _gtr_now_ms() + gtr->load_timeout;
+	while (*loading)
+	{
+		uint64_t now = _gtr_now_ms();
+		if (now >= deadline)
+			break;
+		_gtr_cond_timedwait(&gtr->loaded, &gtr->write_lock,
+			(unsigned int)(deadline - now));
+	}
+}
+
+/* Find the on-demand load in progress of a domain that has no handle.
+Must be called with the write lock held. */
+static libgtr_pending_load_t **_gtr_find_pending(libgtr_t *gtr,
+	const char *domain, size_t len)
+{
+	libgtr_pending_load_t **pending = &gtr->pending;
+	while (*pending && ((*pending)->name_len != len ||
+		memcmp((*pending)->name, domain, len) != 0))
+	{
+		pending = &(*pending)->next;
+	}
+	return pending;
+}
+
+/* Check whether looking up a domain that is not loaded is worth a call
+to _gtr_load_domain: a load of it is in progress, or the loader callback
+or a mounted bundle may provide it. Call from a read-side critical
+section. */
+static bool _gtr_may_load(libgtr_t *gtr, libgtr_domain_ref_t *ref,
+	const char *domain)
+{
+	if (ref != NULL && _gtr_atomic_load_u32(&ref->loading))
+		return true;
+	libgtr_bundle_t *bundle;
+	if (gtr->dom_loader == NULL && !_gtr_bundle_find(gtr, domain, &bundle))
+		return false;
+	/* Domains the loader failed to load before don't get the write lock
+	taken for them again. A load of one that was forgotten in the
+	meantime is found by _gtr_load_domain. */
+	return !_gtr_missing_find(gtr,
+		ref ? ref->hash : _gtr_hash(domain, strlen(domain)));
+}
+
+/* The requested domain is not loaded yet: wait for a load that is
+already running, or hand off to the loader callback. If loading through
+the callback fails, remember this failure in the bounded negative cache,
+instead of creating a handle for the name. Must be called outside of
+read-side critical sections, since the loader will take the write lock.
+Only one thread runs the loader for a domain at a time. Other threads
+that miss on the same domain meanwhile wait for it to finish, for as long
+as the load timeout allows. */
+static void _gtr_load_domain(libgtr_t *gtr, const char *domain)
+{
+	size_t len = strlen(domain);
+	uint64_t hash = _gtr_hash(domain, len);
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_ref_t *ref = _gtr_ref_find(gtr, domain, len, hash);
+	if (ref != NULL && ref->domain != NULL)
+	{
+		/* Somebody else loaded it in the meantime. */
+		_gtr_mutex_unlock(&gtr->write_lock);
+		return;
+	}
+	libgtr_pending_load_t *pending = *_gtr_find_pending(gtr, domain, len);
+	if (pending)
+	{
+		/* A load that started before the domain had a handle. */
+		pending->waiters++;
+		_gtr_wait_loading(gtr, &pending->loading);
+		if (--pending->waiters == 0 && !pending->loading)
+			free(pending);
+		_gtr_mutex_unlock(&gtr->write_lock);
+		return;
+	}
+	/* Mounted bundles come before the loader callback. */
+	libgtr_bundle_t *bundle;
+	const libgtr_gtrb_entry_t *entry =
+		_gtr_bundle_find(gtr, domain, &bundle);
+	if ((ref != NULL && ref->loading) ||
+		(gtr->dom_loader == NULL && entry == NULL) ||
+		_gtr_missing_find(gtr, hash))
+	{
+		if (ref != NULL)
+			_gtr_wait_loading(gtr, &ref->loading);
+		_gtr_mutex_unlock(&gtr->write_lock);
+		return;
+	}
+	uint32_t *loading;
+	if (ref == NULL)
+	{
+		pending = calloc(1, sizeof(libgtr_pending_load_t));
+		if (!pending)
+		{
+			_gtr_mutex_unlock(&gtr->write_lock);
+			return;
+		}
+		pending->name = domain;
+		pending->name_len = len;
+		pending->next = gtr->pending;
+		gtr->pending = pending;
+		loading = &pending->loading;
+	}
+	else
+		loading = &ref->loading;
+	_gtr_atomic_store_u32(loading, 1);
+	_gtr_mutex_unlock(&gtr->write_lock);
+
+	if (entry)
+		_gtr_load_bundle_domain(gtr, bundle, entry, domain);
+	else
+		gtr->dom_loader(gtr, domain, gtr->dom_loader_opaque);
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	libgtr_domain_t *dom;
+	HASH_FIND_STR(gtr->domains, domain, dom);
+	if (dom == NULL)
+		_gtr_missing_set(gtr, hash, true);
+	if (pending)
+	{
+		libgtr_pending_load_t **link = _gtr_find_pending(gtr, domain, len);
+		*link = pending->next;
+	}
+	_gtr_atomic_store_u32(loading, 0);
+	_gtr_cond_broadcast(&gtr->loaded);
+	if (pending && pending->waiters == 0)
+		free(pending);
+	_gtr_mutex_unlock(&gtr->write_lock);
+}
+
+/* Find the descriptor of a string in a domain indexed with uthash. */
+static const libgtr_string_descriptor_t *_domain_find_descriptor(
+	const libgtr_domain_t *dom, libgtr_key_t *key)
+{
+	if (dom->strings == NULL)
+		return NULL;
+
+	/* Walk the bucket ourselves instead of using HASH_FIND, so we can
+	use the hash value from the key. */
+	const UT_hash_table *tbl = dom->strings->hh.tbl;
+	unsigned hashv = (unsigned)_gtr_key_hash(key);
+	if (dom->filter && !_filter_check(dom->filter, hashv))
+	{
+		if (dom->stats)
+			_gtr_counter_add(&dom->stats->filtered, 1);
+		return NULL;
+	}
+	const UT_hash_handle *hh =
+		tbl->buckets[hashv & (tbl->num_buckets - 1)].hh_head;
+	for (; hh != NULL; hh = hh->hh_next)
+	{
+		if (hh->hashv == hashv && hh->keylen == _gtr_key_size(key) &&
+			_gtr_key_equals(key, hh->key))
+		{
+			return ELMT_FROM_HH(tbl, hh);
+		}
+	}
+	return NULL;
+}
+
+/* Count a lookup in the statistics of a domain, if it keeps any. */
+static void _domain_count_lookup(const libgtr_domain_t *dom, bool found)
+{
+	if (dom->stats)
+		_gtr_counter_add(found ? &dom->stats->hits : &dom->stats->misses, 1);
+}
+
+/* Find the requested string inside the domain and return its plural
+form. If len isn't NULL, the length of the form is stored there. */
+static const char *_domain_get_translation(const libgtr_domain_t *dom,
+	libgtr_key_t *key, uint32_t plural_form, size_t *len)
+{
+	if (dom->hash_size != 0 || dom->mph != NULL)
+	{
+		uint32_t index;
+		bool found = dom->hash_size != 0 ?
+			_mo_hash_find(dom, key, &index) : _mph_find(dom, key, &index);
+		_domain_count_lookup(dom, found);
+		return found ?
+			_mo_get_msgstr(dom, index, plural_form, key, len) : NULL;
+	}
+	const libgtr_string_descriptor_t *str = _domain_find_descriptor(dom, key);
+	_domain_count_lookup(dom, str != NULL);
 	if (str == NULL)
 		return NULL;
-	assert(strcmp(str->msgid, msgid) == 0);
+	if (len)
+		*len = _descriptor_lengths(str, dom)[plural_form];
+	return str->msgstr[plural_form];
+}
+
+/* Start loading the memory a lookup of key in the domain will touch
+first, so several lookups can wait for memory at the same time. */
+static void _domain_prefetch(const libgtr_domain_t *dom, libgtr_key_t *key)
+{
+	if (dom->overlay)
+	{
+		_overlay_prefetch(dom->overlay, key);
+	}
+	else if (dom->hash_size != 0)
+	{
+		_mo_hash_prefetch(dom, key);
+	}
+	else if (dom->mph != NULL)
+	{
+		_mph_prefetch(dom, key);
+	}
+	else if (dom->strings != NULL)
+	{
+		const UT_hash_table *tbl = dom->strings->hh.tbl;
+		unsigned hashv = (unsigned)_gtr_key_hash(key);
+		if (dom->filter)
+		{
+			uint32_t word;
+			_filter_bits(dom->filter, hashv, &word);
+			GTR_PREFETCH(&dom->filter->words[word]);
+		}
+		GTR_PREFETCH(&tbl->buckets[hashv & (tbl->num_buckets - 1)]);
+	}
+}
+
+/* Find all plural forms of the translation of key. forms needs room for
+GTR_MAX_SANE_PLURAL_COUNT entries. Returns the domain whose catalog has
+the translation, which is a layer for domains with several catalogs, or
+NULL if there is no translation. */
+static const libgtr_domain_t *_domain_get_forms(const libgtr_domain_t *dom,
+	libgtr_key_t *key, const char **forms)
+{
+	if (dom->overlay || dom->hash_size != 0 || dom->mph != NULL)
+	{
+		uint32_t index;
+		const libgtr_domain_t *catalog = dom;
+		if (dom->overlay)
+			catalog = _overlay_find(dom->overlay, key, &index);
+		else if (!(dom->hash_size != 0 ?
+			_mo_hash_find(dom, key, &index) : _mph_find(dom, key, &index)))
+		{
+			catalog = NULL;
+		}
+		_domain_count_lookup(dom, catalog != NULL);
+		return catalog && _mo_get_msgstrs(catalog, index, forms,
+			catalog->plurals) ? catalog : NULL;
+	}
+
+	/* The descriptor already has pointers to all forms. */
+	const libgtr_string_descriptor_t *str = _domain_find_descriptor(dom, key);
+	_domain_count_lookup(dom, str != NULL);
+	if (str == NULL)
+		return NULL;
+	memcpy(forms, str->msgstr, dom->plurals * sizeof(const char*));
+	return dom;
+}
+
+/* Look up a translation in a domain that has been found already. If len
+isn't NULL, the length of the translation is stored there. */
+static const char *_gtr_get_translation(libgtr_domain_t *dom,
+	libgtr_key_t *key, int n, size_t *len)
+{
+	/* Strings from a layer go by the plural rule of their own catalog.
+	*/
+	if (dom->overlay)
+	{
+		uint32_t index;
+		const libgtr_domain_t *catalog =
+			_overlay_find(dom->overlay, key, &index);
+		_domain_count_lookup(dom, catalog != NULL);
+		if (catalog == NULL)
+			return NULL;
+		uint32_t form = libgtr_plural_rule_eval(catalog->plural_rule, n);
+		return form < catalog->plurals ?
+			_mo_get_msgstr(catalog, index, form, key, len) : NULL;
+	}
 
 	/* Run the plural form evaluator. */
-	uint32_t plural_form = _plural_expr_eval(dom->plural_expr, n);
+	uint32_t plural_form = libgtr_plural_rule_eval(dom->plural_rule, n);
 	/* If the evaluation resulted in an index that's out of bounds, 
 	bail. */
 	if (plural_form >= dom->plurals)
 		return NULL;
-	return str->msgstr[plural_form];
+
+	return _domain_get_translation(dom, key, plural_form, len);
+}
+
+/* Enter a read section and find the domain of a handle, loading the
+domain if needed. The handle may be NULL if none exists for the name
+yet. Returns NULL if the domain has no catalog; the read section has to
+be ended either way. */
+static libgtr_domain_t *_gtr_read_domain(libgtr_t *gtr,
+	libgtr_domain_ref_t *ref, const char *domain, unsigned int *token_out)
+{
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_t *dom = _gtr_ref_domain(ref);
+	if (dom == NULL && _gtr_may_load(gtr, ref, domain))
+	{
+		/* Not loaded (yet). Give the on-demand loader or a mounted bundle
+		a chance to load it, or wait for the load in progress. */
+		_gtr_read_unlock(gtr, token);
+		_gtr_load_domain(gtr, domain);
+		token = _gtr_read_lock(gtr);
+		if (ref == NULL)
+			ref = _gtr_find_ref(gtr, domain);
+		dom = _gtr_ref_domain(ref);
+	}
+
+	*token_out = token;
+	if (dom != NULL && ((dom->data == NULL && dom->overlay == NULL) ||
+		!_domain_ensure_index(dom)))
+	{
+		return NULL;
+	}
+	return dom;
+}
+
+/* Look up a translation in the domain of a handle, loading the domain
+if needed. */
+static const char *_gtr_translate(libgtr_t *gtr, libgtr_domain_ref_t *ref,
+	const char *domain, libgtr_key_t *key, int n, size_t *len)
+{
+	unsigned int token;
+	libgtr_domain_t *dom = _gtr_read_domain(gtr, ref, domain, &token);
+
+	const char *translation = NULL;
+	if (dom != NULL)
+		translation = _gtr_get_translation(dom, key, n, len);
+	_gtr_read_unlock(gtr, token);
+	if (translation == NULL && len != NULL)
+		*len = 0;
+	return translation;
+}
+
+const char *libgtr_get_translation_key(libgtr_t *gtr, const char *domain,
+	libgtr_key_t *key, int n)
+{
+	return libgtr_get_translation_key_len(gtr, domain, key, n, NULL);
+}
+
+const char *libgtr_get_translation_key_len(libgtr_t *gtr,
+	const char *domain, libgtr_key_t *key, int n, size_t *len)
+{
+	if (gtr == NULL || domain == NULL || key == NULL)
+	{
+		if (len)
+			*len = 0;
+		return NULL;
+	}
+
+	/* Find the bound domain. Handles are never freed, so the handle can
+	be used outside of the read-side critical section. */
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_ref_t *ref = _gtr_find_ref(gtr, domain);
+	_gtr_read_unlock(gtr, token);
+
+	return _gtr_translate(gtr, ref, domain, key, n, len);
+}
+
+const char *libgtr_get_translation(libgtr_t *gtr, const char *domain,
+	const char *msgid, int n)
+{
+	if (msgid == NULL)
+		return NULL;
+
+	libgtr_key_t key = { msgid, strlen(msgid), 0, 0, 0, NULL, 0 };
+	return libgtr_get_translation_key(gtr, domain, &key, n);
+}
+
+const char *libgtr_get_translation_len(libgtr_t *gtr, const char *domain,
+	const char *msgid, int n, size_t *len)
+{
+	if (msgid == NULL)
+	{
+		if (len)
+			*len = 0;
+		return NULL;
+	}
+
+	libgtr_key_t key = { msgid, strlen(msgid), 0, 0, 0, NULL, 0 };
+	return libgtr_get_translation_key_len(gtr, domain, &key, n, len);
+}
+
+const char *libgtr_get_translation_ctx(libgtr_t *gtr, const char *domain,
+	const char *ctxt, const char *msgid, int n)
+{
+	if (msgid == NULL)
+		return NULL;
+
+	/* The key refers to both pieces, so nothing has to be put together
+	for the lookup. */
+	libgtr_key_t key = { msgid, strlen(msgid), 0, 0, 0,
+		ctxt, ctxt ? strlen(ctxt) : 0 };
+	return libgtr_get_translation_key(gtr, domain, &key, n);
+}
+
+libgtr_domain_ref_t *libgtr_domain_ref(libgtr_t *gtr, const char *domain)
+{
+	if (gtr == NULL || domain == NULL)
+		return NULL;
+
+	size_t len = strlen(domain);
+	uint64_t hash = _gtr_hash(domain, len);
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_ref_t *ref = _gtr_ref_find(gtr, domain, len, hash);
+	_gtr_read_unlock(gtr, token);
+	if (ref)
+		return ref;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	ref = _gtr_get_ref(gtr, domain);
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return ref;
+}
+
+const char *libgtr_get_translation_ref_key(libgtr_t *gtr,
+	libgtr_domain_ref_t *domain, libgtr_key_t *key, int n)
+{
+	if (gtr == NULL || domain == NULL || key == NULL)
+		return NULL;
+
+	return _gtr_translate(gtr, domain, domain->name, key, n, NULL);
+}
+
+const char *libgtr_get_translation_ref(libgtr_t *gtr,
+	libgtr_domain_ref_t *domain, const char *msgid, int n)
+{
+	if (msgid == NULL)
+		return NULL;
+
+	libgtr_key_t key = { msgid, strlen(msgid), 0, 0, 0, NULL, 0 };
+	return libgtr_get_translation_ref_key(gtr, domain, &key, n);
+}
+
+int libgtr_get_translations_n(libgtr_t *gtr, const char *domain,
+	const char *msgid, const int *ns, size_t count, const char **out)
+{
+	if (gtr == NULL || domain == NULL || msgid == NULL ||
+		(count != 0 && (ns == NULL || out == NULL)))
+	{
+		return GTREINVAL;
+	}
+
+	libgtr_key_t key = { msgid, strlen(msgid), 0, 0, 0, NULL, 0 };
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_ref_t *ref = _gtr_find_ref(gtr, domain);
+	_gtr_read_unlock(gtr, token);
+	libgtr_domain_t *dom = _gtr_read_domain(gtr, ref, domain, &token);
+
+	/* Find the string once, then only evaluate the plural rule for each
+	count. */
+	const char *forms[GTR_MAX_SANE_PLURAL_COUNT];
+	const libgtr_domain_t *catalog =
+		dom != NULL ? _domain_get_forms(dom, &key, forms) : NULL;
+	if (catalog == NULL)
+	{
+		for (size_t i = 0; i < count; ++i)
+			out[i] = NULL;
+	}
+	else
+	{
+		const libgtr_plural_rule_t *rule = catalog->plural_rule;
+		uint32_t plurals = catalog->plurals;
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint32_t form = libgtr_plural_rule_eval(rule, ns[i]);
+			out[i] = form < plurals ? forms[form] : NULL;
+		}
+	}
+	_gtr_read_unlock(gtr, token);
+	return GTREOK;
+}
+
+/* Number of lookups of a batch that wait for memory at the same time */
+#define GTR_BATCH_PREFETCH 8
+
+int libgtr_get_translations(libgtr_t *gtr, const char *domain,
+	const char *const *msgids, const int *ns, size_t count,
+	const char **out)
+{
+	if (gtr == NULL || domain == NULL ||
+		(count != 0 && (msgids == NULL || out == NULL)))
+	{
+		return GTREINVAL;
+	}
+
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_ref_t *ref = _gtr_find_ref(gtr, domain);
+	_gtr_read_unlock(gtr, token);
+	libgtr_domain_t *dom = _gtr_read_domain(gtr, ref, domain, &token);
+
+	/* Hash a group of msgids and prefetch what their lookups need before
+	doing the lookups, so the cache misses of the group overlap. */
+	libgtr_key_t keys[GTR_BATCH_PREFETCH];
+	for (size_t base = 0; base < count; base += GTR_BATCH_PREFETCH)
+	{
+		size_t group = count - base < GTR_BATCH_PREFETCH ?
+			count - base : GTR_BATCH_PREFETCH;
+		for (size_t i = 0; i < group; ++i)
+		{
+			const char *msgid = msgids[base + i];
+			keys[i].msgid = msgid;
+			keys[i].len = msgid ? strlen(msgid) : 0;
+			keys[i].hashed = 0;
+			keys[i].ctxt = NULL;
+			if (dom != NULL && msgid != NULL)
+				_domain_prefetch(dom, &keys[i]);
+		}
+		for (size_t i = 0; i < group; ++i)
+		{
+			out[base + i] = dom != NULL && keys[i].msgid != NULL ?
+				_gtr_get_translation(dom, &keys[i],
+					ns ? ns[base + i] : 1, NULL) : NULL;
+		}
+	}
+	_gtr_read_unlock(gtr, token);
+	return GTREOK;
+}
+
+int libgtr_get_domain_stats(libgtr_t *gtr, const char *domain,
+	libgtr_domain_stats_t *stats)
+{
+	if (gtr == NULL || domain == NULL || stats == NULL)
+		return GTREINVAL;
+
+	unsigned int token = _gtr_read_lock(gtr);
+	libgtr_domain_t *dom = _gtr_ref_domain(_gtr_find_ref(gtr, domain));
+	int result = GTRENOENT;
+	if (dom != NULL && (dom->data != NULL || dom->overlay != NULL))
+	{
+		result = GTRENOTSUPP;
+		if (dom->stats != NULL)
+		{
+			stats->hits = _gtr_counter_load(&dom->stats->hits);
+			stats->misses = _gtr_counter_load(&dom->stats->misses);
+			stats->filtered = _gtr_counter_load(&dom->stats->filtered);
+			result = GTREOK;
+		}
+	}
+	_gtr_read_unlock(gtr, token);
+	return result;
+}
+
+void libgtr_key_init(libgtr_key_t *key, const char *msgid)
+{
+	if (key == NULL || msgid == NULL)
+		return;
+
+	libgtr_key_init_ctx(key, NULL, msgid);
+}
+
+void libgtr_key_init_ctx(libgtr_key_t *key, const char *ctxt,
+	const char *msgid)
+{
+	if (key == NULL || msgid == NULL)
+		return;
+
+	key->msgid = msgid;
+	key->len = strlen(msgid);
+	key->hashed = 0;
+	key->ctxt = ctxt;
+	key->ctxt_len = ctxt ? strlen(ctxt) : 0;
+	_gtr_key_hash(key);
+	_gtr_key_mo_hash(key);
+}
+
+int libgtr_set_flags(libgtr_t *gtr, unsigned int flags)
+{
+	if (gtr == NULL)
+		return GTREINVAL;
+
+	_gtr_mutex_lock(&gtr->write_lock);
+	gtr->flags = flags;
+	_gtr_mutex_unlock(&gtr->write_lock);
+	return GTREOK;
 }
 
 int libgtr_set_msgcat_loader(libgtr_t* gtr,
@@ -605,7 +2276,10 @@ int libgtr_set_msgcat_loader(libgtr_t* gtr,
 	if (gtr == NULL)
 		return GTREINVAL;
 
+	_gtr_mutex_lock(&gtr->write_lock);
 	gtr->dom_loader = callback;
 	gtr->dom_loader_opaque = opaque;
+	_gtr_missing_clear(gtr);
+	_gtr_mutex_unlock(&gtr->write_lock);
 	return GTREOK;
 }
@@ -19,9 +19,338 @@
 #define _LIBGTR_GTRP_H
 
 #include "../libgtr/gtr.h"
-#include "uthash.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#elif defined(__unix__)
+#include <pthread.h>
+#endif
+
+/* Atomic operations. Unless noted otherwise, all of them are sequentially
+consistent. */
+#if defined(_MSC_VER)
+/* Plain loads of aligned words are atomic. x86 doesn't reorder loads
+with other loads, so only the compiler needs to be kept in check. */
+#if defined(_M_IX86) || defined(_M_X64)
+#define _GTR_LOAD_BARRIER() _ReadWriteBarrier()
+#else
+#define _GTR_LOAD_BARRIER() MemoryBarrier()
+#endif
+static inline void *_gtr_atomic_load_ptr(void *const volatile *p)
+{
+	void *v = *p;
+	_GTR_LOAD_BARRIER();
+	return v;
+}
+static inline void _gtr_atomic_store_ptr(void *volatile *p, void *v)
+{
+	_InterlockedExchangePointer(p, v);
+}
+static inline uint32_t _gtr_atomic_load_u32(const volatile uint32_t *p)
+{
+	uint32_t v = *p;
+	_GTR_LOAD_BARRIER();
+	return v;
+}
+static inline void _gtr_atomic_store_u32(volatile uint32_t *p, uint32_t v)
+{
+	_InterlockedExchange((volatile long*)p, (long)v);
+}
+/* Returns the previous value. */
+static inline uint32_t _gtr_atomic_add_u32(volatile uint32_t *p,
+	uint32_t v)
+{
+	return (uint32_t)_InterlockedExchangeAdd((volatile long*)p, (long)v);
+}
+/* Returns the previous value. */
+static inline uint32_t _gtr_atomic_or_u32(volatile uint32_t *p,
+	uint32_t v)
+{
+	return (uint32_t)_InterlockedOr((volatile long*)p, (long)v);
+}
+static inline bool _gtr_atomic_cas_u32(volatile uint32_t *p,
+	uint32_t expected, uint32_t desired)
+{
+	return (uint32_t)_InterlockedCompareExchange((volatile long*)p,
+		(long)desired, (long)expected) == expected;
+}
+/* Counters only need to be atomic, not ordered. */
+static inline void _gtr_counter_add(volatile uint64_t *p, uint64_t v)
+{
+	_InterlockedExchangeAdd64((volatile __int64*)p, (__int64)v);
+}
+static inline uint64_t _gtr_counter_load(volatile uint64_t *p)
+{
+	return (uint64_t)_InterlockedCompareExchange64((volatile __int64*)p,
+		0, 0);
+}
+static inline void _gtr_counter_store(volatile uint64_t *p, uint64_t v)
+{
+	_InterlockedExchange64((volatile __int64*)p, (__int64)v);
+}
+#define GTR_THREAD_LOCAL __declspec(thread)
+#else
+static inline void *_gtr_atomic_load_ptr(void *const volatile *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void _gtr_atomic_store_ptr(void *volatile *p, void *v)
+{
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+static inline uint32_t _gtr_atomic_load_u32(const volatile uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void _gtr_atomic_store_u32(volatile uint32_t *p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+/* Returns the previous value. */
+static inline uint32_t _gtr_atomic_add_u32(volatile uint32_t *p,
+	uint32_t v)
+{
+	return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+/* Returns the previous value. */
+static inline uint32_t _gtr_atomic_or_u32(volatile uint32_t *p,
+	uint32_t v)
+{
+	return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST);
+}
+static inline bool _gtr_atomic_cas_u32(volatile uint32_t *p,
+	uint32_t expected, uint32_t desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+/* Counters only need to be atomic, not ordered. */
+static inline void _gtr_counter_add(volatile uint64_t *p, uint64_t v)
+{
+	__atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+static inline uint64_t _gtr_counter_load(volatile uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+static inline void _gtr_counter_store(volatile uint64_t *p, uint64_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+#define GTR_THREAD_LOCAL __thread
+#endif
+#define GTR_ATOMIC_LOAD_PTR(p) \
+	_gtr_atomic_load_ptr((void *const volatile*)(p))
+#define GTR_ATOMIC_STORE_PTR(p, v) \
+	_gtr_atomic_store_ptr((void *volatile*)(p), (v))
+
+/* Hint that memory is about to be read */
+#if defined(__GNUC__)
+#define GTR_PREFETCH(p) __builtin_prefetch((p))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define GTR_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define GTR_PREFETCH(p) ((void)(p))
+#endif
+
+/* Mutexes, for serializing writers, and condition variables. */
+#if defined(_WIN32)
+typedef CRITICAL_SECTION libgtr_mutex_t;
+typedef CONDITION_VARIABLE libgtr_cond_t;
+#elif defined(__unix__)
+typedef pthread_mutex_t libgtr_mutex_t;
+typedef pthread_cond_t libgtr_cond_t;
+#endif
+
+/* Threads */
+#if defined(_WIN32)
+typedef HANDLE libgtr_thread_t;
+#elif defined(__unix__)
+typedef pthread_t libgtr_thread_t;
+#endif
+
+/* Use our own string hash for uthash tables too, so lookups with a
+precomputed hash can find the right bucket. */
+#define HASH_FUNCTION(keyptr, keylen, num_bkts, hashv, bkt) \
+	do { \
+		hashv = (unsigned)_gtr_hash((const char*)(keyptr), (keylen)); \
+		bkt = (hashv) & ((num_bkts) - 1); \
+	} while (0)
+#include "uthash.h"
+
+/* String hashing. Strings are consumed eight bytes at a time; the state
+keeps the bytes of an incomplete word, so hashing a string in pieces
+gives the same result as hashing it in one go. Words are always read in
+little endian order so hash values don't depend on the host. */
+typedef struct libgtr_hash_state
+{
+	uint64_t hash;
+	uint64_t len;
+	unsigned char pending[8];
+} libgtr_hash_state_t;
+
+static inline uint64_t _gtr_hash_load64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 |
+		(uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+		(uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+static inline uint64_t _gtr_hash_round(uint64_t hash, uint64_t word)
+{
+	word *= UINT64_C(0x87c37b91114253d5);
+	word = (word << 31) | (word >> 33);
+	word *= UINT64_C(0x4cf5ad432745937f);
+	hash ^= word;
+	hash = (hash << 27) | (hash >> 37);
+	return hash * 5 + 0x52dce729;
+}
+/* Final avalanche step, so all bits of a hash can be used to derive
+bucket and slot numbers. */
+static inline uint64_t _gtr_hash_mix(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline void _gtr_hash_init(libgtr_hash_state_t *state)
+{
+	state->hash = UINT64_C(0x9e3779b97f4a7c15);
+	state->len = 0;
+}
+static inline void _gtr_hash_update(libgtr_hash_state_t *state,
+	const char *str, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)str;
+	const unsigned char *end = p + len;
+	size_t fill = state->len % 8;
+	state->len += len;
+
+	/* Complete a word left over from the previous piece first. */
+	if (fill != 0)
+	{
+		while (fill < 8 && p < end)
+			state->pending[fill++] = *p++;
+		if (fill < 8)
+			return;
+		state->hash = _gtr_hash_round(state->hash,
+			_gtr_hash_load64(state->pending));
+	}
+	for (; end - p >= 8; p += 8)
+		state->hash = _gtr_hash_round(state->hash, _gtr_hash_load64(p));
+	for (fill = 0; p < end; ++fill)
+		state->pending[fill] = *p++;
+}
+static inline uint64_t _gtr_hash_final(const libgtr_hash_state_t *state)
+{
+	uint64_t hash = state->hash;
+	size_t fill = state->len % 8;
+	if (fill != 0)
+	{
+		unsigned char word[8] = { 0 };
+		memcpy(word, state->pending, fill);
+		hash = _gtr_hash_round(hash, _gtr_hash_load64(word));
+	}
+	return _gtr_hash_mix(hash ^ state->len);
+}
+static inline uint64_t _gtr_hash(const char *str, size_t len)
+{
+	libgtr_hash_state_t state;
+	_gtr_hash_init(&state);
+	_gtr_hash_update(&state, str, len);
+	return _gtr_hash_final(&state);
+}
+
+/* libgtr_key_t::hashed flags. A key may be used by several threads at
+once, so the first thread to compute a hash value claims the right to
+store it, and the value is published by setting its flag afterwards. */
+#define GTR_KEY_HASHED 0x1
+#define GTR_KEY_MO_HASHED 0x2
+#define GTR_KEY_HASH_CLAIMED 0x4
+#define GTR_KEY_MO_HASH_CLAIMED 0x8
+
+static inline bool _gtr_key_claim(libgtr_key_t *key, unsigned int claim)
+{
+	volatile uint32_t *hashed = (volatile uint32_t*)&key->hashed;
+	return !(_gtr_atomic_or_u32(hashed, claim) & claim);
+}
+static inline void _gtr_key_publish(libgtr_key_t *key, unsigned int flag)
+{
+	_gtr_atomic_or_u32((volatile uint32_t*)&key->hashed, flag);
+}
+static inline bool _gtr_key_has(libgtr_key_t *key, unsigned int flag)
+{
+	return (_gtr_atomic_load_u32((volatile uint32_t*)&key->hashed) &
+		flag) != 0;
+}
+
+/* Message catalogs store strings with a context as the context, this
+separator, and the msgid. */
+#define GTR_CONTEXT_SEPARATOR '\004'
+
+/* Return the length of the msgid of a key as stored in a catalog,
+including its context. */
+static inline size_t _gtr_key_size(const libgtr_key_t *key)
+{
+	return key->ctxt ? key->ctxt_len + 1 + key->len : key->len;
+}
+
+/* Check whether the first _gtr_key_size(key) bytes of str are the msgid
+of the key, including its context. */
+static inline bool _gtr_key_equals(const libgtr_key_t *key,
+	const char *str)
+{
+	if (key->ctxt)
+	{
+		if (memcmp(str, key->ctxt, key->ctxt_len) != 0 ||
+			str[key->ctxt_len] != GTR_CONTEXT_SEPARATOR)
+		{
+			return false;
+		}
+		str += key->ctxt_len + 1;
+	}
+	return memcmp(str, key->msgid, key->len) == 0;
+}
+
+/* Return the string hash of a key, computing it if needed. Keys with a
+context are hashed in pieces, which gives the same value as hashing the
+string they stand for. */
+static inline uint64_t _gtr_key_hash(libgtr_key_t *key)
+{
+	if (_gtr_key_has(key, GTR_KEY_HASHED))
+		return key->hash;
+
+	uint64_t hash;
+	if (key->ctxt)
+	{
+		static const char separator = GTR_CONTEXT_SEPARATOR;
+		libgtr_hash_state_t state;
+		_gtr_hash_init(&state);
+		_gtr_hash_update(&state, key->ctxt, key->ctxt_len);
+		_gtr_hash_update(&state, &separator, 1);
+		_gtr_hash_update(&state, key->msgid, key->len);
+		hash = _gtr_hash_final(&state);
+	}
+	else
+	{
+		hash = _gtr_hash(key->msgid, key->len);
+	}
+	if (_gtr_key_claim(key, GTR_KEY_HASH_CLAIMED))
+	{
+		key->hash = hash;
+		_gtr_key_publish(key, GTR_KEY_HASHED);
+	}
+	return hash;
+}
 
 typedef enum
 {
@@ -64,27 +393,188 @@ struct _gtr_plural_parser
 	libgtr_plural_expr_t *result;
 };
 
+/* Compiled form of a plural expression: a postfix program for a small
+stack machine. Every instruction is one word, followed by an immediate
+operand for some of them. */
+typedef enum
+{
+	GPPO_END,	/* return the top of the stack */
+	GPPO_INT,	/* push the immediate */
+	GPPO_VAR,	/* push n */
+	GPPO_NOT,	/* logical not of the top of the stack */
+	GPPO_JZ,	/* pop, and jump to the immediate if it was zero */
+	GPPO_JMP,	/* jump to the immediate */
+
+	/* binary operations on the two topmost values */
+	GPPO_ADD, GPPO_SUB, GPPO_MUL, GPPO_DIV, GPPO_MOD,
+	GPPO_EQ, GPPO_NEQ, GPPO_LT, GPPO_LTE, GPPO_GT, GPPO_GTE,
+	GPPO_AND, GPPO_OR,
+
+	/* the same binary operations, with the immediate as the right
+	operand */
+	GPPO_ADD_IMM, GPPO_SUB_IMM, GPPO_MUL_IMM, GPPO_DIV_IMM, GPPO_MOD_IMM,
+	GPPO_EQ_IMM, GPPO_NEQ_IMM, GPPO_LT_IMM, GPPO_LTE_IMM, GPPO_GT_IMM,
+	GPPO_GTE_IMM, GPPO_AND_IMM, GPPO_OR_IMM
+} libgtr_plural_program_operation;
+/* Maximum stack depth of a compiled program. Deeper expressions are
+evaluated from the tree. */
+#define GTR_PLURAL_MAX_STACK 16
+typedef struct libgtr_plural_program
+{
+	uint32_t length;
+	int32_t code[];
+} libgtr_plural_program_t;
+
+/* Hand-written evaluator for a well-known plural expression */
+typedef int (*libgtr_plural_fn)(int n);
+
+libgtr_plural_expr_t *libgtr_plural_expr_parse(const char *spec);
 int libgtr_plural_expr_eval(libgtr_plural_expr_t *expr, int n);
 void libgtr_plural_expr_free(libgtr_plural_expr_t *expr);
+libgtr_plural_program_t *libgtr_plural_program_compile(
+	const libgtr_plural_expr_t *expr);
+int libgtr_plural_program_eval(const libgtr_plural_program_t *program,
+	int n);
+void libgtr_plural_program_free(libgtr_plural_program_t *program);
+libgtr_plural_fn libgtr_plural_native(const libgtr_plural_expr_t *expr);
+
+/* Number of plural forms precomputed for a rule, starting at n = 0, if
+the rule doesn't repeat with a short enough period */
+#define GTR_PLURAL_TABLE_SIZE 256
+/* Largest table for a rule that repeats */
+#define GTR_PLURAL_TABLE_MAX 1024
+/* Table entry for results that don't fit into a byte */
+#define GTR_PLURAL_TABLE_INVALID 0xFF
+
+struct libgtr_plural_cache;
+
+/* Plural expression of a catalog, with all the ways to evaluate it */
+typedef struct libgtr_plural_rule
+{
+	/* Rules are shared between all domains of an instance that use the
+	same expression. key is the expression without whitespace; cache is NULL for
+	rules that aren't shared. */
+	UT_hash_handle hh;
+	struct libgtr_plural_cache *cache;
+	char *key;
+	unsigned int refs;
+
+	libgtr_plural_expr_t *expr;
+	libgtr_plural_program_t *program;
+	libgtr_plural_fn native;
+
+	/* Results for 0 <= n < table_size. If period is not 0, the result
+	for any larger n is the result for
+	threshold + (n - threshold) % period. */
+	uint32_t table_size;
+	uint32_t threshold;
+	uint32_t period;
+	uint8_t table[];
+} libgtr_plural_rule_t;
+
+/* All plural rules of an instance, by expression without whitespace */
+typedef struct libgtr_plural_cache
+{
+	libgtr_mutex_t lock;
+	libgtr_plural_rule_t *rules;
+} libgtr_plural_cache_t;
+
+bool libgtr_plural_expr_periodic(const libgtr_plural_expr_t *expr,
+	uint32_t *threshold, uint32_t *period);
+libgtr_plural_rule_t *libgtr_plural_rule_new(libgtr_plural_expr_t *expr);
+int libgtr_plural_rule_eval(const libgtr_plural_rule_t *rule, int n);
+void libgtr_plural_rule_free(libgtr_plural_rule_t *rule);
+libgtr_plural_rule_t *libgtr_plural_rule_acquire(
+	libgtr_plural_cache_t *cache, const char *spec);
+void libgtr_plural_rule_release(libgtr_plural_rule_t *rule);
 
 typedef struct libgtr_string_descriptor
 {
 	UT_hash_handle hh;
 
 	const char *msgid;
+	/* one pointer per plural form, followed by the lengths of the forms
+	as uint32_t, see _descriptor_lengths */
 	const char *msgstr[0];
 } libgtr_string_descriptor_t;
 
+/* Minimal perfect hash over the msgids of a message catalog. Strings are
+distributed into buckets; each bucket stores a pilot value that, mixed
+into the hash of its strings, maps them to distinct slots. */
+typedef struct libgtr_mph
+{
+	uint64_t seed;
+	uint32_t bucket_count;
+	uint32_t slot_count;
+	/* one pilot per bucket */
+	uint32_t *pilots;
+	/* string numbers, indexed by slot */
+	uint32_t *slots;
+} libgtr_mph_t;
+
+/* Blocked Bloom filter over the msgids of a domain, for answering most
+lookups of missing strings without probing the index. Every msgid sets a
+few bits in a single word, so a check reads only one word. */
+typedef struct libgtr_filter
+{
+	/* number of words - 1; the number of words is a power of 2 */
+	uint32_t mask;
+	uint64_t words[];
+} libgtr_filter_t;
+
+/* Lookup statistics of a domain loaded with GTRF_LOOKUP_STATS */
+typedef struct libgtr_stats
+{
+	volatile uint64_t hits;
+	volatile uint64_t misses;
+	/* misses that the filter answered without probing the index */
+	volatile uint64_t filtered;
+} libgtr_stats_t;
+
+/* States of the string index of a domain */
+#define GTR_INDEX_PENDING 0
+#define GTR_INDEX_READY 1
+#define GTR_INDEX_FAILED 2
+
 typedef struct libgtr_domain
 {
 	char *name;
 
 	/* parsed data */
 	unsigned int plurals;
-	libgtr_plural_expr_t *plural_expr;
+	libgtr_plural_rule_t *plural_rule;
 
 	libgtr_string_descriptor_t *strings;
 	void *string_descriptor_block;
+	/* filter in front of strings, with GTRF_MISS_FILTER */
+	libgtr_filter_t *filter;
+	/* lookup statistics, with GTRF_LOOKUP_STATS */
+	libgtr_stats_t *stats;
+
+	/* whether the numbers in the message catalog are in the other byte
+	order */
+	bool swapped;
+	/* string descriptor tables of the message catalog */
+	uint32_t string_count;
+	uint32_t ost_offset;
+	uint32_t tst_offset;
+	/* hash table of the message catalog, if lookups use it */
+	uint32_t hash_size;
+	uint32_t hash_offset;
+	/* minimal perfect hash index, if lookups use it */
+	libgtr_mph_t *mph;
+
+	/* mapped index file the index lives in, if any */
+	void *index_map;
+	size_t index_map_size;
+
+	/* GTR_INDEX_*; the index fields above may only be used once this is
+	GTR_INDEX_READY */
+	uint32_t index_state;
+	/* flags the catalog was loaded with, for building the index later */
+	unsigned int index_flags;
+	/* held while building the index on the first lookup */
+	libgtr_mutex_t index_lock;
 
 	/* raw data */
 	size_t data_size;
@@ -94,13 +584,183 @@ typedef struct libgtr_domain
 	/* if data was mmap'ed, use munmap (not free) */
 	bool mmaped;
 #endif
+	/* if data belongs to the caller, don't free it at all, or only
+	through the caller's callback */
+	bool borrowed;
+	libgtr_free_cb data_free;
+	void *data_free_opaque;
+
+	/* for domains made of several catalogs, the catalogs and their
+	merged index; such domains have no data of their own */
+	struct libgtr_overlay *overlay;
 
 	UT_hash_handle hh;
 } libgtr_domain_t;
 
+/* A message catalog attached to a domain as a layer. Layers are shared
+by all versions of the domain that contain them. */
+typedef struct libgtr_layer
+{
+	char *name;
+	/* the catalog, with only its header parsed */
+	libgtr_domain_t *catalog;
+	/* hash of every msgid of the catalog */
+	uint64_t *hashes;
+	uint32_t refs;
+} libgtr_layer_t;
+
+/* Entry of the merged index of an overlay domain */
+typedef struct libgtr_overlay_entry
+{
+	uint64_t hash;
+	/* layer slot, or GTR_OVERLAY_EMPTY */
+	uint32_t layer;
+	/* string number in the catalog of the layer */
+	uint32_t string;
+} libgtr_overlay_entry_t;
+
+#define GTR_OVERLAY_EMPTY UINT32_MAX
+
+/* The catalogs of a domain made of several, and one index over all of
+them (see overlay.inl). Every msgid has a single entry, for the layer
+with the highest slot that has it, or the first one in fallback
+chains. */
+typedef struct libgtr_overlay
+{
+	/* layers, lowest precedence first, except in fallback chains;
+	detached layers leave a NULL slot behind */
+	libgtr_layer_t **layers;
+	uint32_t layer_count;
+	/* open addressing with linear probing; mask is the table size - 1 */
+	libgtr_overlay_entry_t *entries;
+	size_t mask;
+	size_t used;
+	/* set for fallback chains, which can't take or lose layers */
+	bool resolved;
+} libgtr_overlay_t;
+
+/* Domain handle. Handles are only freed together with the library
+instance; loading and unloading a domain updates the pointer, which
+readers access atomically. */
+struct libgtr_domain_ref
+{
+	char *name;
+	size_t name_len;
+	uint64_t hash;
+	libgtr_domain_t *domain;
+	/* nonzero while the on-demand loader or a background load is
+	running for this domain; written with the write lock held */
+	uint32_t loading;
+};
+
+/* Open addressing hash table of all domain handles, keyed by name.
+Readers find domains through this table without taking any locks, so
+entries are never removed or moved: growing the table publishes a new
+copy. */
+typedef struct libgtr_ref_table
+{
+	/* table size - 1; the size is a power of two */
+	size_t mask;
+	size_t count;
+	/* next superseded table waiting for the end of a grace period */
+	struct libgtr_ref_table *retired;
+	libgtr_domain_ref_t *refs[];
+} libgtr_ref_table_t;
+
+/* Readers announce themselves by incrementing one of these counters.
+Which stripe they use depends on the thread, to keep threads from
+fighting over cache lines; which of the two counters depends on the
+parity of the current epoch, so writers can wait for the readers of one
+epoch to drain while new readers enter the other. */
+#define GTR_READER_STRIPES 64
+typedef struct libgtr_reader_stripe
+{
+	uint32_t count[2];
+	char padding[64 - 2 * sizeof(uint32_t)];
+} libgtr_reader_stripe_t;
+
+/* An on-demand load of a domain that has no handle yet. Domains only
+get a handle once they are loaded, so names that don't exist don't leave
+one behind. */
+typedef struct libgtr_pending_load
+{
+	struct libgtr_pending_load *next;
+	/* the name the loader was called with */
+	const char *name;
+	size_t name_len;
+	uint32_t loading;
+	/* lookups waiting for the load; the last one to leave frees it */
+	unsigned int waiters;
+} libgtr_pending_load_t;
+
+/* Number of domains the on-demand loader failed to load that are
+remembered, so lookups in them don't run it again */
+#define GTR_MISSING_DOMAINS 64
+
+/* A queued background load */
+typedef struct libgtr_load_job
+{
+	char *domain;
+	char *file;
+	libgtr_load_done_cb callback;
+	void *opaque;
+	/* handle whose loading mark this job set, or NULL */
+	libgtr_domain_ref_t *marked;
+	struct libgtr_load_job *next;
+} libgtr_load_job_t;
+
+/* A bundle file mounted into a library instance (see bundle.inl). */
+typedef struct libgtr_bundle
+{
+	/* next older bundle of the same instance */
+	struct libgtr_bundle *next;
+	void *data;
+	size_t size;
+	/* held by the instance and by every domain set up from the bundle */
+	uint32_t refs;
+} libgtr_bundle_t;
+
 struct libgtr
 {
+	/* domains with a catalog, for bookkeeping by writers */
 	libgtr_domain_t *domains;
+	/* all domain handles, for lookups by readers */
+	libgtr_ref_table_t *refs;
+	libgtr_ref_table_t *retired_refs;
+
+	/* held by every operation that modifies the instance */
+	libgtr_mutex_t write_lock;
+	/* signalled when an on-demand or background load finishes */
+	libgtr_cond_t loaded;
+	/* on-demand loads of domains without a handle; protected by the
+	write lock */
+	libgtr_pending_load_t *pending;
+	/* hashes of the names of domains the on-demand loader failed to
+	load, by hash modulo the size; written with the write lock held */
+	uint64_t missing[GTR_MISSING_DOMAINS];
+	/* how long lookups wait for a domain being loaded, in milliseconds */
+	unsigned int load_timeout;
+
+	/* background loads; protected by the write lock */
+	libgtr_load_job_t *jobs;
+	libgtr_load_job_t *jobs_tail;
+	libgtr_cond_t jobs_queued;
+	libgtr_thread_t *workers;
+	unsigned int worker_count;
+	unsigned int worker_limit;
+	bool shutdown;
+	uint32_t epoch;
+	libgtr_reader_stripe_t readers[GTR_READER_STRIPES];
+
+	/* plural rules of all loaded domains */
+	libgtr_plural_cache_t plural_rules;
+
+	/* mounted bundles, latest first; only ever added to, under the write
+	lock */
+	libgtr_bundle_t *bundles;
+
+	/* GTRF_* flags for newly loaded catalogs */
+	unsigned int flags;
 	struct
 	{
 		libgtr_domain_load_cb dom_loader;
@@ -0,0 +1,245 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* persistent index files: the perfect hash index of a message catalog,
+stored next to it, so later loads can map it instead of building it */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* "GTRI" in little endian order. On hosts with the other byte order, the
+magic doesn't match, and the file is rebuilt. */
+#define GTRI_MAGIC 0x49525447
+#define GTRI_VERSION 2
+#define GTRI_SUFFIX ".gtri"
+
+/* Header of an index file. The pilots and the slots of the perfect hash
+follow it directly. The file doesn't contain pointers, so it can be
+used wherever it is mapped. */
+typedef struct libgtr_gtri_header
+{
+	uint32_t magic;
+	uint32_t version;
+	/* the message catalog the index was built for: the checksum of the
+	header and string descriptor tables is checked on every load, the one
+	of the whole catalog only when its modification time changed */
+	uint64_t mo_size;
+	int64_t mo_mtime;
+	uint64_t mo_tables_checksum;
+	uint64_t mo_checksum;
+	/* the perfect hash */
+	uint64_t seed;
+	uint32_t bucket_count;
+	uint32_t slot_count;
+	uint64_t index_checksum;
+} libgtr_gtri_header_t;
+
+/* Name of the index file for a message catalog. */
+static char *_gtri_path(const char *file)
+{
+	size_t len = strlen(file);
+	char *path = malloc(len + sizeof(GTRI_SUFFIX));
+	if (path)
+	{
+		memcpy(path, file, len);
+		memcpy(path + len, GTRI_SUFFIX, sizeof(GTRI_SUFFIX));
+	}
+	return path;
+}
+
+static uint64_t _gtri_index_checksum(const libgtr_mph_t *mph)
+{
+	/* The slots directly follow the pilots, both in memory and in the
+	file. */
+	assert(mph->slots == mph->pilots + mph->bucket_count);
+	return _gtr_hash((const char*)mph->pilots,
+		((size_t)mph->bucket_count + mph->slot_count) * sizeof(uint32_t));
+}
+
+/* Checksum of the whole message catalog of a domain. Reads all of it,
+so callers compute it at most once per index they write or check. */
+static uint64_t _gtri_catalog_checksum(const libgtr_domain_t *domain)
+{
+	return _gtr_hash((const char*)domain->data, domain->data_size);
+}
+
+/* Checksum of the parts of a message catalog its index depends on: the
+header and the string descriptor tables. Unlike the strings themselves,
+they are small, and their pages are read by lookups anyway. */
+static uint64_t _gtri_tables_checksum(const libgtr_domain_t *domain)
+{
+	size_t tables = (size_t)domain->string_count * 2 * sizeof(uint32_t);
+	libgtr_hash_state_t state;
+	_gtr_hash_init(&state);
+	_gtr_hash_update(&state, (const char*)domain->data, MO_HDR_0_0_SIZE);
+	_gtr_hash_update(&state,
+		(const char*)domain->data + domain->ost_offset, tables);
+	_gtr_hash_update(&state,
+		(const char*)domain->data + domain->tst_offset, tables);
+	return _gtr_hash_final(&state);
+}
+
+/* Fill in the header of an index file for the perfect hash index of a
+domain. mo_checksum is the checksum of its whole catalog, as computed by
+_gtri_catalog_checksum. */
+static void _gtri_fill_header(const libgtr_domain_t *domain, int64_t mtime,
+	uint64_t mo_checksum, libgtr_gtri_header_t *hdr)
+{
+	const libgtr_mph_t *mph = domain->mph;
+	assert(mph);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = GTRI_MAGIC;
+	hdr->version = GTRI_VERSION;
+	hdr->mo_size = domain->data_size;
+	hdr->mo_mtime = mtime;
+	hdr->mo_tables_checksum = _gtri_tables_checksum(domain);
+	hdr->mo_checksum = mo_checksum;
+	hdr->seed = mph->seed;
+	hdr->bucket_count = mph->bucket_count;
+	hdr->slot_count = mph->slot_count;
+	hdr->index_checksum = _gtri_index_checksum(mph);
+}
+
+/* Size of an index with the given number of strings, including the
+header */
+static size_t _gtri_size(uint32_t count)
+{
+	uint32_t buckets =
+		(count + GTR_MPH_BUCKET_SIZE - 1) / GTR_MPH_BUCKET_SIZE;
+	return sizeof(libgtr_gtri_header_t) +
+		((size_t)buckets + count) * sizeof(uint32_t);
+}
+
+/* Check whether an index in memory belongs to the catalog of a domain,
+and return a perfect hash that uses it in place. The checksums are only
+verified if asked to; without them, the modification time has to match.
+Returns NULL if the index doesn't match, is damaged, or if there's not
+enough memory. */
+static libgtr_mph_t *_gtri_check(const libgtr_domain_t *domain,
+	const void *data, size_t size, int64_t mtime, bool checksums)
+{
+	const libgtr_gtri_header_t *hdr = data;
+	uint32_t count = domain->string_count;
+	uint32_t buckets =
+		(count + GTR_MPH_BUCKET_SIZE - 1) / GTR_MPH_BUCKET_SIZE;
+	if (size < _gtri_size(count) ||
+		hdr->magic != GTRI_MAGIC || hdr->version != GTRI_VERSION ||
+		hdr->mo_size != domain->data_size ||
+		hdr->slot_count != count || hdr->bucket_count != buckets)
+	{
+		return NULL;
+	}
+	/* A catalog with a different modification time may still be the
+	same, for example after it was copied. Reading all of it is only
+	worth it then, since it is still much cheaper than a rebuild. */
+	if (hdr->mo_mtime != mtime && (!checksums ||
+		hdr->mo_checksum != _gtri_catalog_checksum(domain)))
+	{
+		return NULL;
+	}
+
+	libgtr_mph_t *mph = malloc(sizeof(libgtr_mph_t));
+	if (!mph)
+		return NULL;
+	mph->seed = hdr->seed;
+	mph->bucket_count = buckets;
+	mph->slot_count = count;
+	mph->pilots = (uint32_t*)(hdr + 1);
+	mph->slots = mph->pilots + buckets;
+
+	/* Catch catalogs whose strings moved without changing size or time,
+	and damaged index files. A bad slot would make lookups read outside
+	of the string tables. */
+	if (checksums && (hdr->mo_tables_checksum !=
+		_gtri_tables_checksum(domain) ||
+		hdr->index_checksum != _gtri_index_checksum(mph)))
+	{
+		free(mph);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (mph->slots[i] >= count)
+		{
+			free(mph);
+			return NULL;
+		}
+	}
+	return mph;
+}
+
+/* Write the perfect hash index of a domain into the index file of its
+message catalog, whose checksum is mo_checksum. */
+static int _gtri_write(const libgtr_domain_t *domain, const char *file,
+	int64_t mtime, uint64_t mo_checksum)
+{
+	const libgtr_mph_t *mph = domain->mph;
+	libgtr_gtri_header_t hdr;
+	_gtri_fill_header(domain, mtime, mo_checksum, &hdr);
+
+	char *path = _gtri_path(file);
+	if (!path)
+		return GTRENOMEM;
+	const void *blocks[] = { &hdr, mph->pilots };
+	size_t sizes[] = { sizeof(hdr),
+		((size_t)mph->bucket_count + mph->slot_count) * sizeof(uint32_t) };
+	int result = _gtr_replace_file(path, blocks, sizes, 2);
+	free(path);
+	return result;
+}
+
+/* Use the index stored in the index file of a message catalog. Returns
+false if there's no index file, or if it is corrupt or doesn't belong
+to the catalog as it is now. */
+static bool _gtri_attach(libgtr_domain_t *domain, const char *file,
+	int64_t mtime)
+{
+	char *path = _gtri_path(file);
+	if (!path)
+		return false;
+	void *data;
+	size_t size;
+	int64_t gtri_mtime;
+	int result = _gtr_map_file(path, &data, &size, &gtri_mtime);
+	free(path);
+	if (result != GTREOK)
+		return false;
+
+	/* Index files have a fixed size. */
+	libgtr_mph_t *mph = NULL;
+	if (size == _gtri_size(domain->string_count))
+		mph = _gtri_check(domain, data, size, mtime, true);
+	if (!mph)
+	{
+		_gtr_unmap_file(data, size);
+		return false;
+	}
+	domain->mph = mph;
+	domain->index_map = data;
+	domain->index_map_size = size;
+	/* Record the new modification time, so the next load doesn't read
+	the whole catalog again. Its checksum was just verified to match. */
+	const libgtr_gtri_header_t *hdr = data;
+	if (hdr->mo_mtime != mtime)
+		_gtri_write(domain, file, mtime, hdr->mo_checksum);
+	return true;
+}
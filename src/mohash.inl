@@ -0,0 +1,281 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* string lookup through the hash table stored in message catalogs */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <string.h>
+
+static uint32_t _mo_swap_u32(uint32_t v)
+{
+	return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) |
+		(v << 24);
+}
+
+/* Read a number from the message catalog of a domain, in host byte
+order. */
+static uint32_t _mo_read_u32(const libgtr_domain_t *domain, size_t off)
+{
+	uint32_t v = *(const uint32_t*)((const char*)domain->data + off);
+	return domain->swapped ? _mo_swap_u32(v) : v;
+}
+
+/* The hash function msgfmt uses to fill the table ("hashpjw"), continued
+from the hash of the preceding part of the string. */
+static uint32_t _mo_hash_string(uint32_t hash, const char *str, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash = (hash << 4) + (unsigned char)str[i];
+		uint32_t g = hash & 0xF0000000;
+		if (g != 0)
+		{
+			hash ^= g >> 24;
+			hash ^= g;
+		}
+	}
+	return hash;
+}
+
+/* Return the hashpjw value of a key, computing it if needed. */
+static uint32_t _gtr_key_mo_hash(libgtr_key_t *key)
+{
+	if (_gtr_key_has(key, GTR_KEY_MO_HASHED))
+		return key->mo_hash;
+
+	uint32_t hash = 0;
+	if (key->ctxt)
+	{
+		static const char separator = GTR_CONTEXT_SEPARATOR;
+		hash = _mo_hash_string(hash, key->ctxt, key->ctxt_len);
+		hash = _mo_hash_string(hash, &separator, 1);
+	}
+	hash = _mo_hash_string(hash, key->msgid, key->len);
+	if (_gtr_key_claim(key, GTR_KEY_MO_HASH_CLAIMED))
+	{
+		key->mo_hash = hash;
+		_gtr_key_publish(key, GTR_KEY_MO_HASHED);
+	}
+	return hash;
+}
+
+/* Check whether the original string with the given number is the msgid
+of key. None of the string descriptors have been validated at load time,
+so do that here. */
+static bool _mo_string_equals(const libgtr_domain_t *domain,
+	uint32_t index, const libgtr_key_t *key)
+{
+	size_t len = _gtr_key_size(key);
+	size_t desc = domain->ost_offset + (size_t)index * 2 * sizeof(uint32_t);
+	uint32_t os_size = _mo_read_u32(domain, desc);
+	uint32_t os_offset = _mo_read_u32(domain, desc + sizeof(uint32_t));
+
+	/* The length of the untranslated string includes the untranslated
+	plural form, if there is one, so it may be longer than msgid. */
+	if (os_size < len || os_offset >= domain->data_size ||
+		domain->data_size - os_offset <= len)
+	{
+		return false;
+	}
+	const char *os_data = (const char*)domain->data + os_offset;
+	return _gtr_key_equals(key, os_data) && os_data[len] == '\0';
+}
+
+/* Find the number of the string with the given msgid. Returns true if
+the string exists in the catalog. */
+static bool _mo_hash_find(const libgtr_domain_t *domain,
+	libgtr_key_t *key, uint32_t *index)
+{
+	assert(domain->hash_size > 2);
+
+	uint32_t hash = _gtr_key_mo_hash(key);
+	uint32_t size = domain->hash_size;
+	uint32_t idx = hash % size;
+	uint32_t incr = 1 + (hash % (size - 2));
+
+	/* msgfmt always leaves some slots of the table empty, which ends
+	the probe sequence. Bound the number of probes anyway so a broken
+	file can't make us loop forever. */
+	for (uint32_t probe = 0; probe < size; ++probe)
+	{
+		uint32_t nstr = _mo_read_u32(domain,
+			domain->hash_offset + (size_t)idx * sizeof(uint32_t));
+		if (nstr == 0)
+			return false;
+		/* Entries store the string number plus one. */
+		--nstr;
+		if (nstr < domain->string_count &&
+			_mo_string_equals(domain, nstr, key))
+		{
+			*index = nstr;
+			return true;
+		}
+
+		if (idx >= size - incr)
+			idx -= size - incr;
+		else
+			idx += incr;
+	}
+	return false;
+}
+
+/* Return the msgid of the string with the given number and its length,
+without the untranslated plural form. Returns NULL if the string
+descriptor is broken. */
+static const char *_mo_get_msgid(const libgtr_domain_t *domain,
+	uint32_t index, size_t *len)
+{
+	size_t desc = domain->ost_offset + (size_t)index * 2 * sizeof(uint32_t);
+	uint32_t os_size = _mo_read_u32(domain, desc);
+	uint32_t os_offset = _mo_read_u32(domain, desc + sizeof(uint32_t));
+	if (os_offset >= domain->data_size ||
+		domain->data_size - os_offset <= os_size)
+	{
+		return NULL;
+	}
+	const char *os_data = (const char*)domain->data + os_offset;
+	*len = strnlen(os_data, os_size);
+	return os_data;
+}
+
+/* Compute the hash of every msgid of the catalog, as _gtr_key_hash
+would for them. Returns false if a string descriptor is broken. */
+static bool _mo_hash_msgids(const libgtr_domain_t *domain,
+	uint64_t *hashes)
+{
+	for (uint32_t i = 0; i < domain->string_count; ++i)
+	{
+		size_t len;
+		const char *msgid = _mo_get_msgid(domain, i, &len);
+		if (!msgid)
+			return false;
+		hashes[i] = _gtr_hash(msgid, len);
+	}
+	return true;
+}
+
+/* Start loading the first hash table entry that _mo_hash_find will
+probe for a key. */
+static void _mo_hash_prefetch(const libgtr_domain_t *domain,
+	libgtr_key_t *key)
+{
+	uint32_t idx = _gtr_key_mo_hash(key) % domain->hash_size;
+	GTR_PREFETCH((const char*)domain->data +
+		domain->hash_offset + (size_t)idx * sizeof(uint32_t));
+}
+
+/* Return the requested plural form of the translated string with the
+given number, which was found for key, and store its length in *len
+unless len is NULL. Like the descriptor table, missing plural forms fall
+back to the first form. */
+static const char *_mo_get_msgstr(const libgtr_domain_t *domain,
+	uint32_t index, uint32_t plural_form, const libgtr_key_t *key,
+	size_t *len)
+{
+	size_t desc = domain->tst_offset + (size_t)index * 2 * sizeof(uint32_t);
+	uint32_t ts_size = _mo_read_u32(domain, desc);
+	uint32_t ts_offset = _mo_read_u32(domain, desc + sizeof(uint32_t));
+
+	/* The translation and its terminating NUL have to be inside the
+	data block. */
+	if (ts_offset >= domain->data_size ||
+		domain->data_size - ts_offset <= ts_size)
+	{
+		return NULL;
+	}
+	const char *ts_base = (const char*)domain->data + ts_offset;
+	if (ts_base[ts_size] != '\0')
+		return NULL;
+
+	/* A msgid without a plural has a single translation, which takes up
+	the whole string. So does every translation in a catalog with a single
+	plural form. The untranslated string only is longer than the msgid if
+	it has a plural. */
+	if (len && (domain->plurals == 1 || _mo_read_u32(domain,
+		domain->ost_offset + (size_t)index * 2 * sizeof(uint32_t)) ==
+		_gtr_key_size(key)))
+	{
+		*len = ts_size;
+		return ts_base;
+	}
+
+	const char *ts_end = ts_base + ts_size;
+	const char *ts_data = ts_base;
+	const char *first_end = ts_end;
+	for (uint32_t p = 0; p < plural_form; ++p)
+	{
+		const char *form_end = memchr(ts_data, '\0', ts_end - ts_data);
+		if (!form_end)
+		{
+			if (len)
+				*len = first_end - ts_base;
+			return ts_base;
+		}
+		if (p == 0)
+			first_end = form_end;
+		ts_data = form_end + 1;
+	}
+	if (len)
+	{
+		/* The last form ends at the end of the string. Only earlier
+		forms have to be measured. */
+		const char *form_end = plural_form + 1 < domain->plurals ?
+			memchr(ts_data, '\0', ts_end - ts_data) : NULL;
+		*len = (form_end ? form_end : ts_end) - ts_data;
+	}
+	return ts_data;
+}
+
+/* Return all plural forms of the translated string with the given
+number, like _mo_get_msgstr for every form, in a single pass over the
+string. Returns false if the string descriptor is broken. */
+static bool _mo_get_msgstrs(const libgtr_domain_t *domain,
+	uint32_t index, const char **forms, uint32_t count)
+{
+	size_t desc = domain->tst_offset + (size_t)index * 2 * sizeof(uint32_t);
+	uint32_t ts_size = _mo_read_u32(domain, desc);
+	uint32_t ts_offset = _mo_read_u32(domain, desc + sizeof(uint32_t));
+
+	if (ts_offset >= domain->data_size ||
+		domain->data_size - ts_offset <= ts_size)
+	{
+		return false;
+	}
+	const char *ts_base = (const char*)domain->data + ts_offset;
+	if (ts_base[ts_size] != '\0')
+		return false;
+
+	const char *ts_data = ts_base;
+	for (uint32_t p = 0; p < count; ++p)
+	{
+		if (ts_data)
+		{
+			forms[p] = ts_data;
+			ts_data = memchr(ts_data, '\0', ts_base + ts_size - ts_data);
+			if (ts_data)
+				++ts_data;
+		}
+		else
+		{
+			forms[p] = ts_base;
+		}
+	}
+	return true;
+}
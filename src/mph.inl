@@ -0,0 +1,288 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* minimal perfect hash index over the msgids of a message catalog */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Average number of strings per bucket. Larger buckets make the index
+smaller, but take much longer to place once the table fills up. */
+#define GTR_MPH_BUCKET_SIZE 2
+/* Number of seeds to try before giving up on building a perfect hash. */
+#define GTR_MPH_MAX_ATTEMPTS 4
+
+#define GTR_MPH_EMPTY UINT32_MAX
+
+/* Map a 32 bit value uniformly onto [0, range) without a division. */
+static uint32_t _mph_reduce(uint32_t value, uint32_t range)
+{
+	return (uint32_t)(((uint64_t)value * range) >> 32);
+}
+
+static uint32_t _mph_slot(uint64_t key, uint32_t pilot, uint32_t slots)
+{
+	uint64_t h = _gtr_hash_mix(key ^
+		(pilot * UINT64_C(0x9e3779b97f4a7c15)));
+	return _mph_reduce((uint32_t)h, slots);
+}
+
+/* Find the number of the string with the given msgid. Returns true if
+the string exists in the catalog. */
+static bool _mph_find(const libgtr_domain_t *domain,
+	libgtr_key_t *msgid, uint32_t *index)
+{
+	const libgtr_mph_t *mph = domain->mph;
+	assert(mph);
+
+	uint64_t key = _gtr_hash_mix(_gtr_key_hash(msgid) ^ mph->seed);
+	uint32_t bucket = _mph_reduce((uint32_t)(key >> 32),
+		mph->bucket_count);
+	uint32_t slot = _mph_slot(key, mph->pilots[bucket], mph->slot_count);
+
+	/* The perfect hash maps every string to some slot, whether it's in
+	the catalog or not. Compare to find out. */
+	uint32_t nstr = mph->slots[slot];
+	if (!_mo_string_equals(domain, nstr, msgid))
+		return false;
+	*index = nstr;
+	return true;
+}
+
+/* Start loading the pilot _mph_find will need for a key. */
+static void _mph_prefetch(const libgtr_domain_t *domain,
+	libgtr_key_t *msgid)
+{
+	const libgtr_mph_t *mph = domain->mph;
+	uint64_t key = _gtr_hash_mix(_gtr_key_hash(msgid) ^ mph->seed);
+	GTR_PREFETCH(&mph->pilots[_mph_reduce((uint32_t)(key >> 32),
+		mph->bucket_count)]);
+}
+
+/* Order buckets by size, largest first. Ties are ordered by bucket
+number to keep the build deterministic. */
+static bool _mph_bucket_before(uint32_t a, uint32_t b,
+	const uint32_t *bucket_start)
+{
+	uint32_t size_a = bucket_start[a + 1] - bucket_start[a];
+	uint32_t size_b = bucket_start[b + 1] - bucket_start[b];
+	if (size_a != size_b)
+		return size_a > size_b;
+	return a < b;
+}
+
+/* qsort has no context parameter, so sort bucket numbers by size with a
+simple merge sort instead. */
+static void _mph_sort_buckets(uint32_t *order, uint32_t *tmp,
+	uint32_t count, const uint32_t *bucket_start)
+{
+	for (uint32_t width = 1; width < count; width *= 2)
+	{
+		for (uint32_t lo = 0; lo < count; lo += 2 * width)
+		{
+			uint32_t mid = lo + width < count ? lo + width : count;
+			uint32_t hi =
+				lo + 2 * width < count ? lo + 2 * width : count;
+			uint32_t i = lo, j = mid, k = lo;
+			while (i < mid && j < hi)
+			{
+				if (_mph_bucket_before(order[j], order[i], bucket_start))
+					tmp[k++] = order[j++];
+				else
+					tmp[k++] = order[i++];
+			}
+			while (i < mid) tmp[k++] = order[i++];
+			while (j < hi) tmp[k++] = order[j++];
+		}
+		memcpy(order, tmp, count * sizeof(uint32_t));
+	}
+}
+
+/* Try to place all strings with the given seed. Returns GTREOK on
+success, GTREINVAL if two strings are identical or a string descriptor
+is broken, or GTRENOTSUPP if this seed doesn't work. */
+static int _mph_place(const libgtr_domain_t *domain, libgtr_mph_t *mph,
+	const uint64_t *hashes, uint32_t *scratch)
+{
+	uint32_t count = mph->slot_count;
+	uint32_t buckets = mph->bucket_count;
+	uint64_t *keys = (uint64_t*)scratch;
+	uint32_t *bucket_start = scratch + 2 * count;
+	uint32_t *members = bucket_start + buckets + 1;
+	uint32_t *order = members + count;
+	uint32_t *tmp = order + buckets;
+
+	/* Sort the strings into their buckets. */
+	memset(bucket_start, 0, (buckets + 1) * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		keys[i] = _gtr_hash_mix(hashes[i] ^ mph->seed);
+		uint32_t b = _mph_reduce((uint32_t)(keys[i] >> 32), buckets);
+		++bucket_start[b + 1];
+	}
+	for (uint32_t b = 0; b < buckets; ++b)
+		bucket_start[b + 1] += bucket_start[b];
+	memcpy(tmp, bucket_start, buckets * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t b = _mph_reduce((uint32_t)(keys[i] >> 32), buckets);
+		members[tmp[b]++] = i;
+	}
+
+	for (uint32_t b = 0; b < buckets; ++b)
+		order[b] = b;
+	_mph_sort_buckets(order, tmp, buckets, bucket_start);
+
+	memset(mph->pilots, 0, buckets * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; ++i)
+		mph->slots[i] = GTR_MPH_EMPTY;
+
+	/* Place the biggest buckets first, while most of the slots are still
+	free. */
+	for (uint32_t o = 0; o < buckets; ++o)
+	{
+		uint32_t b = order[o];
+		uint32_t first = bucket_start[b];
+		uint32_t size = bucket_start[b + 1] - first;
+		if (size == 0)
+			break;
+
+		/* Strings with the same full hash can never be separated. */
+		for (uint32_t i = first; i < first + size; ++i)
+		{
+			for (uint32_t j = i + 1; j < first + size; ++j)
+			{
+				if (hashes[members[i]] != hashes[members[j]])
+					continue;
+				size_t len_i, len_j;
+				const char *str_i =
+					_mo_get_msgid(domain, members[i], &len_i);
+				const char *str_j =
+					_mo_get_msgid(domain, members[j], &len_j);
+				if (!str_i || !str_j)
+					return GTREINVAL;
+				if (len_i == len_j && memcmp(str_i, str_j, len_i) == 0)
+				{
+					/* There is already a string with this msgid.
+					That is not legal in .mo files. */
+					return GTREINVAL;
+				}
+				return GTRENOTSUPP;
+			}
+		}
+
+		/* Try pilots until all strings of the bucket land in distinct
+		free slots. With every slot filled at the end, the last buckets
+		need about as many attempts as there are slots. */
+		uint32_t *pos = tmp;
+		uint32_t max_pilot = count < (UINT32_MAX - 1024) / 64 ?
+			64 * count + 1024 : UINT32_MAX;
+		uint32_t pilot;
+		for (pilot = 0; pilot < max_pilot; ++pilot)
+		{
+			uint32_t placed;
+			for (placed = 0; placed < size; ++placed)
+			{
+				uint32_t slot = _mph_slot(keys[members[first + placed]],
+					pilot, count);
+				if (mph->slots[slot] != GTR_MPH_EMPTY)
+					break;
+				uint32_t k;
+				for (k = 0; k < placed; ++k)
+				{
+					if (pos[k] == slot)
+						break;
+				}
+				if (k < placed)
+					break;
+				pos[placed] = slot;
+			}
+			if (placed == size)
+				break;
+		}
+		if (pilot == max_pilot)
+			return GTRENOTSUPP;
+
+		mph->pilots[b] = pilot;
+		for (uint32_t i = 0; i < size; ++i)
+			mph->slots[pos[i]] = members[first + i];
+	}
+
+	return GTREOK;
+}
+
+/* Build a minimal perfect hash index over the msgids of the catalog.
+Returns GTREOK, GTREINVAL if the catalog is broken, GTRENOMEM, or
+GTRENOTSUPP if no perfect hash was found and the caller should fall back
+to a different index. */
+static int _mph_build(libgtr_domain_t *domain)
+{
+	uint32_t count = domain->string_count;
+	if (count == 0)
+		return GTRENOTSUPP;
+
+	uint32_t buckets =
+		(count + GTR_MPH_BUCKET_SIZE - 1) / GTR_MPH_BUCKET_SIZE;
+
+	/* The index itself is allocated in one block so it can be freed in
+	one go. */
+	libgtr_mph_t *mph = malloc(sizeof(libgtr_mph_t) +
+		((size_t)buckets + count) * sizeof(uint32_t));
+	uint64_t *hashes = malloc(count * sizeof(uint64_t));
+	/* keys, bucket offsets, bucket members, bucket order, temp space */
+	uint32_t *scratch = malloc(((size_t)2 * count + buckets + 1 + count +
+		buckets + (buckets > count ? buckets : count)) * sizeof(uint32_t));
+	int result = GTRENOMEM;
+	if (!mph || !hashes || !scratch)
+		goto _mph_build_cleanup;
+
+	mph->bucket_count = buckets;
+	mph->slot_count = count;
+	mph->pilots = (uint32_t*)(mph + 1);
+	mph->slots = mph->pilots + buckets;
+
+	/* Hash all msgids once. They don't change between attempts. */
+	if (!_mo_hash_msgids(domain, hashes))
+	{
+		result = GTREINVAL;
+		goto _mph_build_cleanup;
+	}
+
+	result = GTRENOTSUPP;
+	for (int attempt = 0;
+		attempt < GTR_MPH_MAX_ATTEMPTS && result == GTRENOTSUPP;
+		++attempt)
+	{
+		mph->seed = _gtr_hash_mix(attempt + 1);
+		result = _mph_place(domain, mph, hashes, scratch);
+	}
+
+_mph_build_cleanup:
+	free(scratch);
+	free(hashes);
+	if (result != GTREOK)
+	{
+		free(mph);
+		mph = NULL;
+	}
+	domain->mph = mph;
+	return result;
+}
@@ -0,0 +1,350 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* overlays: one merged index over a stack of message catalogs attached
+to the same domain, or over the catalogs of a fallback chain. Each msgid
+has a single entry, for the catalog that has precedence, so lookups are
+done with the first match. Readers never lock, so the index is never
+changed once published: attaching or detaching a layer copies the table,
+then only updates the entries of that layer's msgids. */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Find the translation of key. Returns the catalog of the layer with the
+highest precedence that has it, and the number of the string in that
+catalog, or NULL if no layer has it. */
+static const libgtr_domain_t *_overlay_find(const libgtr_overlay_t *ov,
+	libgtr_key_t *key, uint32_t *index)
+{
+	uint64_t hash = _gtr_key_hash(key);
+	for (size_t i = hash & ov->mask;; i = (i + 1) & ov->mask)
+	{
+		const libgtr_overlay_entry_t *e = &ov->entries[i];
+		if (e->layer == GTR_OVERLAY_EMPTY)
+			return NULL;
+		if (e->hash != hash)
+			continue;
+		const libgtr_domain_t *catalog = ov->layers[e->layer]->catalog;
+		if (_mo_string_equals(catalog, e->string, key))
+		{
+			*index = e->string;
+			return catalog;
+		}
+	}
+}
+
+static void _overlay_prefetch(const libgtr_overlay_t *ov,
+	libgtr_key_t *key)
+{
+	GTR_PREFETCH(&ov->entries[_gtr_key_hash(key) & ov->mask]);
+}
+
+/* Find the entry for the msgid of string s of a catalog, or the empty
+slot where it would go. The msgid is only read if another one has the
+same hash. */
+static size_t _overlay_probe(const libgtr_overlay_t *ov, uint64_t hash,
+	const libgtr_domain_t *catalog, uint32_t s)
+{
+	libgtr_key_t key = { NULL, 0, 0, 0, 0, NULL, 0 };
+	size_t i = hash & ov->mask;
+	for (; ov->entries[i].layer != GTR_OVERLAY_EMPTY; i = (i + 1) & ov->mask)
+	{
+		const libgtr_overlay_entry_t *e = &ov->entries[i];
+		if (e->hash != hash)
+			continue;
+		/* Layers checked their msgids when they were loaded. */
+		if (!key.msgid)
+			key.msgid = _mo_get_msgid(catalog, s, &key.len);
+		assert(key.msgid);
+		if (_mo_string_equals(ov->layers[e->layer]->catalog, e->string,
+			&key))
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+static void _overlay_insert(libgtr_overlay_t *ov,
+	const libgtr_overlay_entry_t *entry)
+{
+	size_t i = entry->hash & ov->mask;
+	while (ov->entries[i].layer != GTR_OVERLAY_EMPTY)
+		i = (i + 1) & ov->mask;
+	ov->entries[i] = *entry;
+	++ov->used;
+}
+
+/* Add the layer in a slot on top of all others. Its strings take over
+the entries of the msgids it shares with lower layers. */
+static void _overlay_add_layer(libgtr_overlay_t *ov, uint32_t slot)
+{
+	const libgtr_layer_t *layer = ov->layers[slot];
+	for (uint32_t s = 0; s < layer->catalog->string_count; ++s)
+	{
+		uint64_t hash = layer->hashes[s];
+		size_t i = _overlay_probe(ov, hash, layer->catalog, s);
+		libgtr_overlay_entry_t *e = &ov->entries[i];
+		/* If the catalog has a msgid twice, the first one counts, as it
+		does for a catalog on its own. */
+		if (e->layer == slot)
+			continue;
+		if (e->layer == GTR_OVERLAY_EMPTY)
+			++ov->used;
+		e->hash = hash;
+		e->layer = slot;
+		e->string = s;
+	}
+}
+
+/* Remove the entry of a slot. Later entries of a run move up into the
+gap, so lookups don't stop early. */
+static void _overlay_erase(libgtr_overlay_t *ov, size_t i)
+{
+	for (size_t j = (i + 1) & ov->mask;
+		ov->entries[j].layer != GTR_OVERLAY_EMPTY;
+		j = (j + 1) & ov->mask)
+	{
+		/* An entry can move into the gap if that doesn't put it before
+		its home slot. */
+		size_t home = ov->entries[j].hash & ov->mask;
+		if (((j - home) & ov->mask) >= ((j - i) & ov->mask))
+		{
+			ov->entries[i] = ov->entries[j];
+			i = j;
+		}
+	}
+	ov->entries[i].layer = GTR_OVERLAY_EMPTY;
+	--ov->used;
+}
+
+/* Remove the layer in a slot. The entries it had are handed down to the
+highest lower layer with the same msgid, or removed if there is none.
+Only the lower layers' hashes are scanned; their strings are only read
+if a hash matches. Returns GTREOK or GTRENOMEM. */
+static int _overlay_remove_layer(libgtr_overlay_t *ov, uint32_t slot)
+{
+	const libgtr_layer_t *layer = ov->layers[slot];
+
+	/* Collect the entries of the layer in a small table by hash. Strings
+	of the layer that lower layers never saw aren't in the index. */
+	size_t size = 16;
+	while (size < 2 * (size_t)layer->catalog->string_count + 2)
+		size *= 2;
+	size_t *orphans = malloc(size * sizeof(size_t));
+	if (!orphans)
+		return GTRENOMEM;
+	for (size_t k = 0; k < size; ++k)
+		orphans[k] = SIZE_MAX;
+	size_t left = 0;
+	for (uint32_t s = 0; s < layer->catalog->string_count; ++s)
+	{
+		uint64_t hash = layer->hashes[s];
+		size_t i = hash & ov->mask;
+		for (; ov->entries[i].layer != GTR_OVERLAY_EMPTY;
+			i = (i + 1) & ov->mask)
+		{
+			if (ov->entries[i].layer == slot &&
+				ov->entries[i].string == s)
+			{
+				break;
+			}
+		}
+		if (ov->entries[i].layer == GTR_OVERLAY_EMPTY)
+			continue;
+		size_t k = hash & (size - 1);
+		while (orphans[k] != SIZE_MAX)
+			k = (k + 1) & (size - 1);
+		orphans[k] = i;
+		++left;
+	}
+
+	/* Hand them down, going through the layers by precedence. */
+	for (uint32_t l = slot; l-- > 0 && left > 0;)
+	{
+		const libgtr_layer_t *lower = ov->layers[l];
+		if (!lower)
+			continue;
+		for (uint32_t s = 0; s < lower->catalog->string_count; ++s)
+		{
+			uint64_t hash = lower->hashes[s];
+			libgtr_key_t key = { NULL, 0, 0, 0, 0, NULL, 0 };
+			for (size_t k = hash & (size - 1); orphans[k] != SIZE_MAX;
+				k = (k + 1) & (size - 1))
+			{
+				libgtr_overlay_entry_t *e = &ov->entries[orphans[k]];
+				if (e->hash != hash || e->layer != slot)
+					continue;
+				if (!key.msgid)
+					key.msgid = _mo_get_msgid(lower->catalog, s, &key.len);
+				assert(key.msgid);
+				if (_mo_string_equals(layer->catalog, e->string, &key))
+				{
+					e->layer = l;
+					e->string = s;
+					--left;
+					break;
+				}
+			}
+		}
+	}
+	free(orphans);
+
+	/* Remove what no other layer has. Entries move while doing so, so
+	look for them again. */
+	for (uint32_t s = 0; s < layer->catalog->string_count && left > 0; ++s)
+	{
+		size_t i = layer->hashes[s] & ov->mask;
+		for (; ov->entries[i].layer != GTR_OVERLAY_EMPTY;
+			i = (i + 1) & ov->mask)
+		{
+			if (ov->entries[i].layer == slot &&
+				ov->entries[i].string == s)
+			{
+				_overlay_erase(ov, i);
+				--left;
+				break;
+			}
+		}
+	}
+	assert(left == 0);
+	return GTREOK;
+}
+
+/* Build the index of a fallback chain, first catalog first. Each msgid
+only gets an entry for the first catalog that has it, so misses don't
+cost more than in a single catalog. Returns GTREOK or GTRENOMEM. */
+static int _overlay_resolve(libgtr_overlay_t *ov)
+{
+	size_t total = 0;
+	for (uint32_t l = 0; l < ov->layer_count; ++l)
+		total += ov->layers[l]->catalog->string_count;
+	size_t size = 16;
+	while (size < 2 * total + 2)
+		size *= 2;
+	ov->entries = malloc(size * sizeof(libgtr_overlay_entry_t));
+	if (!ov->entries)
+		return GTRENOMEM;
+	ov->mask = size - 1;
+	ov->used = 0;
+	ov->resolved = true;
+	for (size_t i = 0; i < size; ++i)
+		ov->entries[i].layer = GTR_OVERLAY_EMPTY;
+
+	for (uint32_t l = 0; l < ov->layer_count; ++l)
+	{
+		const libgtr_layer_t *layer = ov->layers[l];
+		for (uint32_t s = 0; s < layer->catalog->string_count; ++s)
+		{
+			uint64_t hash = layer->hashes[s];
+			size_t i = _overlay_probe(ov, hash, layer->catalog, s);
+			if (ov->entries[i].layer != GTR_OVERLAY_EMPTY)
+				continue;
+			libgtr_overlay_entry_t entry = { hash, l, s };
+			ov->entries[i] = entry;
+			++ov->used;
+		}
+	}
+	return GTREOK;
+}
+
+static void _overlay_free(libgtr_overlay_t *ov)
+{
+	if (!ov)
+		return;
+	free(ov->entries);
+	free(ov->layers);
+	free(ov);
+}
+
+/* Copy an overlay, with room for one more layer and the given number of
+entries. Without holes, the entries are copied as they are; when the
+table grows, or more than half of the layer slots are holes, they are
+rehashed, which still doesn't touch any of the catalogs. The caller has
+to take references to the layers of the copy. */
+static libgtr_overlay_t *_overlay_copy(const libgtr_overlay_t *old,
+	size_t extra)
+{
+	libgtr_overlay_t *ov = calloc(1, sizeof(libgtr_overlay_t));
+	if (!ov)
+		return NULL;
+
+	/* Keep the table at most half full. */
+	size_t used = (old ? old->used : 0) + extra;
+	size_t size = old ? old->mask + 1 : 16;
+	while (size < 2 * used + 2)
+		size *= 2;
+
+	uint32_t live = 0;
+	uint32_t slots = old ? old->layer_count : 0;
+	for (uint32_t l = 0; l < slots; ++l)
+		live += old->layers[l] != NULL;
+	bool compact = live * 2 < slots;
+
+	ov->layers = malloc((size_t)((compact ? live : slots) + 1) *
+		sizeof(libgtr_layer_t*));
+	ov->entries = malloc(size * sizeof(libgtr_overlay_entry_t));
+	if (!ov->layers || !ov->entries)
+	{
+		_overlay_free(ov);
+		return NULL;
+	}
+	ov->mask = size - 1;
+
+	if (old && !compact && size == old->mask + 1)
+	{
+		memcpy(ov->entries, old->entries,
+			size * sizeof(libgtr_overlay_entry_t));
+		memcpy(ov->layers, old->layers, slots * sizeof(libgtr_layer_t*));
+		ov->layer_count = slots;
+		ov->used = old->used;
+		return ov;
+	}
+
+	for (size_t i = 0; i < size; ++i)
+		ov->entries[i].layer = GTR_OVERLAY_EMPTY;
+	/* Map old slots to new ones, dropping the holes when compacting. */
+	uint32_t *renumber = malloc((slots + 1) * sizeof(uint32_t));
+	if (!renumber)
+	{
+		_overlay_free(ov);
+		return NULL;
+	}
+	for (uint32_t l = 0; l < slots; ++l)
+	{
+		if (compact && old->layers[l] == NULL)
+			continue;
+		renumber[l] = ov->layer_count;
+		ov->layers[ov->layer_count++] = old->layers[l];
+	}
+	for (size_t i = 0; old && i <= old->mask; ++i)
+	{
+		libgtr_overlay_entry_t entry = old->entries[i];
+		if (entry.layer == GTR_OVERLAY_EMPTY)
+			continue;
+		entry.layer = renumber[entry.layer];
+		_overlay_insert(ov, &entry);
+	}
+	free(renumber);
+	return ov;
+}
@@ -23,6 +23,10 @@
 #include "plurals.y.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static int _plural_expr_eval(libgtr_plural_expr_t *expr, int n)
 {
@@ -78,6 +82,9 @@ static libgtr_plural_expr_t *_plural_expr_parse(const char *spec)
 	};
 	if (_gtr_pluralparse(&parser) == 0)
 		return parser.result;
+	/* The whole expression may have been reduced before the parser found
+	trailing garbage. */
+	libgtr_plural_expr_free(parser.result);
 	return NULL;
 }
 
@@ -92,3 +99,773 @@ void libgtr_plural_expr_free(libgtr_plural_expr_t *expr)
 	}
 	free(expr);
 }
+
+/* Write a plural expression in a normalized form: fully parenthesized,
+without whitespace. Returns false if the buffer is too small. */
+static bool _plural_expr_serialize(const libgtr_plural_expr_t *expr,
+	char *buf, size_t size, size_t *pos)
+{
+#define PUT(str) do { \
+		size_t len = strlen(str); \
+		if (size - *pos <= len) \
+			return false; \
+		memcpy(buf + *pos, (str), len + 1); \
+		*pos += len; \
+	} while (0)
+#define ARG(i) do { \
+		if (!_plural_expr_serialize(expr->args[i], buf, size, pos)) \
+			return false; \
+	} while (0)
+
+	static const char *const binops[] = {
+		"+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=",
+		"&&", "||"
+	};
+	char num[16];
+	switch (expr->op)
+	{
+	case GPEO_INT:
+		snprintf(num, sizeof(num), "%d", expr->val);
+		PUT(num);
+		return true;
+	case GPEO_VAR:
+		PUT("n");
+		return true;
+	case GPEO_NOT:
+		PUT("!");
+		ARG(0);
+		return true;
+	case GPEO_TERN:
+		PUT("(");
+		ARG(0);
+		PUT("?");
+		ARG(1);
+		PUT(":");
+		ARG(2);
+		PUT(")");
+		return true;
+	default:
+		assert(expr->op >= GPEO_ADD && expr->op <= GPEO_OR);
+		PUT("(");
+		ARG(0);
+		PUT(binops[expr->op - GPEO_ADD]);
+		ARG(1);
+		PUT(")");
+		return true;
+	}
+#undef ARG
+#undef PUT
+}
+
+/* Native evaluators for the Plural-Forms expressions found in nearly
+all real-world catalogs, as listed in the gettext manual. They compute
+exactly what the expressions compute, for negative n as well. */
+static int _plural_one_form(int n)
+{
+	(void)n;
+	return 0;
+}
+static int _plural_germanic(int n)
+{
+	return n != 1;
+}
+static int _plural_french(int n)
+{
+	return n > 1;
+}
+static int _plural_latvian(int n)
+{
+	return n % 10 == 1 && n % 100 != 11 ? 0 : n != 0 ? 1 : 2;
+}
+static int _plural_irish_3(int n)
+{
+	return n == 1 ? 0 : n == 2 ? 1 : 2;
+}
+static int _plural_romanian(int n)
+{
+	return n == 1 ? 0 :
+		(n == 0 || (n % 100 > 0 && n % 100 < 20)) ? 1 : 2;
+}
+static int _plural_lithuanian(int n)
+{
+	return n % 10 == 1 && n % 100 != 11 ? 0 :
+		n % 10 >= 2 && (n % 100 < 10 || n % 100 >= 20) ? 1 : 2;
+}
+static int _plural_east_slavic(int n)
+{
+	return n % 10 == 1 && n % 100 != 11 ? 0 :
+		n % 10 >= 2 && n % 10 <= 4 && (n % 100 < 10 || n % 100 >= 20) ?
+		1 : 2;
+}
+static int _plural_czech(int n)
+{
+	return n == 1 ? 0 : (n >= 2 && n <= 4) ? 1 : 2;
+}
+static int _plural_polish(int n)
+{
+	return n == 1 ? 0 :
+		n % 10 >= 2 && n % 10 <= 4 && (n % 100 < 10 || n % 100 >= 20) ?
+		1 : 2;
+}
+static int _plural_slovenian(int n)
+{
+	return n % 100 == 1 ? 0 : n % 100 == 2 ? 1 :
+		n % 100 == 3 || n % 100 == 4 ? 2 : 3;
+}
+static int _plural_arabic(int n)
+{
+	return n == 0 ? 0 : n == 1 ? 1 : n == 2 ? 2 :
+		n % 100 >= 3 && n % 100 <= 10 ? 3 : n % 100 >= 11 ? 4 : 5;
+}
+static int _plural_icelandic(int n)
+{
+	return n % 10 != 1 || n % 100 == 11;
+}
+static int _plural_irish_5(int n)
+{
+	return n == 1 ? 0 : n == 2 ? 1 : n < 7 ? 2 : n < 11 ? 3 : 4;
+}
+static int _plural_scottish_gaelic(int n)
+{
+	return (n == 1 || n == 11) ? 0 : (n == 2 || n == 12) ? 1 :
+		(n > 2 && n < 20) ? 2 : 3;
+}
+static int _plural_macedonian(int n)
+{
+	return n == 1 || n % 10 == 1 ? 0 : 1;
+}
+static int _plural_maltese(int n)
+{
+	return n == 1 ? 0 : n == 0 || (n % 100 > 1 && n % 100 < 11) ? 1 :
+		(n % 100 > 10 && n % 100 < 20) ? 2 : 3;
+}
+
+/* The expressions above, as written by _plural_expr_serialize. */
+static const struct
+{
+	const char *expr;
+	libgtr_plural_fn fn;
+} _plural_natives[] = {
+	{ "0", _plural_one_form },
+	{ "(n!=1)", _plural_germanic },
+	{ "(n>1)", _plural_french },
+	{ "((((n%10)==1)&&((n%100)!=11))?0:((n!=0)?1:2))", _plural_latvian },
+	{ "((n==1)?0:((n==2)?1:2))", _plural_irish_3 },
+	{ "((n==1)?0:(((n==0)||(((n%100)>0)&&((n%100)<20)))?1:2))",
+		_plural_romanian },
+	{ "((((n%10)==1)&&((n%100)!=11))?0:((((n%10)>=2)&&(((n%100)<10)||"
+		"((n%100)>=20)))?1:2))", _plural_lithuanian },
+	{ "((((n%10)==1)&&((n%100)!=11))?0:(((((n%10)>=2)&&((n%10)<=4))&&"
+		"(((n%100)<10)||((n%100)>=20)))?1:2))", _plural_east_slavic },
+	{ "((n==1)?0:(((n>=2)&&(n<=4))?1:2))", _plural_czech },
+	{ "((n==1)?0:(((((n%10)>=2)&&((n%10)<=4))&&(((n%100)<10)||"
+		"((n%100)>=20)))?1:2))", _plural_polish },
+	{ "(((n%100)==1)?0:(((n%100)==2)?1:((((n%100)==3)||((n%100)==4))?"
+		"2:3)))", _plural_slovenian },
+	{ "((n==0)?0:((n==1)?1:((n==2)?2:((((n%100)>=3)&&((n%100)<=10))?3:"
+		"(((n%100)>=11)?4:5)))))", _plural_arabic },
+	{ "(((n%10)!=1)||((n%100)==11))", _plural_icelandic },
+	{ "((n==1)?0:((n==2)?1:((n<7)?2:((n<11)?3:4))))", _plural_irish_5 },
+	{ "(((n==1)||(n==11))?0:(((n==2)||(n==12))?1:(((n>2)&&(n<20))?2:"
+		"3)))", _plural_scottish_gaelic },
+	{ "(((n==1)||((n%10)==1))?0:1)", _plural_macedonian },
+	{ "((n==1)?0:(((n==0)||(((n%100)>1)&&((n%100)<11)))?1:((((n%100)>10)"
+		"&&((n%100)<20))?2:3)))", _plural_maltese },
+};
+
+/* Find a native evaluator for an expression. Returns NULL if there is
+none. Like _plural_expr_eval, a NULL expression means English-style
+plurals. */
+libgtr_plural_fn libgtr_plural_native(const libgtr_plural_expr_t *expr)
+{
+	if (expr == NULL)
+		return _plural_germanic;
+
+	char buf[256];
+	size_t pos = 0;
+	if (!_plural_expr_serialize(expr, buf, sizeof(buf), &pos))
+		return NULL;
+	for (size_t i = 0;
+		i < sizeof(_plural_natives) / sizeof(_plural_natives[0]); ++i)
+	{
+		if (strcmp(buf, _plural_natives[i].expr) == 0)
+			return _plural_natives[i].fn;
+	}
+	return NULL;
+}
+
+libgtr_plural_expr_t *libgtr_plural_expr_parse(const char *spec)
+{
+	return _plural_expr_parse(spec);
+}
+
+int libgtr_plural_expr_eval(libgtr_plural_expr_t *expr, int n)
+{
+	return _plural_expr_eval(expr, n);
+}
+
+/* Plural expression compiler
+
+The tree is flattened into postfix order, so evaluation is a single loop
+over an array instead of a recursive walk. Binary operations with a
+constant right operand, like n % 10 or n == 1, which make up most of
+real-world formulas, take the constant as an immediate operand. Only the
+ternary operator needs jumps: all other operations are free of side
+effects, so && and || can evaluate both operands. */
+
+typedef struct libgtr_plural_compiler
+{
+	int32_t *code;
+	uint32_t length;
+	uint32_t capacity;
+	unsigned int depth;
+	unsigned int max_depth;
+	bool failed;
+} libgtr_plural_compiler_t;
+
+static uint32_t _plural_emit(libgtr_plural_compiler_t *c, int32_t word)
+{
+	if (c->length == c->capacity)
+	{
+		uint32_t capacity = c->capacity ? c->capacity * 2 : 32;
+		int32_t *code = realloc(c->code, capacity * sizeof(int32_t));
+		if (!code)
+		{
+			c->failed = true;
+			return c->length;
+		}
+		c->code = code;
+		c->capacity = capacity;
+	}
+	c->code[c->length] = word;
+	return c->length++;
+}
+
+static void _plural_push(libgtr_plural_compiler_t *c)
+{
+	if (++c->depth > c->max_depth)
+		c->max_depth = c->depth;
+}
+
+static void _plural_compile(libgtr_plural_compiler_t *c,
+	const libgtr_plural_expr_t *expr)
+{
+	if (c->failed)
+		return;
+
+	switch (expr->op)
+	{
+	case GPEO_INT:
+		_plural_emit(c, GPPO_INT);
+		_plural_emit(c, expr->val);
+		_plural_push(c);
+		return;
+	case GPEO_VAR:
+		_plural_emit(c, GPPO_VAR);
+		_plural_push(c);
+		return;
+	case GPEO_NOT:
+		_plural_compile(c, expr->args[0]);
+		_plural_emit(c, GPPO_NOT);
+		return;
+	case GPEO_TERN:
+	{
+		/* condition, JZ else, then-branch, JMP end, else-branch */
+		_plural_compile(c, expr->args[0]);
+		_plural_emit(c, GPPO_JZ);
+		uint32_t jz = _plural_emit(c, 0);
+		--c->depth;
+		_plural_compile(c, expr->args[1]);
+		_plural_emit(c, GPPO_JMP);
+		uint32_t jmp = _plural_emit(c, 0);
+		/* Only one of the branches leaves its result on the stack. */
+		--c->depth;
+		if (!c->failed)
+			c->code[jz] = c->length;
+		_plural_compile(c, expr->args[2]);
+		if (!c->failed)
+			c->code[jmp] = c->length;
+		return;
+	}
+	default:
+		break;
+	}
+
+	int32_t op;
+	switch (expr->op)
+	{
+	case GPEO_ADD: op = GPPO_ADD; break;
+	case GPEO_SUB: op = GPPO_SUB; break;
+	case GPEO_MUL: op = GPPO_MUL; break;
+	case GPEO_DIV: op = GPPO_DIV; break;
+	case GPEO_MOD: op = GPPO_MOD; break;
+	case GPEO_EQ: op = GPPO_EQ; break;
+	case GPEO_NEQ: op = GPPO_NEQ; break;
+	case GPEO_LT: op = GPPO_LT; break;
+	case GPEO_LTE: op = GPPO_LTE; break;
+	case GPEO_GT: op = GPPO_GT; break;
+	case GPEO_GTE: op = GPPO_GTE; break;
+	case GPEO_AND: op = GPPO_AND; break;
+	case GPEO_OR: op = GPPO_OR; break;
+	default:
+		assert(!"Unknown plural expression opcode encountered!");
+		c->failed = true;
+		return;
+	}
+
+	_plural_compile(c, expr->args[0]);
+	if (expr->args[1]->op == GPEO_INT)
+	{
+		_plural_emit(c, op - GPPO_ADD + GPPO_ADD_IMM);
+		_plural_emit(c, expr->args[1]->val);
+	}
+	else
+	{
+		_plural_compile(c, expr->args[1]);
+		_plural_emit(c, op);
+		--c->depth;
+	}
+}
+
+/* Compile a plural expression. Returns NULL if the expression is too
+deeply nested, or if there's not enough memory. */
+libgtr_plural_program_t *libgtr_plural_program_compile(
+	const libgtr_plural_expr_t *expr)
+{
+	if (expr == NULL)
+		return NULL;
+
+	libgtr_plural_compiler_t c = { NULL, 0, 0, 0, 0, false };
+	_plural_compile(&c, expr);
+	_plural_emit(&c, GPPO_END);
+
+	libgtr_plural_program_t *program = NULL;
+	if (!c.failed && c.max_depth <= GTR_PLURAL_MAX_STACK)
+	{
+		program = malloc(sizeof(libgtr_plural_program_t) +
+			c.length * sizeof(int32_t));
+		if (program)
+		{
+			program->length = c.length;
+			memcpy(program->code, c.code, c.length * sizeof(int32_t));
+		}
+	}
+	free(c.code);
+	return program;
+}
+
+/* Arithmetic for compiled programs. Unlike the tree evaluator, this
+wraps around on overflow and yields 0 for division by zero, so a broken
+catalog can't crash lookups. */
+static int _plural_div(int a, int b)
+{
+	if (b == 0 || (a == INT_MIN && b == -1))
+		return 0;
+	return a / b;
+}
+static int _plural_mod(int a, int b)
+{
+	if (b == 0 || (a == INT_MIN && b == -1))
+		return 0;
+	return a % b;
+}
+#define _PLURAL_WRAP(a, op, b) ((int)((unsigned int)(a) op (unsigned int)(b)))
+
+int libgtr_plural_program_eval(const libgtr_plural_program_t *program,
+	int n)
+{
+	int stack[GTR_PLURAL_MAX_STACK];
+	/* top of the stack; the stack is empty at stack - 1 */
+	int *sp = stack - 1;
+	const int32_t *pc = program->code;
+
+#define BINOP(optag, expr) \
+	case optag: --sp; { int a = sp[0], b = sp[1]; sp[0] = (expr); } break; \
+	case optag##_IMM: { int a = sp[0], b = *pc++; sp[0] = (expr); } break
+
+	for (;;)
+	{
+		switch (*pc++)
+		{
+		case GPPO_END:
+			return *sp;
+		case GPPO_INT:
+			*++sp = *pc++;
+			break;
+		case GPPO_VAR:
+			*++sp = n;
+			break;
+		case GPPO_NOT:
+			*sp = !*sp;
+			break;
+		case GPPO_JZ:
+			if (*sp-- == 0)
+				pc = program->code + *pc;
+			else
+				++pc;
+			break;
+		case GPPO_JMP:
+			pc = program->code + *pc;
+			break;
+
+		BINOP(GPPO_ADD, _PLURAL_WRAP(a, +, b));
+		BINOP(GPPO_SUB, _PLURAL_WRAP(a, -, b));
+		BINOP(GPPO_MUL, _PLURAL_WRAP(a, *, b));
+		BINOP(GPPO_DIV, _plural_div(a, b));
+		BINOP(GPPO_MOD, _plural_mod(a, b));
+		BINOP(GPPO_EQ, a == b);
+		BINOP(GPPO_NEQ, a != b);
+		BINOP(GPPO_LT, a < b);
+		BINOP(GPPO_LTE, a <= b);
+		BINOP(GPPO_GT, a > b);
+		BINOP(GPPO_GTE, a >= b);
+		BINOP(GPPO_AND, a && b);
+		BINOP(GPPO_OR, a || b);
+
+		default:
+			assert(!"Unknown plural program opcode encountered!");
+			return 0;
+		}
+	}
+#undef BINOP
+}
+#undef _PLURAL_WRAP
+
+void libgtr_plural_program_free(libgtr_plural_program_t *program)
+{
+	free(program);
+}
+
+/* Plural rules
+
+Most lookups are for small n, so every rule keeps a table of results
+for n from 0 upwards. Real-world expressions only look at n through
+n % 10, n % 100 and comparisons with small constants, so past the
+largest constant the result repeats with the period of the moduli. For
+those, the table covers one full period and every non-negative n maps
+into it. */
+
+static uint32_t _plural_gcd(uint32_t a, uint32_t b)
+{
+	while (b != 0)
+	{
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Check whether the value of an expression only depends on n % period
+once n >= threshold, for a period no longer than GTR_PLURAL_TABLE_MAX. */
+static bool _plural_periodic(const libgtr_plural_expr_t *expr,
+	uint32_t *threshold, uint32_t *period)
+{
+	switch (expr->op)
+	{
+	case GPEO_INT:
+		*threshold = 0;
+		*period = 1;
+		return true;
+	case GPEO_VAR:
+		return false;
+	default:
+		break;
+	}
+
+	const libgtr_plural_expr_t *lhs = expr->args[0];
+	const libgtr_plural_expr_t *rhs = expr->args[1];
+
+	/* n % m repeats every m. */
+	if (expr->op == GPEO_MOD && lhs->op == GPEO_VAR &&
+		rhs->op == GPEO_INT && rhs->val > 0)
+	{
+		if (rhs->val > GTR_PLURAL_TABLE_MAX)
+			return false;
+		*threshold = 0;
+		*period = rhs->val;
+		return true;
+	}
+
+	/* A comparison of n with a constant doesn't change any more once n
+	is past the constant. */
+	if (expr->op >= GPEO_EQ && expr->op <= GPEO_GTE &&
+		(lhs->op == GPEO_VAR || rhs->op == GPEO_VAR))
+	{
+		const libgtr_plural_expr_t *other =
+			lhs->op == GPEO_VAR ? rhs : lhs;
+		if (other->op != GPEO_INT)
+			return false;
+		*threshold = other->val < 0 ? 0 : (uint32_t)other->val + 1;
+		*period = 1;
+		return true;
+	}
+
+	/* Anything computed from values that repeat repeats as well. */
+	int args = expr->op == GPEO_NOT ? 1 : expr->op == GPEO_TERN ? 3 : 2;
+	*threshold = 0;
+	*period = 1;
+	for (int i = 0; i < args; ++i)
+	{
+		uint32_t arg_threshold, arg_period;
+		if (!_plural_periodic(expr->args[i], &arg_threshold, &arg_period))
+			return false;
+		if (arg_threshold > *threshold)
+			*threshold = arg_threshold;
+		uint64_t lcm = (uint64_t)*period / _plural_gcd(*period, arg_period)
+			* arg_period;
+		if (lcm > GTR_PLURAL_TABLE_MAX)
+			return false;
+		*period = (uint32_t)lcm;
+	}
+	return true;
+}
+
+bool libgtr_plural_expr_periodic(const libgtr_plural_expr_t *expr,
+	uint32_t *threshold, uint32_t *period)
+{
+	if (expr == NULL)
+	{
+		/* n != 1 */
+		*threshold = 2;
+		*period = 1;
+		return true;
+	}
+	return _plural_periodic(expr, threshold, period);
+}
+
+/* Evaluate a rule without its table. */
+static int _plural_rule_eval_slow(const libgtr_plural_rule_t *rule, int n)
+{
+	if (rule->native)
+		return rule->native(n);
+	if (rule->program)
+		return libgtr_plural_program_eval(rule->program, n);
+	return _plural_expr_eval(rule->expr, n);
+}
+
+/* Set up everything needed to evaluate an expression. The rule takes
+ownership of the expression, which may be NULL for English-style
+plurals. Returns NULL if there's not enough memory. */
+libgtr_plural_rule_t *libgtr_plural_rule_new(libgtr_plural_expr_t *expr)
+{
+	/* Prefer a native evaluator for well-known expressions. If the
+	expression can't be compiled either, it has to be evaluated from the
+	tree. */
+	libgtr_plural_fn native = libgtr_plural_native(expr);
+	libgtr_plural_program_t *program = NULL;
+	if (!native)
+		program = libgtr_plural_program_compile(expr);
+
+	uint32_t threshold = 0, period = 0, table_size = 0;
+	/* The table is filled at load time, for values of n nobody may ever
+	ask for. The tree evaluator can crash on a division by zero, so only
+	precompute results for expressions that have a safe evaluator. */
+	if (native || program)
+	{
+		if (libgtr_plural_expr_periodic(expr, &threshold, &period) &&
+			threshold + period <= GTR_PLURAL_TABLE_MAX)
+		{
+			table_size = threshold + period;
+		}
+		else
+		{
+			threshold = period = 0;
+			table_size = GTR_PLURAL_TABLE_SIZE;
+		}
+	}
+
+	libgtr_plural_rule_t *rule =
+		malloc(sizeof(libgtr_plural_rule_t) + table_size);
+	if (!rule)
+	{
+		libgtr_plural_program_free(program);
+		libgtr_plural_expr_free(expr);
+		return NULL;
+	}
+	rule->cache = NULL;
+	rule->key = NULL;
+	rule->refs = 1;
+	rule->expr = expr;
+	rule->program = program;
+	rule->native = native;
+	rule->threshold = threshold;
+	rule->period = period;
+	/* Leave the table empty while filling it, so the results come from
+	the evaluators. */
+	rule->table_size = 0;
+	for (uint32_t n = 0; n < table_size; ++n)
+	{
+		int form = _plural_rule_eval_slow(rule, (int)n);
+		rule->table[n] = form >= 0 && form < GTR_PLURAL_TABLE_INVALID ?
+			(uint8_t)form : GTR_PLURAL_TABLE_INVALID;
+	}
+	rule->table_size = table_size;
+	return rule;
+}
+
+int libgtr_plural_rule_eval(const libgtr_plural_rule_t *rule, int n)
+{
+	if (n >= 0)
+	{
+		uint32_t index = (uint32_t)n;
+		if (index >= rule->table_size && rule->period != 0)
+		{
+			index = rule->threshold +
+				(index - rule->threshold) % rule->period;
+		}
+		if (index < rule->table_size &&
+			rule->table[index] != GTR_PLURAL_TABLE_INVALID)
+		{
+			return rule->table[index];
+		}
+	}
+	return _plural_rule_eval_slow(rule, n);
+}
+
+void libgtr_plural_rule_free(libgtr_plural_rule_t *rule)
+{
+	if (rule == NULL)
+		return;
+	free(rule->key);
+	libgtr_plural_program_free(rule->program);
+	libgtr_plural_expr_free(rule->expr);
+	free(rule);
+}
+
+/* Classes of characters that make up a token of a plural expression
+together: 1 for numbers and names, 2 for operators, 0 for all others. */
+static int _plural_spec_class(char c)
+{
+	if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+		(c >= 'A' && c <= 'Z') || c == '_')
+	{
+		return 1;
+	}
+	return c != '\0' && strchr("<>=!&|+-*/%?:", c) ? 2 : 0;
+}
+
+/* Write the text of a plural expression up to its end, with whitespace
+only where it separates tokens that would otherwise run together, as in
+"n > = 2". Returns false if the buffer is too small. */
+static bool _plural_spec_normalize(const char *spec,
+	char *buf, size_t size, size_t *len)
+{
+	size_t pos = 0;
+	bool space = false;
+	for (; *spec != '\0' && *spec != '\n' && *spec != ';'; ++spec)
+	{
+		if (*spec == ' ' || *spec == '\t')
+		{
+			space = true;
+			continue;
+		}
+		bool separate = space && pos > 0 &&
+			_plural_spec_class(*spec) != 0 &&
+			_plural_spec_class(*spec) == _plural_spec_class(buf[pos - 1]);
+		space = false;
+		if (pos + 1 + separate >= size)
+			return false;
+		if (separate)
+			buf[pos++] = ' ';
+		buf[pos++] = *spec;
+	}
+	buf[pos] = '\0';
+	*len = pos;
+	return true;
+}
+
+/* Find or create the shared rule for the text of a plural expression,
+which may be NULL for English-style plurals. The expression is only
+parsed if there is no rule for it yet; if it doesn't parse, the domain
+gets a rule of its own without an expression, like the one for
+English-style plurals. The rule has to be released with
+libgtr_plural_rule_release. Returns NULL if there's not enough
+memory. */
+libgtr_plural_rule_t *libgtr_plural_rule_acquire(
+	libgtr_plural_cache_t *cache, const char *spec)
+{
+	/* Expressions that differ only in whitespace between tokens share a
+	rule.
+	Expressions too long for the buffer are unusual enough to get a rule
+	of their own. English-style plurals get the empty key. */
+	char key[256];
+	size_t key_len = 0;
+	key[0] = '\0';
+	if (spec != NULL && !_plural_spec_normalize(spec, key, sizeof(key),
+		&key_len))
+	{
+		return libgtr_plural_rule_new(_plural_expr_parse(spec));
+	}
+
+	libgtr_plural_rule_t *rule;
+	_gtr_mutex_lock(&cache->lock);
+	HASH_FIND(hh, cache->rules, key, key_len, rule);
+	if (rule)
+		++rule->refs;
+	_gtr_mutex_unlock(&cache->lock);
+	if (rule)
+		return rule;
+
+	/* Parsing the expression and filling the table take a moment, so
+	don't hold the lock while doing so. If another thread adds the same
+	rule in the meantime, use that one instead. */
+	libgtr_plural_expr_t *expr = NULL;
+	if (spec != NULL)
+	{
+		/* Broken expressions aren't shared, so they can't stand in for
+		anything but themselves. */
+		expr = _plural_expr_parse(spec);
+		if (expr == NULL)
+			return libgtr_plural_rule_new(NULL);
+	}
+	libgtr_plural_rule_t *new_rule = libgtr_plural_rule_new(expr);
+	if (!new_rule)
+		return NULL;
+	new_rule->key = malloc(key_len + 1);
+	if (!new_rule->key)
+	{
+		libgtr_plural_rule_free(new_rule);
+		return NULL;
+	}
+	memcpy(new_rule->key, key, key_len + 1);
+
+	_gtr_mutex_lock(&cache->lock);
+	HASH_FIND(hh, cache->rules, key, key_len, rule);
+	if (rule)
+	{
+		++rule->refs;
+	}
+	else
+	{
+		rule = new_rule;
+		rule->cache = cache;
+		HASH_ADD_KEYPTR(hh, cache->rules, rule->key, key_len, rule);
+		new_rule = NULL;
+	}
+	_gtr_mutex_unlock(&cache->lock);
+	libgtr_plural_rule_free(new_rule);
+	return rule;
+}
+
+/* Drop a reference to a rule, and free it if it was the last one. */
+void libgtr_plural_rule_release(libgtr_plural_rule_t *rule)
+{
+	if (rule == NULL)
+		return;
+
+	libgtr_plural_cache_t *cache = rule->cache;
+	if (cache == NULL)
+	{
+		libgtr_plural_rule_free(rule);
+		return;
+	}
+
+	_gtr_mutex_lock(&cache->lock);
+	bool last = --rule->refs == 0;
+	if (last)
+		HASH_DEL(cache->rules, rule);
+	_gtr_mutex_unlock(&cache->lock);
+	if (last)
+		libgtr_plural_rule_free(rule);
+}
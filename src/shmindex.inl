@@ -0,0 +1,295 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* shared indexes: the perfect hash index of a message catalog, published
+in named shared memory by the first process that loads the catalog, and
+mapped read-only by all others. The shared memory holds an index file
+(see indexfile.inl). The first process creates it before building the
+index, and sets its magic once the index is complete; processes that
+load the catalog in the meantime wait for that. */
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GTRS_NAME_SIZE 64
+/* How long to wait for another process to publish an index, in
+milliseconds. After that, the process is assumed to have died, and the
+index is replaced. */
+#define GTRS_WAIT_MS 5000
+
+/* Name of the shared memory that holds the index for a message catalog.
+Processes that load the same catalog by different names don't share an
+index, but they still work. */
+static void _gtrs_name(const char *file, char *name)
+{
+#if defined(_WIN32)
+	snprintf(name, GTRS_NAME_SIZE, "Local\\libgtr-%016llx",
+		(unsigned long long)_gtr_hash(file, strlen(file)));
+#elif defined(__unix__)
+	/* Only share with processes of the same user: the shared memory is
+	trusted to belong to the catalog as long as size and modification time
+	match. _gtrs_map checks that it really belongs to the user. */
+	char *path = realpath(file, NULL);
+	const char *p = path ? path : file;
+	snprintf(name, GTRS_NAME_SIZE, "/libgtr-%lu-%016llx",
+		(unsigned long)geteuid(),
+		(unsigned long long)_gtr_hash(p, strlen(p)));
+	free(path);
+#endif
+}
+
+/* Map existing shared memory, read-only. Returns GTRENOENT if there is
+none, or GTREPERM if it may have been written by somebody else. Shared
+memory that was just created may still be empty; data is NULL then. */
+static int _gtrs_map(const char *name, void **data, size_t *size)
+{
+	*data = NULL;
+	*size = 0;
+#if defined(_WIN32)
+	/* Names in the Local namespace are private to the session, so other
+	users can't have created the mapping. */
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (mapping == NULL)
+		return GTRENOENT;
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == NULL)
+		return GTRENOMEM;
+	/* The size of the view is rounded up to whole pages, which is fine:
+	the header says how much of it is used. */
+	MEMORY_BASIC_INFORMATION info;
+	if (VirtualQuery(view, &info, sizeof(info)) == 0)
+	{
+		UnmapViewOfFile(view);
+		return GTRENOMEM;
+	}
+	*data = view;
+	*size = info.RegionSize;
+	return GTREOK;
+#elif defined(__unix__)
+	int fh = shm_open(name, O_RDONLY, 0);
+	if (fh < 0)
+		return errno == ENOENT ? GTRENOENT : GTREACCES;
+	struct stat st;
+	if (fstat(fh, &st) == -1)
+	{
+		close(fh);
+		return GTREACCES;
+	}
+	/* Anybody can create shared memory by any name, including the names
+	of other users. Only trust it if nobody else can have written it. */
+	if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		close(fh);
+		return GTREPERM;
+	}
+	void *view = NULL;
+	if (st.st_size > 0)
+		view = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fh, 0);
+	close(fh);
+	if (view == MAP_FAILED)
+		return GTRENOMEM;
+	*data = view;
+	*size = st.st_size;
+	return GTREOK;
+#endif
+}
+
+/* Create new shared memory and map it for writing. Returns NULL if it
+already exists, or can't be created. */
+static void *_gtrs_create(const char *name, size_t size)
+{
+#if defined(_WIN32)
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+		PAGE_READWRITE, 0, (DWORD)size, name);
+	if (mapping == NULL)
+		return NULL;
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		CloseHandle(mapping);
+		return NULL;
+	}
+	/* The view keeps the mapping alive for as long as it exists. */
+	void *data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+	CloseHandle(mapping);
+	return data;
+#elif defined(__unix__)
+	int fh = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fh < 0)
+		return NULL;
+	void *data = MAP_FAILED;
+	if (ftruncate(fh, size) == 0)
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fh, 0);
+	close(fh);
+	if (data == MAP_FAILED)
+	{
+		shm_unlink(name);
+		return NULL;
+	}
+	return data;
+#endif
+}
+
+/* Make a mapping created by _gtrs_create read-only. */
+static void _gtrs_protect(void *data, size_t size)
+{
+#if defined(_WIN32)
+	DWORD old;
+	VirtualProtect(data, size, PAGE_READONLY, &old);
+#elif defined(__unix__)
+	mprotect(data, size, PROT_READ);
+#endif
+}
+
+/* Remove shared memory. Processes that have it mapped keep using it.
+Named mappings on Windows go away with the last process that uses them,
+and can't be removed. */
+static int _gtrs_remove(const char *name)
+{
+#if defined(_WIN32)
+	(void)name;
+	return GTRENOTSUPP;
+#elif defined(__unix__)
+	if (shm_unlink(name) == 0)
+		return GTREOK;
+	return errno == ENOENT ? GTRENOENT : GTREACCES;
+#endif
+}
+
+/* Use the index another process published for a message catalog,
+waiting for it if it is still being built. Returns false if there is
+none, or if it belongs to a different version of the catalog. Outdated
+indexes, and ones that don't get finished, are removed, so a new one can
+be published. Shared memory that doesn't belong to the user is left
+alone; the catalog gets a private index then. */
+static bool _gtrs_attach(libgtr_domain_t *domain, const char *file,
+	int64_t mtime)
+{
+	char name[GTRS_NAME_SIZE];
+	_gtrs_name(file, name);
+
+	void *data = NULL;
+	size_t size = 0;
+	uint64_t deadline = _gtr_now_ms() + GTRS_WAIT_MS;
+	for (;;)
+	{
+		if (!data)
+		{
+			int result = _gtrs_map(name, &data, &size);
+			if (result == GTRENOENT || result == GTREPERM)
+				return false;
+			if (result != GTREOK)
+				break;
+			if (data && size < sizeof(libgtr_gtri_header_t))
+				break;
+		}
+		if (data && _gtr_atomic_load_u32(
+			&((libgtr_gtri_header_t*)data)->magic) == GTRI_MAGIC)
+		{
+			break;
+		}
+		if (_gtr_now_ms() >= deadline)
+			break;
+		_gtr_sleep_ms(1);
+	}
+
+	/* Only the process that wrote the index can have damaged it, so
+	don't spend the time on checksums. The string numbers in the index
+	are still checked, though. */
+	libgtr_mph_t *mph = NULL;
+	if (data && size >= sizeof(libgtr_gtri_header_t) &&
+		((libgtr_gtri_header_t*)data)->magic == GTRI_MAGIC)
+	{
+		mph = _gtri_check(domain, data, size, mtime, false);
+	}
+	if (!mph)
+	{
+		if (data)
+			_gtr_unmap_file(data, size);
+		_gtrs_remove(name);
+		return false;
+	}
+	domain->mph = mph;
+	domain->index_map = data;
+	domain->index_map_size = size;
+	return true;
+}
+
+/* Create the shared memory for the index of a domain, before building
+the index, so other processes wait for it instead of building their own.
+Returns NULL if another process was faster. */
+static void *_gtrs_claim(const libgtr_domain_t *domain, const char *file)
+{
+	char name[GTRS_NAME_SIZE];
+	_gtrs_name(file, name);
+	return _gtrs_create(name, _gtri_size(domain->string_count));
+}
+
+/* Give up on publishing the index of a domain, for example because it
+couldn't be built, and let other processes try themselves. */
+static void _gtrs_abandon(const libgtr_domain_t *domain, const char *file,
+	void *data)
+{
+	char name[GTRS_NAME_SIZE];
+	_gtrs_name(file, name);
+	_gtrs_remove(name);
+	_gtr_unmap_file(data, _gtri_size(domain->string_count));
+}
+
+/* Publish the perfect hash index of a domain in the shared memory
+claimed for it, and switch the domain over to the published copy, so
+that this process doesn't keep a private one either. */
+static void _gtrs_publish(libgtr_domain_t *domain, const char *file,
+	void *data, int64_t mtime)
+{
+	const libgtr_mph_t *mph = domain->mph;
+	if (!mph)
+	{
+		_gtrs_abandon(domain, file, data);
+		return;
+	}
+	assert(!domain->index_map);
+
+	size_t size = _gtri_size(mph->slot_count);
+	/* Shared indexes are only ever matched by modification time, so
+	don't read the whole catalog for a checksum nobody verifies. */
+	libgtr_gtri_header_t hdr;
+	_gtri_fill_header(domain, mtime, 0, &hdr);
+	uint32_t magic = hdr.magic;
+	hdr.magic = 0;
+	memcpy(data, &hdr, sizeof(hdr));
+	memcpy((libgtr_gtri_header_t*)data + 1, mph->pilots,
+		size - sizeof(hdr));
+	_gtr_atomic_store_u32(&((libgtr_gtri_header_t*)data)->magic, magic);
+	_gtrs_protect(data, size);
+
+	libgtr_mph_t *shared = _gtri_check(domain, data, size, mtime, false);
+	if (!shared)
+	{
+		_gtr_unmap_file(data, size);
+		return;
+	}
+	free(domain->mph);
+	domain->mph = shared;
+	domain->index_map = data;
+	domain->index_map_size = size;
+}
@@ -0,0 +1,409 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+ *
+ * Permission to use, copy, modify, and / or distribute this software
+ * for any purpose with or without fee is hereby granted, provided that
+ * the above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ * OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* synchronization between lookups and loading/unloading of domains
+
+Lookups never take a lock. A reader marks the time it spends looking
+at domains by incrementing a reader counter on entry and decrementing it
+on exit. Writers serialize on a mutex, make their changes visible by
+atomically replacing pointers, and before freeing anything a reader may
+still be looking at, wait until all readers that were active at the time
+of the change have left ("grace period").
+*/
+
+#include "../libgtr/gtr.h"
+#include "gtrP.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__)
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+static void _gtr_mutex_init(libgtr_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void _gtr_mutex_destroy(libgtr_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void _gtr_mutex_lock(libgtr_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+static void _gtr_mutex_unlock(libgtr_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(mutex);
+#elif defined(__unix__)
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void _gtr_cond_init(libgtr_cond_t *cond)
+{
+#if defined(_WIN32)
+	InitializeConditionVariable(cond);
+#elif defined(__unix__)
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+static void _gtr_cond_destroy(libgtr_cond_t *cond)
+{
+#if defined(_WIN32)
+	/* Nothing to do */
+	(void)cond;
+#elif defined(__unix__)
+	pthread_cond_destroy(cond);
+#endif
+}
+
+static void _gtr_cond_wait(libgtr_cond_t *cond, libgtr_mutex_t *mutex)
+{
+#if defined(_WIN32)
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+#elif defined(__unix__)
+	pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/* Wait on a condition variable for at most the given number of
+milliseconds. */
+static void _gtr_cond_timedwait(libgtr_cond_t *cond, libgtr_mutex_t *mutex,
+	unsigned int ms)
+{
+#if defined(_WIN32)
+	SleepConditionVariableCS(cond, mutex, ms);
+#elif defined(__unix__)
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_nsec -= 1000000000;
+		++ts.tv_sec;
+	}
+	pthread_cond_timedwait(cond, mutex, &ts);
+#endif
+}
+
+static void _gtr_cond_signal(libgtr_cond_t *cond)
+{
+#if defined(_WIN32)
+	WakeConditionVariable(cond);
+#elif defined(__unix__)
+	pthread_cond_signal(cond);
+#endif
+}
+
+static void _gtr_cond_broadcast(libgtr_cond_t *cond)
+{
+#if defined(_WIN32)
+	WakeAllConditionVariable(cond);
+#elif defined(__unix__)
+	pthread_cond_broadcast(cond);
+#endif
+}
+
+/* Milliseconds since some fixed point in the past. */
+static uint64_t _gtr_now_ms(void)
+{
+#if defined(_WIN32)
+	return GetTickCount64();
+#elif defined(__unix__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+typedef void (*libgtr_thread_fn)(void *arg);
+
+typedef struct libgtr_thread_start
+{
+	libgtr_thread_fn fn;
+	void *arg;
+} libgtr_thread_start_t;
+
+#if defined(_WIN32)
+static DWORD WINAPI _gtr_thread_main(LPVOID p)
+#elif defined(__unix__)
+static void *_gtr_thread_main(void *p)
+#endif
+{
+	libgtr_thread_start_t start = *(libgtr_thread_start_t*)p;
+	free(p);
+	start.fn(start.arg);
+	return 0;
+}
+
+/* Start a thread running fn(arg). Returns GTREOK or GTRENOMEM. */
+static int _gtr_thread_create(libgtr_thread_t *thread, libgtr_thread_fn fn,
+	void *arg)
+{
+	libgtr_thread_start_t *start = malloc(sizeof(libgtr_thread_start_t));
+	if (!start)
+		return GTRENOMEM;
+	start->fn = fn;
+	start->arg = arg;
+#if defined(_WIN32)
+	*thread = CreateThread(NULL, 0, _gtr_thread_main, start, 0, NULL);
+	if (*thread == NULL)
+#elif defined(__unix__)
+	if (pthread_create(thread, NULL, _gtr_thread_main, start) != 0)
+#endif
+	{
+		free(start);
+		return GTRENOMEM;
+	}
+	return GTREOK;
+}
+
+static void _gtr_thread_join(libgtr_thread_t thread)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#elif defined(__unix__)
+	pthread_join(thread, NULL);
+#endif
+}
+
+/* Number of processors available. */
+static unsigned int _gtr_cpu_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#elif defined(__unix__)
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (unsigned int)count : 1;
+#endif
+}
+
+static void _gtr_yield(void)
+{
+#if defined(_WIN32)
+	SwitchToThread();
+#elif defined(__unix__)
+	sched_yield();
+#endif
+}
+
+static void _gtr_sleep_ms(unsigned int ms)
+{
+#if defined(_WIN32)
+	Sleep(ms);
+#elif defined(__unix__)
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+/* Reader stripe of the calling thread, plus one. Threads are assigned
+stripes round robin on their first lookup. */
+static GTR_THREAD_LOCAL uint32_t _gtr_thread_stripe;
+static uint32_t _gtr_next_stripe;
+
+/* Enter a read-side critical section. Pointers loaded from the library
+instance stay valid until the matching _gtr_read_unlock. Returns a token
+to pass to it. */
+static unsigned int _gtr_read_lock(libgtr_t *gtr)
+{
+	uint32_t stripe = _gtr_thread_stripe;
+	if (stripe == 0)
+	{
+		stripe = _gtr_atomic_add_u32(&_gtr_next_stripe, 1) %
+			GTR_READER_STRIPES + 1;
+		_gtr_thread_stripe = stripe;
+	}
+	--stripe;
+
+	uint32_t parity = _gtr_atomic_load_u32(&gtr->epoch) & 1;
+	_gtr_atomic_add_u32(&gtr->readers[stripe].count[parity], 1);
+	return stripe * 2 + parity;
+}
+
+static void _gtr_read_unlock(libgtr_t *gtr, unsigned int token)
+{
+	_gtr_atomic_add_u32(&gtr->readers[token / 2].count[token % 2],
+		(uint32_t)-1);
+}
+
+static void _gtr_ref_table_free(libgtr_ref_table_t *table);
+
+/* Wait until all readers that might have seen state the caller has
+unpublished are gone, then free superseded ref tables. Must be called
+with the write lock held.
+
+A reader may have read the epoch just before it changed and still enter
+with the old parity, so wait for both counters in turn: the first flip
+drains everyone counted under the current parity, the second drains the
+stragglers that entered under the other one. */
+static void _gtr_synchronize(libgtr_t *gtr)
+{
+	for (int flip = 0; flip < 2; ++flip)
+	{
+		uint32_t parity = _gtr_atomic_add_u32(&gtr->epoch, 1) & 1;
+		for (size_t s = 0; s < GTR_READER_STRIPES; ++s)
+		{
+			while (_gtr_atomic_load_u32(&gtr->readers[s].count[parity]))
+				_gtr_yield();
+		}
+	}
+
+	while (gtr->retired_refs)
+	{
+		libgtr_ref_table_t *table = gtr->retired_refs;
+		gtr->retired_refs = table->retired;
+		_gtr_ref_table_free(table);
+	}
+}
+
+/* Domain handle tables */
+
+static libgtr_ref_table_t *_gtr_ref_table_new(size_t size)
+{
+	assert(size != 0 && (size & (size - 1)) == 0);
+	libgtr_ref_table_t *table = calloc(1,
+		sizeof(libgtr_ref_table_t) + size * sizeof(libgtr_domain_ref_t*));
+	if (!table)
+		return NULL;
+	table->mask = size - 1;
+	return table;
+}
+
+/* Free a table, but not the handles in it. */
+static void _gtr_ref_table_free(libgtr_ref_table_t *table)
+{
+	free(table);
+}
+
+static void _gtr_ref_table_put(libgtr_ref_table_t *table,
+	libgtr_domain_ref_t *ref)
+{
+	size_t idx = (size_t)ref->hash & table->mask;
+	while (table->refs[idx] != NULL)
+		idx = (idx + 1) & table->mask;
+	GTR_ATOMIC_STORE_PTR(&table->refs[idx], ref);
+	++table->count;
+}
+
+/* Find the handle for a domain name in the published table. Call from a
+read-side critical section, or with the write lock held. */
+static libgtr_domain_ref_t *_gtr_ref_find(libgtr_t *gtr, const char *name,
+	size_t len, uint64_t hash)
+{
+	const libgtr_ref_table_t *table = GTR_ATOMIC_LOAD_PTR(&gtr->refs);
+	if (table == NULL)
+		return NULL;
+
+	/* The table is never more than half full, so this terminates. */
+	for (size_t idx = (size_t)hash & table->mask; ;
+		idx = (idx + 1) & table->mask)
+	{
+		libgtr_domain_ref_t *ref = GTR_ATOMIC_LOAD_PTR(&table->refs[idx]);
+		if (ref == NULL)
+			return NULL;
+		if (ref->hash == hash && ref->name_len == len &&
+			memcmp(ref->name, name, len) == 0)
+		{
+			return ref;
+		}
+	}
+}
+
+/* Create the handle for a domain name and publish it. Must be called
+with the write lock held, and only if there is no handle for the name
+yet. */
+static libgtr_domain_ref_t *_gtr_ref_create(libgtr_t *gtr,
+	const char *name, size_t len, uint64_t hash)
+{
+	libgtr_domain_ref_t *ref = calloc(1, sizeof(libgtr_domain_ref_t));
+	if (!ref)
+		return NULL;
+	ref->name = malloc(len + 1);
+	if (!ref->name)
+	{
+		free(ref);
+		return NULL;
+	}
+	memcpy(ref->name, name, len);
+	ref->name[len] = '\0';
+	ref->name_len = len;
+	ref->hash = hash;
+
+	libgtr_ref_table_t *old = gtr->refs;
+	if (old && (old->count + 1) * 2 <= old->mask + 1)
+	{
+		/* There's room. Readers probing concurrently either see the new
+		entry or an empty slot, and both are fine. */
+		_gtr_ref_table_put(old, ref);
+		return ref;
+	}
+
+	/* Publish a table twice the size. The old one is freed after the
+	next grace period. */
+	size_t size = old ? 2 * (old->mask + 1) : 8;
+	libgtr_ref_table_t *table = _gtr_ref_table_new(size);
+	if (!table)
+	{
+		free(ref->name);
+		free(ref);
+		return NULL;
+	}
+	if (old)
+	{
+		for (size_t i = 0; i <= old->mask; ++i)
+		{
+			if (old->refs[i])
+				_gtr_ref_table_put(table, old->refs[i]);
+		}
+	}
+	_gtr_ref_table_put(table, ref);
+
+	GTR_ATOMIC_STORE_PTR(&gtr->refs, table);
+	if (old)
+	{
+		old->retired = gtr->retired_refs;
+		gtr->retired_refs = old;
+	}
+	return ref;
+}
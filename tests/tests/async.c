@@ -0,0 +1,144 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+static libgtr_t *gtr;
+static volatile int done;
+static volatile int result;
+static volatile int release;
+
+static void yield(void)
+{
+#if defined(_WIN32)
+	Sleep(0);
+#else
+	sched_yield();
+#endif
+}
+
+static void loaded(libgtr_t *gtr, const char *domain, int res,
+	void *opaque)
+{
+	(void)gtr;
+	(void)domain;
+	if (opaque)
+		*(volatile int*)opaque = 1;
+	result = res;
+	++done;
+}
+
+/* Keep the worker busy until released. */
+static void blocking(libgtr_t *gtr, const char *domain, int res,
+	void *opaque)
+{
+	loaded(gtr, domain, res, opaque);
+	while (!release)
+		yield();
+}
+
+void test_async__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+	done = 0;
+	result = 1;
+	release = 0;
+}
+
+void test_async__cleanup(void)
+{
+	release = 1;
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_async__load(void)
+{
+	cl_must_pass(libgtr_set_load_timeout(gtr, LIBGTR_WAIT_FOREVER));
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo", loaded, NULL)
+		);
+	/* Lookups wait for the load if asked to. */
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	while (!done)
+		yield();
+	cl_assert_equal_i(GTREOK, result);
+}
+
+void test_async__failure(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"domain", CLAR_RESOURCES "/nonexistent.mo", loaded, NULL)
+		);
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	while (!done)
+		yield();
+	cl_assert_equal_i(GTRENOENT, result);
+}
+
+void test_async__timeout(void)
+{
+	/* With a single worker, the second load stays queued until the
+	first callback returns. */
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"first", CLAR_RESOURCES "/basic.mo", blocking, NULL)
+		);
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"second", CLAR_RESOURCES "/basic.mo", loaded, NULL)
+		);
+	/* Lookups don't wait by default. */
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "second", "test 1", 1));
+
+	cl_must_pass(libgtr_set_load_timeout(gtr, 10));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "second", "test 1", 1));
+
+	release = 1;
+	while (done < 2)
+		yield();
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "second", "test 1", 1));
+}
+
+void test_async__destroy_finishes_loads(void)
+{
+	/* The workers run concurrently, so each has its own flag. */
+	volatile int first = 0, second = 0;
+	cl_must_pass(libgtr_set_load_threads(gtr, 2));
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"first", CLAR_RESOURCES "/basic.mo", loaded, (void*)&first)
+		);
+	cl_must_pass(libgtr_load_msgcat_file_async(gtr,
+		"second", CLAR_RESOURCES "/header.mo", loaded, (void*)&second)
+		);
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	cl_assert_equal_i(1, first);
+	cl_assert_equal_i(1, second);
+}
@@ -0,0 +1,113 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+static libgtr_t *gtr;
+
+void test_batch__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_batch__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+/* Batches have to give the same results as single lookups. */
+static void check_batches(void)
+{
+	int ns[200];
+	const char *out[200];
+	for (int i = 0; i < 200; ++i)
+		ns[i] = i * 7 - 50;
+
+	static const char *msgids[] = { "test 1", "test 2", "test 3", "test 4" };
+	for (size_t m = 0; m < sizeof(msgids) / sizeof(msgids[0]); ++m)
+	{
+		cl_must_pass(libgtr_get_translations_n(gtr, "plurals-complex",
+			msgids[m], ns, 200, out));
+		for (int i = 0; i < 200; ++i)
+		{
+			cl_assert_equal_s(libgtr_get_translation(gtr,
+				"plurals-complex", msgids[m], ns[i]), out[i]);
+		}
+	}
+
+	const char *many[37];
+	for (int i = 0; i < 37; ++i)
+		many[i] = i % 5 == 4 ? NULL : msgids[i % 5];
+	cl_must_pass(libgtr_get_translations(gtr, "plurals-complex",
+		many, ns, 37, out));
+	for (int i = 0; i < 37; ++i)
+	{
+		cl_assert_equal_s(many[i] ? libgtr_get_translation(gtr,
+			"plurals-complex", many[i], ns[i]) : NULL, out[i]);
+	}
+
+	cl_must_pass(libgtr_get_translations(gtr, "plurals-complex",
+		many, NULL, 3, out));
+	cl_assert_equal_s("test 1 translation", out[0]);
+	cl_assert_equal_s("test 2 translation 0", out[1]);
+	cl_assert_equal_s("test 3 translation 0", out[2]);
+}
+
+void test_batch__translate(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_batches();
+}
+
+void test_batch__translate_mo_hash(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_MO_HASH));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_batches();
+}
+
+void test_batch__translate_perfect_hash(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_PERFECT_HASH));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_batches();
+}
+
+void test_batch__missing_domain(void)
+{
+	const char *msgid = "test 1";
+	int n = 1;
+	const char *out = "x";
+	cl_must_pass(libgtr_get_translations_n(gtr, "nope", msgid, &n, 1, &out));
+	cl_assert_equal_s(NULL, out);
+	out = "x";
+	cl_must_pass(libgtr_get_translations(gtr, "nope", &msgid, &n, 1, &out));
+	cl_assert_equal_s(NULL, out);
+
+	cl_must_fail(libgtr_get_translations_n(gtr, "nope", msgid, NULL, 1,
+		&out));
+	cl_must_fail(libgtr_get_translations(gtr, "nope", NULL, &n, 1, &out));
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+static libgtr_t *gtr;
+
+void test_bulk__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_bulk__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_bulk__load(void)
+{
+	libgtr_msgcat_file_t files[] = {
+		{ "basic", CLAR_RESOURCES "/basic.mo" },
+		{ "header", CLAR_RESOURCES "/header.mo" },
+		{ "complex", CLAR_RESOURCES "/plurals-complex.mo" },
+	};
+	cl_must_pass(libgtr_load_msgcat_files(gtr, files, 3, 2));
+	for (int i = 0; i < 3; ++i)
+	{
+		cl_assert_equal_i(GTREOK, files[i].result);
+		cl_assert_equal_s("test 1 translation",
+			libgtr_get_translation(gtr, files[i].domain, "test 1", 1));
+	}
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "complex", "test 3", 12));
+}
+
+void test_bulk__partial_failure(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"loaded", CLAR_RESOURCES "/basic.mo")
+		);
+	libgtr_msgcat_file_t files[] = {
+		{ "basic", CLAR_RESOURCES "/basic.mo" },
+		{ "missing", CLAR_RESOURCES "/nonexistent.mo" },
+		{ "loaded", CLAR_RESOURCES "/header.mo" },
+		{ "header", CLAR_RESOURCES "/header.mo" },
+	};
+	cl_assert_equal_i(GTRENOENT, libgtr_load_msgcat_files(gtr, files, 4, 0));
+	cl_assert_equal_i(GTREOK, files[0].result);
+	cl_assert_equal_i(GTRENOENT, files[1].result);
+	cl_assert_equal_i(GTREEXIST, files[2].result);
+	cl_assert_equal_i(GTREOK, files[3].result);
+
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "header", "test 1", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "missing", "test 1", 1));
+}
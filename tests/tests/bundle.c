@@ -0,0 +1,178 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUNDLE "bundle.gtrb"
+
+static libgtr_t *gtr;
+
+static libgtr_msgcat_file_t catalogs[] = {
+	{ "fr/basic", CLAR_RESOURCES "/basic.mo", 0 },
+	{ "de/complex", CLAR_RESOURCES "/plurals-complex.mo", 0 },
+	{ "de/header", CLAR_RESOURCES "/header.mo", 0 },
+};
+
+void test_bundle__initialize(void)
+{
+	cl_must_pass(libgtr_write_bundle(BUNDLE, catalogs, 3));
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_bundle__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	remove(BUNDLE);
+}
+
+static void check_translations(void)
+{
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "fr/basic", "test 1", 1));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "de/complex", "test 3", 12));
+	cl_assert_equal_s("test 2 translation",
+		libgtr_get_translation(gtr, "de/header", "test 2", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "de/complex", "test 4", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "de/basic", "test 1", 1));
+}
+
+void test_bundle__domains_set_up_on_first_use(void)
+{
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE));
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "de/complex", "test 3", 3));
+	cl_assert_equal_i(1, HASH_COUNT(gtr->domains));
+	libgtr_domain_t *dom = gtr->domains;
+	cl_assert_equal_s("de/complex", dom->name);
+	/* The prebuilt index is used, even though no perfect hash was asked
+	for. */
+	cl_assert(dom->mph != NULL);
+	cl_assert_equal_i(GTR_INDEX_READY, dom->index_state);
+
+	check_translations();
+	/* Domains that aren't in the bundle aren't created. */
+	cl_assert_equal_i(3, HASH_COUNT(gtr->domains));
+}
+
+void test_bundle__outlives_instance_domains(void)
+{
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE));
+	check_translations();
+	cl_must_pass(libgtr_unload_domain(gtr, "de/complex"));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "de/complex", "test 3", 12));
+}
+
+void test_bundle__latest_bundle_wins(void)
+{
+	libgtr_msgcat_file_t other[] = {
+		{ "de/complex", CLAR_RESOURCES "/basic.mo", 0 },
+	};
+	cl_must_pass(libgtr_write_bundle(BUNDLE ".2", other, 1));
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE));
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE ".2"));
+	remove(BUNDLE ".2");
+
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "de/complex", "test 1", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "de/complex", "test 3", 12));
+	cl_assert_equal_s("test 2 translation",
+		libgtr_get_translation(gtr, "de/header", "test 2", 1));
+}
+
+void test_bundle__loaded_domains_first(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "de/complex",
+		CLAR_RESOURCES "/basic.mo"));
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "de/complex", "test 1", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "de/complex", "test 3", 12));
+}
+
+void test_bundle__lazy_index(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LAZY_INDEX));
+	cl_must_pass(libgtr_load_bundle(gtr, BUNDLE));
+	check_translations();
+}
+
+void test_bundle__write_errors(void)
+{
+	libgtr_msgcat_file_t missing[] = {
+		{ "a", CLAR_RESOURCES "/basic.mo", 0 },
+		{ "b", CLAR_RESOURCES "/does-not-exist.mo", 0 },
+	};
+	cl_assert_equal_i(GTRENOENT,
+		libgtr_write_bundle(BUNDLE ".2", missing, 2));
+	cl_assert_equal_i(GTREOK, missing[0].result);
+	cl_assert_equal_i(GTRENOENT, missing[1].result);
+
+	libgtr_msgcat_file_t twice[] = {
+		{ "a", CLAR_RESOURCES "/basic.mo", 0 },
+		{ "a", CLAR_RESOURCES "/header.mo", 0 },
+	};
+	cl_assert_equal_i(GTREEXIST,
+		libgtr_write_bundle(BUNDLE ".2", twice, 2));
+
+	FILE *f = fopen(BUNDLE ".2", "rb");
+	cl_assert(f == NULL);
+}
+
+void test_bundle__broken_bundles(void)
+{
+	char buf[8192];
+	FILE *f = fopen(BUNDLE, "rb");
+	cl_assert(f != NULL);
+	size_t len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	cl_assert(len < sizeof(buf));
+
+	/* Cut short */
+	f = fopen(BUNDLE, "wb");
+	cl_assert(f != NULL);
+	cl_assert_equal_i(len - 1, fwrite(buf, 1, len - 1, f));
+	fclose(f);
+	cl_assert_equal_i(GTREINVAL, libgtr_load_bundle(gtr, BUNDLE));
+
+	/* A name outside of the bundle. The directory follows the 24 byte
+	header, and its entries start with the offset of the name. */
+	uint32_t name_offset = (uint32_t)len;
+	memcpy(buf + 24 + 24, &name_offset, sizeof(name_offset));
+	f = fopen(BUNDLE, "wb");
+	cl_assert(f != NULL);
+	cl_assert_equal_i(len, fwrite(buf, 1, len, f));
+	fclose(f);
+	cl_assert_equal_i(GTREINVAL, libgtr_load_bundle(gtr, BUNDLE));
+
+	cl_assert_equal_i(GTRENOENT, libgtr_load_bundle(gtr, "missing.gtrb"));
+	cl_assert(gtr->bundles == NULL);
+}
@@ -0,0 +1,128 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static libgtr_t *gtr;
+static uint32_t *catalog;
+static size_t catalog_size;
+
+static uint32_t swap(uint32_t v)
+{
+	return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) |
+		(v << 24);
+}
+
+/* Convert the catalog to the other byte order, like msgfmt on a host
+with the other byte order would have written it. */
+static void swap_catalog(void)
+{
+	uint32_t count = catalog[2];
+	uint32_t ost = catalog[3] / sizeof(uint32_t);
+	uint32_t tst = catalog[4] / sizeof(uint32_t);
+	uint32_t hash_size = catalog[5];
+	uint32_t hash = catalog[6] / sizeof(uint32_t);
+	cl_assert((size_t)hash + hash_size <= catalog_size / sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < 2 * count; ++i)
+	{
+		catalog[ost + i] = swap(catalog[ost + i]);
+		catalog[tst + i] = swap(catalog[tst + i]);
+	}
+	for (uint32_t i = 0; i < hash_size; ++i)
+		catalog[hash + i] = swap(catalog[hash + i]);
+	for (uint32_t i = 0; i < 7; ++i)
+		catalog[i] = swap(catalog[i]);
+}
+
+void test_byteorder__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+
+	FILE *f = fopen(CLAR_RESOURCES "/plurals-complex.mo", "rb");
+	cl_assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	catalog_size = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	cl_assert(NULL != (catalog = malloc(catalog_size)));
+	cl_assert_equal_i(catalog_size, fread(catalog, 1, catalog_size, f));
+	fclose(f);
+	swap_catalog();
+}
+
+void test_byteorder__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	free(catalog);
+	catalog = NULL;
+}
+
+static void check_translations(unsigned int flags)
+{
+	cl_must_pass(libgtr_set_flags(gtr, flags));
+	cl_must_pass(libgtr_load_msgcat_mem_ex(gtr, "domain", catalog_size,
+		catalog, GTRM_BORROW, NULL, NULL));
+	cl_assert(gtr->domains->swapped);
+
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	cl_assert_equal_s("test 2 translation 0",
+		libgtr_get_translation(gtr, "domain", "test 2", 2));
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "domain", "test 3", 1));
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "domain", "test 3", 3));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "domain", "test 3", 12));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "domain", "test 4", 1));
+	if (flags & GTRF_MO_HASH)
+		cl_assert(gtr->domains->hash_size != 0);
+	cl_must_pass(libgtr_unload_domain(gtr, "domain"));
+}
+
+void test_byteorder__swapped_catalogs(void)
+{
+	check_translations(0);
+	check_translations(GTRF_PERFECT_HASH);
+	check_translations(GTRF_LAZY_INDEX);
+}
+
+void test_byteorder__swapped_hash_table(void)
+{
+	cl_assert(swap(catalog[5]) != 0);
+	check_translations(GTRF_MO_HASH);
+}
+
+void test_byteorder__catalog_left_alone(void)
+{
+	/* Lookups never write to the catalog. */
+	uint32_t *copy = malloc(catalog_size);
+	cl_assert(copy != NULL);
+	memcpy(copy, catalog, catalog_size);
+	check_translations(0);
+	check_translations(GTRF_MO_HASH);
+	cl_assert_equal_i(0, memcmp(copy, catalog, catalog_size));
+	free(copy);
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+static libgtr_t *gtr;
+
+void test_chain__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_chain__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_chain__first_catalog_wins(void)
+{
+	const char *files[] = {
+		CLAR_RESOURCES "/plurals-2.mo",
+		CLAR_RESOURCES "/missing.mo",
+		CLAR_RESOURCES "/plurals-3.mo",
+	};
+	cl_must_pass(libgtr_load_msgcat_chain(gtr, "test", files, 3));
+
+	/* Every msgid has a single entry. */
+	libgtr_overlay_t *ov = gtr->domains->overlay;
+	cl_assert(ov->resolved);
+	cl_assert_equal_i(2, ov->layer_count);
+	cl_assert_equal_i(5, ov->used);
+
+	/* Each string uses the plural rule of the catalog it came from. */
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "test 5", 5));
+
+	const int ns[] = { 1, 2 };
+	const char *out[2];
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "test 3", ns, 2,
+		out));
+	cl_assert_equal_s("test 3 translation 0", out[0]);
+	cl_assert_equal_s("test 3 translation 1", out[1]);
+}
+
+void test_chain__order(void)
+{
+	const char *files[] = {
+		CLAR_RESOURCES "/plurals-3.mo",
+		CLAR_RESOURCES "/plurals-2.mo",
+	};
+	cl_must_pass(libgtr_load_msgcat_chain(gtr, "test", files, 2));
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+}
+
+void test_chain__no_catalogs(void)
+{
+	const char *files[] = { CLAR_RESOURCES "/missing.mo" };
+	cl_assert_equal_i(GTRENOENT,
+		libgtr_load_msgcat_chain(gtr, "test", files, 1));
+	cl_assert_equal_i(GTRENOENT,
+		libgtr_load_msgcat_chain(gtr, "test", files, 0));
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+}
+
+void test_chain__existing_domain(void)
+{
+	const char *files[] = { CLAR_RESOURCES "/basic.mo" };
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+		CLAR_RESOURCES "/plurals-2.mo"));
+	cl_assert_equal_i(GTREEXIST,
+		libgtr_load_msgcat_chain(gtr, "test", files, 1));
+}
+
+void test_chain__no_layers(void)
+{
+	const char *files[] = { CLAR_RESOURCES "/basic.mo" };
+	cl_must_pass(libgtr_load_msgcat_chain(gtr, "test", files, 1));
+	cl_assert_equal_i(GTREEXIST, libgtr_attach_msgcat_file(gtr, "test",
+		"update", CLAR_RESOURCES "/plurals-2.mo"));
+	cl_assert_equal_i(GTRENOENT, libgtr_detach_msgcat(gtr, "test",
+		files[0]));
+	cl_assert_equal_i(GTREEXIST, libgtr_reload_domain(gtr, "test",
+		CLAR_RESOURCES "/plurals-2.mo"));
+	cl_assert(gtr->domains->overlay != NULL);
+	cl_must_pass(libgtr_unload_domain(gtr, "test"));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+}
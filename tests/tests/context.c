@@ -0,0 +1,94 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+static libgtr_t *gtr;
+
+static void load(unsigned int flags)
+{
+	cl_must_pass(libgtr_set_flags(gtr, flags));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+		CLAR_RESOURCES "/context.mo"));
+}
+
+static void check_translations(void)
+{
+	cl_assert_equal_s("open translation",
+		libgtr_get_translation(gtr, "test", "open", 1));
+	cl_assert_equal_s("open translation",
+		libgtr_get_translation_ctx(gtr, "test", NULL, "open", 1));
+	cl_assert_equal_s("open menu translation",
+		libgtr_get_translation_ctx(gtr, "test", "menu", "open", 1));
+	cl_assert_equal_s("open door translation",
+		libgtr_get_translation_ctx(gtr, "test", "door", "open", 1));
+	cl_assert_equal_s("file menu translation 1",
+		libgtr_get_translation_ctx(gtr, "test", "menu", "file", 2));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_ctx(gtr, "test", "window", "open", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_ctx(gtr, "test", "", "open", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "file", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_ctx(gtr, "test", "men", "u\004open", 1));
+
+	libgtr_key_t key;
+	libgtr_key_init_ctx(&key, "door", "open");
+	cl_assert_equal_s("open door translation",
+		libgtr_get_translation_key(gtr, "test", &key, 1));
+	cl_assert_equal_s("open door translation",
+		libgtr_get_translation_key(gtr, "test", &key, 1));
+}
+
+void test_context__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_context__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_context__descriptors(void)
+{
+	load(0);
+	check_translations();
+}
+
+void test_context__perfect_hash(void)
+{
+	load(GTRF_PERFECT_HASH);
+	check_translations();
+}
+
+void test_context__mo_hash(void)
+{
+	load(GTRF_MO_HASH);
+	check_translations();
+}
+
+void test_context__layers(void)
+{
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "base",
+		CLAR_RESOURCES "/context.mo"));
+	check_translations();
+}
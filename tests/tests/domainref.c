@@ -0,0 +1,151 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+
+static libgtr_t *gtr;
+
+void test_domainref__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_domainref__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_domainref__same_handle(void)
+{
+	libgtr_domain_ref_t *ref = libgtr_domain_ref(gtr, "basic");
+	cl_assert(ref != NULL);
+	cl_assert_equal_p(ref, libgtr_domain_ref(gtr, "basic"));
+	cl_assert(ref != libgtr_domain_ref(gtr, "header"));
+}
+
+void test_domainref__follows_reload(void)
+{
+	libgtr_domain_ref_t *ref = libgtr_domain_ref(gtr, "domain");
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_ref(gtr, ref, "test 1", 1));
+
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation_ref(gtr, ref, "test 1", 1));
+
+	cl_must_pass(libgtr_unload_domain(gtr, "domain"));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_ref(gtr, ref, "test 1", 1));
+
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation_ref(gtr, ref, "test 3", 12));
+}
+
+void test_domainref__with_key(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	libgtr_domain_ref_t *ref = libgtr_domain_ref(gtr, "domain");
+	libgtr_key_t key;
+	libgtr_key_init(&key, "test 3");
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation_ref_key(gtr, ref, &key, 2));
+}
+
+static int loader(libgtr_t *gtr, const char *domain, void *opaque)
+{
+	++*(int*)opaque;
+	return libgtr_load_msgcat_file(gtr, domain, CLAR_RESOURCES "/basic.mo");
+}
+
+void test_domainref__on_demand_loading(void)
+{
+	int calls = 0;
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, loader, &calls));
+
+	libgtr_domain_ref_t *ref = libgtr_domain_ref(gtr, "domain");
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation_ref(gtr, ref, "test 1", 1));
+	cl_assert_equal_s("test 2 translation",
+		libgtr_get_translation_ref(gtr, ref, "test 2", 1));
+	cl_assert_equal_i(1, calls);
+}
+
+static int failing_loader(libgtr_t *gtr, const char *domain, void *opaque)
+{
+	(void)gtr;
+	(void)domain;
+	++*(int*)opaque;
+	return GTRENOENT;
+}
+
+void test_domainref__missing_domain(void)
+{
+	int calls = 0;
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, failing_loader, &calls));
+
+	for (int i = 0; i < 3; i++)
+	{
+		cl_assert_equal_p(NULL,
+			libgtr_get_translation(gtr, "missing", "test 1", 1));
+	}
+	/* The failure is remembered, without a handle for the name. */
+	cl_assert_equal_i(1, calls);
+	cl_assert(gtr->refs == NULL || gtr->refs->count == 0);
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+
+	/* Unloading the domain gives the loader another chance. */
+	cl_must_pass(libgtr_unload_domain(gtr, "missing"));
+	cl_assert_equal_p(NULL,
+		libgtr_get_translation(gtr, "missing", "test 1", 1));
+	cl_assert_equal_i(2, calls);
+
+	/* And so does setting a loader. */
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, loader, &calls));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "missing", "test 1", 1));
+	cl_assert_equal_i(3, calls);
+}
+
+void test_domainref__many_missing_domains(void)
+{
+	int calls = 0;
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, failing_loader, &calls));
+
+	char name[24];
+	for (int i = 0; i < 1000; i++)
+	{
+		snprintf(name, sizeof(name), "missing %d", i);
+		cl_assert_equal_p(NULL,
+			libgtr_get_translation(gtr, name, "test 1", 1));
+	}
+	cl_assert_equal_i(1000, calls);
+	cl_assert(gtr->refs == NULL || gtr->refs->count == 0);
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+}
@@ -0,0 +1,196 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+
+static libgtr_t *gtr;
+
+void test_filter__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_filter__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+static void load(unsigned int flags)
+{
+	cl_must_pass(libgtr_set_flags(gtr, flags));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+		CLAR_RESOURCES "/plurals-3.mo"));
+}
+
+/* Look up every string of plurals-3.mo, then count missing ones. */
+static void lookup(unsigned int misses)
+{
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+	cl_assert_equal_s("test 2 translation 0",
+		libgtr_get_translation(gtr, "test", "test 2", 1));
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "test", "test 3", 1));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 1));
+	char msgid[32];
+	for (unsigned int i = 0; i < misses; ++i)
+	{
+		snprintf(msgid, sizeof(msgid), "missing %u", i);
+		cl_assert_equal_s(NULL,
+			libgtr_get_translation(gtr, "test", msgid, 1));
+	}
+}
+
+void test_filter__rejects_misses(void)
+{
+	load(GTRF_MISS_FILTER | GTRF_LOOKUP_STATS);
+	cl_assert(gtr->domains->filter != NULL);
+	lookup(1000);
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(4, stats.hits);
+	cl_assert_equal_i(1000, stats.misses);
+	cl_assert(stats.filtered >= 990);
+	cl_assert(stats.filtered <= stats.misses);
+}
+
+void test_filter__lazy_index(void)
+{
+	load(GTRF_MISS_FILTER | GTRF_LOOKUP_STATS | GTRF_LAZY_INDEX);
+	cl_assert(gtr->domains->filter == NULL);
+	lookup(100);
+	cl_assert(gtr->domains->filter != NULL);
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(4, stats.hits);
+	cl_assert_equal_i(100, stats.misses);
+}
+
+void test_filter__batch(void)
+{
+	load(GTRF_MISS_FILTER | GTRF_LOOKUP_STATS);
+	const char *msgids[] = { "test 1", "missing", "test 4", NULL };
+	const char *out[4];
+	cl_must_pass(libgtr_get_translations(gtr, "test", msgids, NULL, 4,
+		out));
+	cl_assert_equal_s("test 1 translation", out[0]);
+	cl_assert_equal_s(NULL, out[1]);
+	cl_assert_equal_s("test 4 translation 0", out[2]);
+
+	const int ns[] = { 1, 2 };
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "test 4", ns, 2,
+		out));
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "missing", ns, 2,
+		out));
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(3, stats.hits);
+	cl_assert_equal_i(2, stats.misses);
+}
+
+void test_filter__stats_without_filter(void)
+{
+	load(GTRF_LOOKUP_STATS);
+	cl_assert(gtr->domains->filter == NULL);
+	lookup(10);
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(4, stats.hits);
+	cl_assert_equal_i(10, stats.misses);
+	cl_assert_equal_i(0, stats.filtered);
+}
+
+void test_filter__stats_with_other_indexes(void)
+{
+	load(GTRF_LOOKUP_STATS | GTRF_MISS_FILTER | GTRF_PERFECT_HASH);
+	cl_assert(gtr->domains->filter == NULL);
+	lookup(10);
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(4, stats.hits);
+	cl_assert_equal_i(10, stats.misses);
+	cl_assert_equal_i(0, stats.filtered);
+}
+
+void test_filter__no_stats(void)
+{
+	libgtr_domain_stats_t stats;
+	cl_assert_equal_i(GTRENOENT,
+		libgtr_get_domain_stats(gtr, "test", &stats));
+	load(GTRF_MISS_FILTER);
+	lookup(10);
+	cl_assert_equal_i(GTRENOTSUPP,
+		libgtr_get_domain_stats(gtr, "test", &stats));
+}
+
+void test_filter__stats_for_overlays(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LOOKUP_STATS));
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "base",
+		CLAR_RESOURCES "/plurals-3.mo"));
+	lookup(10);
+
+	/* New versions of the domain keep counting. */
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "update",
+		CLAR_RESOURCES "/basic.mo"));
+	const int ns[] = { 1, 2 };
+	const char *out[2];
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "test 3", ns, 2,
+		out));
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "missing", ns, 2,
+		out));
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "update"));
+	lookup(1);
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(9, stats.hits);
+	cl_assert_equal_i(12, stats.misses);
+	cl_assert_equal_i(0, stats.filtered);
+}
+
+void test_filter__stats_for_chains(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LOOKUP_STATS));
+	const char *files[] = {
+		CLAR_RESOURCES "/basic.mo", CLAR_RESOURCES "/plurals-3.mo"
+	};
+	cl_must_pass(libgtr_load_msgcat_chain(gtr, "test", files, 2));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "missing", 1));
+
+	libgtr_domain_stats_t stats;
+	cl_must_pass(libgtr_get_domain_stats(gtr, "test", &stats));
+	cl_assert_equal_i(2, stats.hits);
+	cl_assert_equal_i(1, stats.misses);
+}
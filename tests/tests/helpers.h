@@ -0,0 +1,47 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* Helpers for tests that set up catalog and index files on disk */
+
+#ifndef _LIBGTR_TEST_HELPERS_H
+#define _LIBGTR_TEST_HELPERS_H
+
+#include "clar.h"
+
+#include <stdio.h>
+
+/* Read a whole file into buf, which must be larger than the file. */
+static size_t read_file(const char *file, char *buf, size_t size)
+{
+	FILE *f = fopen(file, "rb");
+	cl_assert(f != NULL);
+	size_t len = fread(buf, 1, size, f);
+	fclose(f);
+	cl_assert(len < size);
+	return len;
+}
+
+/* Replace the contents of a file. */
+static void write_file(const char *file, const char *buf, size_t size)
+{
+	FILE *f = fopen(file, "wb");
+	cl_assert(f != NULL);
+	cl_assert_equal_i(size, fwrite(buf, 1, size, f));
+	fclose(f);
+}
+
+#endif
@@ -0,0 +1,156 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CATALOG "indexfile.mo"
+#define INDEX "indexfile.mo.gtri"
+
+static libgtr_t *gtr;
+
+void test_indexfile__initialize(void)
+{
+	char buf[4096];
+	size_t len = read_file(CLAR_RESOURCES "/plurals-complex.mo",
+		buf, sizeof(buf));
+	write_file(CATALOG, buf, len);
+	remove(INDEX);
+
+	cl_assert(NULL != (gtr = libgtr_new()));
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_INDEX_FILE));
+}
+
+void test_indexfile__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	remove(CATALOG);
+	remove(INDEX);
+}
+
+/* Load the catalog into a fresh instance, and return whether its index
+came from the index file. */
+static bool reload(void)
+{
+	libgtr_destroy(gtr);
+	cl_assert(NULL != (gtr = libgtr_new()));
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_INDEX_FILE));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "domain", CATALOG));
+
+	libgtr_domain_t *dom = gtr->domains;
+	cl_assert(dom->mph != NULL);
+	cl_assert_equal_i(GTR_INDEX_READY, dom->index_state);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "domain", "test 3", 12));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "domain", "test 4", 1));
+	return dom->index_map != NULL;
+}
+
+void test_indexfile__written_and_used(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "domain", CATALOG));
+	cl_assert(gtr->domains->index_map == NULL);
+	FILE *f = fopen(INDEX, "rb");
+	cl_assert(f != NULL);
+	fclose(f);
+
+	cl_assert(reload());
+	cl_assert(reload());
+}
+
+void test_indexfile__corrupt_index_replaced(void)
+{
+	cl_assert(!reload());
+	cl_assert(reload());
+
+	/* Damage one of the slots. */
+	char buf[4096];
+	size_t len = read_file(INDEX, buf, sizeof(buf));
+	buf[len - 2] ^= 0x40;
+	write_file(INDEX, buf, len);
+	cl_assert(!reload());
+	cl_assert(reload());
+
+	/* Cut it short. */
+	write_file(INDEX, buf, len / 2);
+	cl_assert(!reload());
+	cl_assert(reload());
+
+	/* Not an index file at all */
+	write_file(INDEX, "garbage", 7);
+	cl_assert(!reload());
+	cl_assert(reload());
+}
+
+void test_indexfile__changed_catalog(void)
+{
+	cl_assert(!reload());
+	cl_assert(reload());
+
+	/* Change a translation without changing the size of the catalog. */
+	char buf[4096];
+	size_t len = read_file(CATALOG, buf, sizeof(buf));
+	char *str = NULL;
+	for (size_t i = 0; i + 18 <= len && !str; ++i)
+	{
+		if (memcmp(buf + i, "test 1 translation", 18) == 0)
+			str = buf + i;
+	}
+	cl_assert(str != NULL);
+	str[0] = 'T';
+	write_file(CATALOG, buf, len);
+
+	cl_must_pass(libgtr_unload_domain(gtr, "domain"));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "domain", CATALOG));
+	cl_assert(gtr->domains->index_map == NULL);
+	cl_assert_equal_s("Test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+}
+
+void test_indexfile__copied_catalog(void)
+{
+	cl_assert(!reload());
+
+	/* Writing the same catalog again only changes its modification
+	time, which doesn't call for a new index. */
+	char buf[4096];
+	size_t len = read_file(CATALOG, buf, sizeof(buf));
+	write_file(CATALOG, buf, len);
+	cl_assert(reload());
+	cl_assert(reload());
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+}
+
+void test_indexfile__not_for_memory_catalogs(void)
+{
+	char buf[4096];
+	size_t len = read_file(CATALOG, buf, sizeof(buf));
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "domain", len, buf));
+	FILE *f = fopen(INDEX, "rb");
+	cl_assert(f == NULL);
+}
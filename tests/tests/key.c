@@ -0,0 +1,82 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+static libgtr_t *gtr;
+
+void test_key__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_key__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+static void check_keys(void)
+{
+	static libgtr_key_t test3 = LIBGTR_KEY("test 3");
+	libgtr_key_t test1, missing;
+	libgtr_key_init(&test1, "test 1");
+	libgtr_key_init(&missing, "test 4");
+
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation_key(gtr, "plurals-complex", &test1, 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_key(gtr, "plurals-complex", &missing, 1));
+
+	/* Run the statically initialized key twice, so the second lookup
+	uses the hash values stored by the first. */
+	for (int i = 0; i < 2; ++i)
+	{
+		cl_assert_equal_s("test 3 translation 1",
+			libgtr_get_translation_key(gtr, "plurals-complex", &test3, 22));
+		cl_assert_equal_s("test 3 translation 2",
+			libgtr_get_translation_key(gtr, "plurals-complex", &test3, 12));
+	}
+}
+
+void test_key__translate(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_keys();
+}
+
+void test_key__translate_mo_hash(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_MO_HASH));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_keys();
+}
+
+void test_key__translate_perfect_hash(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_PERFECT_HASH));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	check_keys();
+}
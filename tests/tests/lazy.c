@@ -0,0 +1,110 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static libgtr_t *gtr;
+
+void test_lazy__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_lazy__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+static void check_lazy(unsigned int flags)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LAZY_INDEX | flags));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+
+	/* Loading only parsed the header. */
+	libgtr_domain_t *dom = gtr->domains;
+	cl_assert_equal_i(3, dom->plurals);
+	cl_assert_equal_i(GTR_INDEX_PENDING, dom->index_state);
+	cl_assert(dom->strings == NULL);
+	cl_assert(dom->mph == NULL);
+
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "plurals-complex", "test 3", 12));
+	cl_assert_equal_i(GTR_INDEX_READY, dom->index_state);
+	cl_assert(dom->strings != NULL || dom->mph != NULL);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "plurals-complex", "test 1", 1));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "plurals-complex", "test 4", 1));
+}
+
+void test_lazy__uthash(void)
+{
+	check_lazy(0);
+	cl_assert(gtr->domains->strings != NULL);
+}
+
+void test_lazy__perfect_hash(void)
+{
+	check_lazy(GTRF_PERFECT_HASH);
+	cl_assert(gtr->domains->mph != NULL);
+}
+
+void test_lazy__mo_hash_needs_no_index(void)
+{
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LAZY_INDEX | GTRF_MO_HASH));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"plurals-complex", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	cl_assert_equal_i(GTR_INDEX_READY, gtr->domains->index_state);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "plurals-complex", "test 1", 1));
+}
+
+void test_lazy__broken_string_table(void)
+{
+	FILE *f = fopen(CLAR_RESOURCES "/plurals-complex.mo", "rb");
+	cl_assert(f != NULL);
+	uint32_t data[256];
+	size_t size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	cl_assert(size > 28 && size < sizeof(data));
+
+	/* Give the second string the msgid of the first one. Duplicate
+	msgids are only found while building the index. */
+	uint32_t *ost = data + data[3] / sizeof(uint32_t);
+	ost[4] = ost[2];
+	ost[5] = ost[3];
+	cl_assert_equal_i(GTREINVAL,
+		libgtr_load_msgcat_mem(gtr, "eager", size, data));
+
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LAZY_INDEX));
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "lazy", size, data));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "lazy", "test 1", 1));
+	cl_assert_equal_i(GTR_INDEX_FAILED, gtr->domains->index_state);
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "lazy", "test 1", 1));
+}
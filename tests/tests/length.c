@@ -0,0 +1,129 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+#include <string.h>
+
+static libgtr_t *gtr;
+
+void test_length__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_length__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+static void check_length(const char *msgid, int n)
+{
+	size_t len = 12345;
+	const char *translation =
+		libgtr_get_translation_len(gtr, "test", msgid, n, &len);
+	cl_assert_equal_s(libgtr_get_translation(gtr, "test", msgid, n),
+		translation);
+	cl_assert_equal_i(translation ? strlen(translation) : 0, len);
+}
+
+static void check_lengths(unsigned int flags)
+{
+	cl_must_pass(libgtr_set_flags(gtr, flags));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+		CLAR_RESOURCES "/plurals-3.mo"));
+
+	check_length("test 1", 1);
+	check_length("test 3", 1);
+	check_length("test 4", 2);
+	check_length("test 5", 1);
+
+	libgtr_key_t key;
+	libgtr_key_init(&key, "test 4");
+	size_t len;
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation_key_len(gtr, "test", &key, 1, &len));
+	cl_assert_equal_i(strlen("test 4 translation 0"), len);
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation_key_len(gtr, "none", &key, 1, &len));
+	cl_assert_equal_i(0, len);
+}
+
+void test_length__descriptors(void)
+{
+	check_lengths(0);
+}
+
+void test_length__perfect_hash(void)
+{
+	check_lengths(GTRF_PERFECT_HASH);
+}
+
+void test_length__mo_hash(void)
+{
+	check_lengths(GTRF_MO_HASH);
+}
+
+static const unsigned int index_flags[] = {
+	0, GTRF_PERFECT_HASH, GTRF_MO_HASH
+};
+
+void test_length__plural_rule(void)
+{
+	for (size_t i = 0; i < sizeof(index_flags) / sizeof(*index_flags); ++i)
+	{
+		cl_must_pass(libgtr_set_flags(gtr, index_flags[i]));
+		cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+			CLAR_RESOURCES "/plurals-complex.mo"));
+		for (int n = 0; n < 30; ++n)
+		{
+			check_length("test 1", n);
+			check_length("test 2", n);
+			check_length("test 3", n);
+		}
+		cl_must_pass(libgtr_unload_domain(gtr, "test"));
+	}
+}
+
+void test_length__missing_forms(void)
+{
+	/* Missing forms fall back to the first one. */
+	for (size_t i = 0; i < sizeof(index_flags) / sizeof(*index_flags); ++i)
+	{
+		cl_must_pass(libgtr_set_flags(gtr, index_flags[i]));
+		cl_must_pass(libgtr_load_msgcat_file(gtr, "test",
+			CLAR_RESOURCES "/plurals-2.mo"));
+		check_length("test 2", 1);
+		check_length("test 2", 2);
+		check_length("test 3", 2);
+		cl_must_pass(libgtr_unload_domain(gtr, "test"));
+	}
+}
+
+void test_length__layers(void)
+{
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "base",
+		CLAR_RESOURCES "/plurals-complex.mo"));
+	for (int n = 0; n < 30; ++n)
+	{
+		check_length("test 1", n);
+		check_length("test 3", n);
+	}
+}
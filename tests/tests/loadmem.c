@@ -0,0 +1,135 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static libgtr_t *gtr;
+static void *catalog;
+static size_t catalog_size;
+
+void test_loadmem__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+
+	FILE *f = fopen(CLAR_RESOURCES "/plurals-complex.mo", "rb");
+	cl_assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	catalog_size = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	cl_assert(NULL != (catalog = malloc(catalog_size)));
+	cl_assert_equal_i(catalog_size, fread(catalog, 1, catalog_size, f));
+	fclose(f);
+}
+
+void test_loadmem__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	free(catalog);
+	catalog = NULL;
+}
+
+static void check_translations(const char *domain)
+{
+	cl_assert_equal_i(1, HASH_COUNT(gtr->domains));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, domain, "test 1", 1));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, domain, "test 3", 12));
+}
+
+void test_loadmem__copy(void)
+{
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "copy", catalog_size,
+		catalog));
+	/* The domain has its own copy. */
+	memset(catalog, 0, catalog_size);
+	check_translations("copy");
+}
+
+void test_loadmem__borrow(void)
+{
+	cl_must_pass(libgtr_load_msgcat_mem_ex(gtr, "borrow", catalog_size,
+		catalog, GTRM_BORROW, NULL, NULL));
+	check_translations("borrow");
+
+	/* Translations point into the buffer. */
+	const char *str = libgtr_get_translation(gtr, "borrow", "test 1", 1);
+	cl_assert(str >= (const char*)catalog &&
+		str < (const char*)catalog + catalog_size);
+
+	cl_must_pass(libgtr_unload_domain(gtr, "borrow"));
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+}
+
+static int free_calls;
+
+static void free_catalog(void *data, size_t size, void *opaque)
+{
+	cl_assert(data == catalog);
+	cl_assert_equal_i(catalog_size, size);
+	cl_assert(opaque == &free_calls);
+	++free_calls;
+}
+
+void test_loadmem__take(void)
+{
+	free_calls = 0;
+	cl_must_pass(libgtr_load_msgcat_mem_ex(gtr, "take", catalog_size,
+		catalog, GTRM_TAKE, free_catalog, &free_calls));
+	check_translations("take");
+	cl_assert_equal_i(0, free_calls);
+
+	/* A failed load leaves the buffer alone. */
+	cl_assert_equal_i(GTREEXIST, libgtr_load_msgcat_mem_ex(gtr, "take",
+		catalog_size, catalog, GTRM_TAKE, free_catalog, &free_calls));
+	cl_assert_equal_i(0, free_calls);
+
+	cl_must_pass(libgtr_unload_domain(gtr, "take"));
+	cl_assert_equal_i(1, free_calls);
+
+	/* So does destroying the instance. */
+	cl_must_pass(libgtr_load_msgcat_mem_ex(gtr, "take", catalog_size,
+		catalog, GTRM_TAKE, free_catalog, &free_calls));
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	cl_assert_equal_i(2, free_calls);
+}
+
+void test_loadmem__invalid(void)
+{
+	free_calls = 0;
+	/* broken catalog */
+	cl_must_fail(libgtr_load_msgcat_mem_ex(gtr, "bad", 16,
+		catalog, GTRM_TAKE, free_catalog, &free_calls));
+	/* unaligned buffer */
+	cl_must_fail(libgtr_load_msgcat_mem_ex(gtr, "bad", catalog_size - 1,
+		(char*)catalog + 1, GTRM_BORROW, NULL, NULL));
+	/* taking ownership without a way to free */
+	cl_must_fail(libgtr_load_msgcat_mem_ex(gtr, "bad", catalog_size,
+		catalog, GTRM_TAKE, NULL, NULL));
+	cl_must_fail(libgtr_load_msgcat_mem_ex(gtr, "bad", catalog_size,
+		catalog, 42, NULL, NULL));
+	cl_assert_equal_i(0, free_calls);
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+}
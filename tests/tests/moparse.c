@@ -20,6 +20,8 @@
 #include "gtr.h"
 #include "../src/gtrP.h"
 
+#include <string.h>
+
 static libgtr_t *gtr;
 
 void test_moparse__initialize(void)
@@ -75,3 +77,81 @@ void test_moparse__load_file_with_3_plurals(void)
 	cl_assert_equal_i(1, HASH_COUNT(gtr->domains));
 	cl_assert_equal_i(3, gtr->domains->plurals);
 }
+
+void test_moparse__load_existing_domain(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"moparse", CLAR_RESOURCES "/basic.mo")
+		);
+	cl_assert_equal_i(GTREEXIST, libgtr_load_msgcat_file(gtr,
+		"moparse", CLAR_RESOURCES "/header.mo")
+		);
+	cl_assert_equal_i(1, HASH_COUNT(gtr->domains));
+}
+
+void test_moparse__plural_rules_are_shared(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"one", CLAR_RESOURCES "/plurals-1.mo"));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"three", CLAR_RESOURCES "/plurals-3.mo"));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"two", CLAR_RESOURCES "/plurals-2.mo"));
+	cl_assert_equal_i(3, HASH_COUNT(gtr->domains));
+
+	/* plurals-1 and plurals-3 both use plural=0. */
+	cl_assert_equal_i(2, HASH_COUNT(gtr->plural_rules.rules));
+	libgtr_domain_t *one, *three;
+	HASH_FIND_STR(gtr->domains, "one", one);
+	HASH_FIND_STR(gtr->domains, "three", three);
+	cl_assert(one != NULL && three != NULL);
+	cl_assert(one->plural_rule == three->plural_rule);
+	cl_assert_equal_i(2, one->plural_rule->refs);
+
+	/* The rule goes away with the last domain using it. */
+	cl_must_pass(libgtr_unload_domain(gtr, "one"));
+	cl_assert_equal_i(2, HASH_COUNT(gtr->plural_rules.rules));
+	cl_must_pass(libgtr_unload_domain(gtr, "three"));
+	cl_assert_equal_i(1, HASH_COUNT(gtr->plural_rules.rules));
+	cl_must_pass(libgtr_unload_domain(gtr, "two"));
+	cl_assert(gtr->plural_rules.rules == NULL);
+}
+
+/* Write a catalog that only has a header into buf, and return its size.
+*/
+static size_t header_catalog(const char *header, char *buf, size_t size)
+{
+	size_t len = strlen(header);
+	uint32_t words[11] = {
+		0x950412de, 0, 1, 28, 36, 0, 44,
+		0, 44, (uint32_t)len, 45
+	};
+	cl_assert(45 + len + 1 <= size);
+	memcpy(buf, words, sizeof(words));
+	buf[44] = '\0';
+	memcpy(buf + 45, header, len + 1);
+	return 45 + len + 1;
+}
+
+void test_moparse__broken_plural_rules_are_not_shared(void)
+{
+	char buf[256];
+	size_t len = header_catalog("Plural-Forms: nplurals=3; "
+		"plural=n > = 2 ? 2 : n;\n", buf, sizeof(buf));
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "broken", len, buf));
+	len = header_catalog("Plural-Forms: nplurals=3; "
+		"plural=n >= 2 ? 2 : n;\n", buf, sizeof(buf));
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "valid", len, buf));
+
+	libgtr_domain_t *broken, *valid;
+	HASH_FIND_STR(gtr->domains, "broken", broken);
+	HASH_FIND_STR(gtr->domains, "valid", valid);
+	cl_assert(broken != NULL && valid != NULL);
+	cl_assert(broken->plural_rule != valid->plural_rule);
+	cl_assert(broken->plural_rule->expr == NULL);
+	cl_assert_equal_i(2, broken->plurals);
+	cl_assert(valid->plural_rule->expr != NULL);
+	cl_assert_equal_i(3, valid->plurals);
+	cl_assert_equal_i(2, libgtr_plural_rule_eval(valid->plural_rule, 5));
+	cl_assert_equal_i(1, HASH_COUNT(gtr->plural_rules.rules));
+}
@@ -0,0 +1,192 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <stdio.h>
+
+static libgtr_t *gtr;
+
+void test_overlay__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "base",
+		CLAR_RESOURCES "/plurals-3.mo"));
+}
+
+void test_overlay__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_overlay__later_layers_win(void)
+{
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "update",
+		CLAR_RESOURCES "/plurals-2.mo"));
+
+	/* Each string uses the plural rule of the catalog it came from. */
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "test 5", 5));
+
+	const int ns[] = { 1, 2 };
+	const char *out[2];
+	cl_must_pass(libgtr_get_translations_n(gtr, "test", "test 3", ns, 2,
+		out));
+	cl_assert_equal_s("test 3 translation 0", out[0]);
+	cl_assert_equal_s("test 3 translation 1", out[1]);
+
+	const char *msgids[] = { "test 1", "test 3", "test 4" };
+	const int counts[] = { 1, 2, 2 };
+	const char *batch[3];
+	cl_must_pass(libgtr_get_translations(gtr, "test", msgids, counts, 3,
+		batch));
+	cl_assert_equal_s("test 1 translation", batch[0]);
+	cl_assert_equal_s("test 3 translation 1", batch[1]);
+	cl_assert_equal_s("test 4 translation 0", batch[2]);
+}
+
+void test_overlay__detach(void)
+{
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "middle",
+		CLAR_RESOURCES "/plurals-complex.mo"));
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "top",
+		CLAR_RESOURCES "/basic.mo"));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "middle"));
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+	cl_assert_equal_i(GTRENOENT, libgtr_detach_msgcat(gtr, "test", "middle"));
+
+	/* The name is free again. */
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "middle",
+		CLAR_RESOURCES "/plurals-2.mo"));
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "top"));
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "middle"));
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+}
+
+void test_overlay__one_entry_per_msgid(void)
+{
+	/* plurals-3 has the header and four strings, which include all of
+	the other catalogs'. */
+	cl_assert_equal_i(5, gtr->domains->overlay->used);
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "update",
+		CLAR_RESOURCES "/plurals-2.mo"));
+	cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", "top",
+		CLAR_RESOURCES "/basic.mo"));
+	cl_assert_equal_i(5, gtr->domains->overlay->used);
+
+	/* Entries of a detached layer go to the next lower layer with the
+	same msgid. */
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "update"));
+	cl_assert_equal_i(5, gtr->domains->overlay->used);
+	cl_assert_equal_s("test 3 translation 0",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "base"));
+	cl_assert_equal_i(2, gtr->domains->overlay->used);
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_assert_equal_s("test 2 translation",
+		libgtr_get_translation(gtr, "test", "test 2", 1));
+}
+
+void test_overlay__no_reload(void)
+{
+	cl_assert_equal_i(GTREEXIST, libgtr_reload_domain(gtr, "test",
+		CLAR_RESOURCES "/basic.mo"));
+	cl_assert(gtr->domains->overlay != NULL);
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+}
+
+void test_overlay__detach_last_layer_unloads(void)
+{
+	cl_must_pass(libgtr_detach_msgcat(gtr, "test", "base"));
+	cl_assert_equal_i(0, HASH_COUNT(gtr->domains));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+	cl_assert_equal_i(GTRENOENT, libgtr_detach_msgcat(gtr, "test", "base"));
+}
+
+void test_overlay__many_layers(void)
+{
+	char name[24];
+	for (int i = 0; i < 40; ++i)
+	{
+		snprintf(name, sizeof(name), "layer %d", i);
+		cl_must_pass(libgtr_attach_msgcat_file(gtr, "test", name, i % 2 ?
+			CLAR_RESOURCES "/plurals-2.mo" : CLAR_RESOURCES "/basic.mo"));
+	}
+	/* Detaching most of them makes the index drop the holes. */
+	for (int i = 0; i < 39; ++i)
+	{
+		snprintf(name, sizeof(name), "layer %d", i);
+		cl_must_pass(libgtr_detach_msgcat(gtr, "test", name));
+	}
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation(gtr, "test", "test 3", 5));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "test", "test 1", 1));
+	cl_assert(gtr->domains->overlay->layer_count <= 4);
+}
+
+void test_overlay__duplicate_names(void)
+{
+	cl_assert_equal_i(GTREEXIST, libgtr_attach_msgcat_file(gtr, "test",
+		"base", CLAR_RESOURCES "/basic.mo"));
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+}
+
+void test_overlay__not_for_single_catalogs(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "single",
+		CLAR_RESOURCES "/basic.mo"));
+	cl_assert_equal_i(GTREEXIST, libgtr_attach_msgcat_file(gtr, "single",
+		"base", CLAR_RESOURCES "/plurals-2.mo"));
+	cl_assert_equal_i(GTRENOENT, libgtr_detach_msgcat(gtr, "single",
+		"base"));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "single", "test 1", 1));
+}
+
+void test_overlay__missing_file(void)
+{
+	cl_assert(libgtr_attach_msgcat_file(gtr, "test", "missing",
+		CLAR_RESOURCES "/missing.mo") != GTREOK);
+	cl_assert_equal_s("test 4 translation 0",
+		libgtr_get_translation(gtr, "test", "test 4", 5));
+}
@@ -0,0 +1,291 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+
+#include <limits.h>
+#include <string.h>
+
+/* Plural-Forms expressions of a few languages, plus some odd ones. */
+static const char *formulas[] = {
+	"0",
+	"n != 1",
+	"n > 1",
+	"(n==1 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || n%100>=20) ? 1 : 2)",
+	"(n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && "
+		"(n%100<10 || n%100>=20) ? 1 : 2)",
+	"(n==0 ? 0 : n==1 ? 1 : n==2 ? 2 : n%100>=3 && n%100<=10 ? 3 : "
+		"n%100>=11 ? 4 : 5)",
+	"(n%100==1 ? 0 : n%100==2 ? 1 : n%100==3 || n%100==4 ? 2 : 3)",
+	"!(n - 1) + 2 * (n / 7) - (3 < n)",
+	"(n == 1 || n == 2) ? (n * 2 - 1) : !n ? 17 : n % 3 + n / 1000",
+};
+
+void test_plurals__program_matches_tree(void)
+{
+	for (size_t f = 0; f < sizeof(formulas) / sizeof(formulas[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr = libgtr_plural_expr_parse(formulas[f]);
+		cl_assert(expr != NULL);
+		libgtr_plural_program_t *program =
+			libgtr_plural_program_compile(expr);
+		cl_assert(program != NULL);
+
+		for (int n = -50; n < 2000; ++n)
+		{
+			cl_assert_equal_i(libgtr_plural_expr_eval(expr, n),
+				libgtr_plural_program_eval(program, n));
+		}
+		cl_assert_equal_i(libgtr_plural_expr_eval(expr, 1000001),
+			libgtr_plural_program_eval(program, 1000001));
+
+		libgtr_plural_program_free(program);
+		libgtr_plural_expr_free(expr);
+	}
+}
+
+void test_plurals__division_by_zero(void)
+{
+	libgtr_plural_expr_t *expr = libgtr_plural_expr_parse("n / (n - 5)");
+	cl_assert(expr != NULL);
+	libgtr_plural_program_t *program = libgtr_plural_program_compile(expr);
+	cl_assert(program != NULL);
+	cl_assert_equal_i(2, libgtr_plural_program_eval(program, 10));
+	cl_assert_equal_i(0, libgtr_plural_program_eval(program, 5));
+	libgtr_plural_program_free(program);
+	libgtr_plural_expr_free(expr);
+}
+
+void test_plurals__deep_expression_not_compiled(void)
+{
+	/* n+(n+(n+(...))) needs one stack slot per level. */
+	char spec[256] = "";
+	for (int i = 0; i < GTR_PLURAL_MAX_STACK + 1; ++i)
+		strcat(spec, "n+(");
+	strcat(spec, "n");
+	for (int i = 0; i < GTR_PLURAL_MAX_STACK + 1; ++i)
+		strcat(spec, ")");
+
+	libgtr_plural_expr_t *expr = libgtr_plural_expr_parse(spec);
+	cl_assert(expr != NULL);
+	cl_assert(libgtr_plural_program_compile(expr) == NULL);
+	cl_assert_equal_i(GTR_PLURAL_MAX_STACK + 2,
+		libgtr_plural_expr_eval(expr, 1));
+	libgtr_plural_expr_free(expr);
+}
+
+/* Plural-Forms of the gettext manual, as found in catalog headers */
+static const char *well_known[] = {
+	"0",
+	"(n != 1)",
+	"(n > 1)",
+	"(n%10==1 && n%100!=11 ? 0 : n != 0 ? 1 : 2)",
+	"n==1 ? 0 : n==2 ? 1 : 2",
+	"(n==1 ? 0 : (n==0 || (n%100 > 0 && n%100 < 20)) ? 1 : 2)",
+	"(n%10==1 && n%100!=11 ? 0 : n%10>=2 && "
+		"(n%100<10 || n%100>=20) ? 1 : 2)",
+	"(n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && "
+		"(n%100<10 || n%100>=20) ? 1 : 2)",
+	"(n==1) ? 0 : (n>=2 && n<=4) ? 1 : 2",
+	"(n==1 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || n%100>=20) ? 1 : 2)",
+	"(n%100==1 ? 0 : n%100==2 ? 1 : n%100==3 || n%100==4 ? 2 : 3)",
+	"(n==0 ? 0 : n==1 ? 1 : n==2 ? 2 : n%100>=3 && n%100<=10 ? 3 : "
+		"n%100>=11 ? 4 : 5)",
+	"(n%10!=1 || n%100==11)",
+	"n==1 ? 0 : n==2 ? 1 : n<7 ? 2 : n<11 ? 3 : 4",
+	"(n==1 || n==11) ? 0 : (n==2 || n==12) ? 1 : (n > 2 && n < 20) ? 2 : 3",
+	"n==1 || n%10==1 ? 0 : 1",
+	"(n==1 ? 0 : n==0 || ( n%100>1 && n%100<11) ? 1 : "
+		"(n%100>10 && n%100<20 ) ? 2 : 3)",
+};
+
+void test_plurals__native_evaluators(void)
+{
+	for (size_t f = 0; f < sizeof(well_known) / sizeof(well_known[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr =
+			libgtr_plural_expr_parse(well_known[f]);
+		cl_assert(expr != NULL);
+		libgtr_plural_fn fn = libgtr_plural_native(expr);
+		cl_assert(fn != NULL);
+
+		for (int n = -250; n < 2500; ++n)
+			cl_assert_equal_i(libgtr_plural_expr_eval(expr, n), fn(n));
+
+		libgtr_plural_expr_free(expr);
+	}
+}
+
+void test_plurals__unknown_formula_not_native(void)
+{
+	libgtr_plural_expr_t *expr = libgtr_plural_expr_parse("n % 3");
+	cl_assert(expr != NULL);
+	cl_assert(libgtr_plural_native(expr) == NULL);
+	libgtr_plural_expr_free(expr);
+
+	/* The tree evaluator's default */
+	cl_assert(libgtr_plural_native(NULL) != NULL);
+	cl_assert_equal_i(1, libgtr_plural_native(NULL)(2));
+}
+
+void test_plurals__periodic_formulas(void)
+{
+	static const struct
+	{
+		const char *formula;
+		uint32_t threshold;
+		uint32_t period;
+	} periodic[] = {
+		{ "0", 0, 1 },
+		{ "n != 1", 2, 1 },
+		{ "n%10==1 && n%100!=11 ? 0 : 1", 0, 100 },
+		{ "(n==1 ? 0 : n%10>=2 && n%10<=4 && "
+			"(n%100<10 || n%100>=20) ? 1 : 2)", 2, 100 },
+		{ "n==1 ? 0 : n==2 ? 1 : n<7 ? 2 : n<11 ? 3 : 4", 12, 1 },
+		{ "n % 3 == 0 ? n % 4 : 5", 0, 12 },
+	};
+	for (size_t f = 0; f < sizeof(periodic) / sizeof(periodic[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr =
+			libgtr_plural_expr_parse(periodic[f].formula);
+		cl_assert(expr != NULL);
+		uint32_t threshold, period;
+		cl_assert(libgtr_plural_expr_periodic(expr, &threshold, &period));
+		cl_assert_equal_i(periodic[f].threshold, threshold);
+		cl_assert_equal_i(periodic[f].period, period);
+		libgtr_plural_expr_free(expr);
+	}
+
+	/* n itself, or anything but n % m, never repeats. Neither do
+	expressions with overly long periods, as far as tables go. */
+	static const char *aperiodic[] = {
+		"n", "n / 10 == 1", "n % (n - 5)", "n % 2000",
+		"n % 1009 + n % 1013",
+	};
+	for (size_t f = 0; f < sizeof(aperiodic) / sizeof(aperiodic[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr =
+			libgtr_plural_expr_parse(aperiodic[f]);
+		cl_assert(expr != NULL);
+		uint32_t threshold, period;
+		cl_assert(!libgtr_plural_expr_periodic(expr, &threshold, &period));
+		libgtr_plural_expr_free(expr);
+	}
+}
+
+void test_plurals__rule_matches_tree(void)
+{
+	for (size_t f = 0; f < sizeof(formulas) / sizeof(formulas[0]); ++f)
+	{
+		libgtr_plural_expr_t *expr = libgtr_plural_expr_parse(formulas[f]);
+		libgtr_plural_rule_t *rule =
+			libgtr_plural_rule_new(libgtr_plural_expr_parse(formulas[f]));
+		cl_assert(expr != NULL);
+		cl_assert(rule != NULL);
+		cl_assert(rule->table_size > 0);
+
+		for (int n = -50; n < 5000; ++n)
+		{
+			cl_assert_equal_i(libgtr_plural_expr_eval(expr, n),
+				libgtr_plural_rule_eval(rule, n));
+		}
+		for (int n = 1000000; n < 1000200; ++n)
+		{
+			cl_assert_equal_i(libgtr_plural_expr_eval(expr, n),
+				libgtr_plural_rule_eval(rule, n));
+		}
+		cl_assert_equal_i(libgtr_plural_expr_eval(expr, INT_MAX),
+			libgtr_plural_rule_eval(rule, INT_MAX));
+
+		libgtr_plural_rule_free(rule);
+		libgtr_plural_expr_free(expr);
+	}
+
+	/* English-style plurals without an expression */
+	libgtr_plural_rule_t *rule = libgtr_plural_rule_new(NULL);
+	cl_assert(rule != NULL);
+	cl_assert_equal_i(0, libgtr_plural_rule_eval(rule, 1));
+	cl_assert_equal_i(1, libgtr_plural_rule_eval(rule, 0));
+	cl_assert_equal_i(1, libgtr_plural_rule_eval(rule, 123456789));
+	libgtr_plural_rule_free(rule);
+}
+
+void test_plurals__no_table_without_safe_evaluator(void)
+{
+	/* Too deep to compile, and the tree evaluator would divide by zero
+	for n == 0. */
+	char spec[256] = "";
+	for (int i = 0; i < GTR_PLURAL_MAX_STACK + 1; ++i)
+		strcat(spec, "n+(");
+	strcat(spec, "1/n");
+	for (int i = 0; i < GTR_PLURAL_MAX_STACK + 1; ++i)
+		strcat(spec, ")");
+
+	libgtr_plural_rule_t *rule =
+		libgtr_plural_rule_new(libgtr_plural_expr_parse(spec));
+	cl_assert(rule != NULL);
+	cl_assert(rule->program == NULL);
+	cl_assert_equal_i(0, rule->table_size);
+	cl_assert_equal_i(GTR_PLURAL_MAX_STACK + 2,
+		libgtr_plural_rule_eval(rule, 1));
+	libgtr_plural_rule_free(rule);
+}
+
+void test_plurals__rules_shared_by_text(void)
+{
+	libgtr_t *gtr = libgtr_new();
+	cl_assert(gtr != NULL);
+	libgtr_plural_cache_t *cache = &gtr->plural_rules;
+
+	/* The expression ends where the header line does, and whitespace
+	doesn't matter. */
+	libgtr_plural_rule_t *a = libgtr_plural_rule_acquire(cache, "n != 1;");
+	libgtr_plural_rule_t *b =
+		libgtr_plural_rule_acquire(cache, "\tn!=1 \nPOT-Creation-Date:");
+	cl_assert(a != NULL && a == b);
+	cl_assert_equal_i(2, a->refs);
+	cl_assert_equal_s("n!=1", a->key);
+	cl_assert(a->expr != NULL);
+
+	/* Whitespace is kept where it separates tokens. */
+	libgtr_plural_rule_t *sep =
+		libgtr_plural_rule_acquire(cache, "n ! = 1;");
+	cl_assert(sep != NULL && sep != a);
+	libgtr_plural_rule_release(sep);
+
+	/* Expressions that don't parse get a rule without one, which isn't
+	shared. */
+	libgtr_plural_rule_t *bad = libgtr_plural_rule_acquire(cache, "n +;");
+	cl_assert(bad != NULL && bad != a);
+	cl_assert(bad->expr == NULL);
+	cl_assert(bad->cache == NULL);
+	cl_assert_equal_i(1, libgtr_plural_rule_eval(bad, 2));
+
+	libgtr_plural_rule_t *english = libgtr_plural_rule_acquire(cache, NULL);
+	cl_assert(english != NULL && english != a && english != bad);
+	cl_assert_equal_i(2, HASH_COUNT(cache->rules));
+
+	libgtr_plural_rule_release(english);
+	libgtr_plural_rule_release(bad);
+	libgtr_plural_rule_release(b);
+	libgtr_plural_rule_release(a);
+	cl_assert(cache->rules == NULL);
+	libgtr_destroy(gtr);
+}
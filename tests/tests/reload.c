@@ -0,0 +1,90 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+static libgtr_t *gtr;
+
+void test_reload__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+}
+
+void test_reload__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_reload__replaces_catalog(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+	libgtr_domain_ref_t *ref = libgtr_domain_ref(gtr, "domain");
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "domain", "test 3", 1));
+
+	cl_must_pass(libgtr_reload_domain(gtr,
+		"domain", CLAR_RESOURCES "/plurals-complex.mo")
+		);
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "domain", "test 3", 12));
+	cl_assert_equal_s("test 3 translation 1",
+		libgtr_get_translation_ref(gtr, ref, "test 3", 2));
+}
+
+void test_reload__creates_domain(void)
+{
+	cl_must_pass(libgtr_reload_domain(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+}
+
+void test_reload__failure_keeps_catalog(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+	cl_assert_equal_i(GTRENOENT, libgtr_reload_domain(gtr,
+		"domain", CLAR_RESOURCES "/nonexistent.mo")
+		);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+}
+
+void test_reload__read_section(void)
+{
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+	unsigned int outer = libgtr_read_begin(gtr);
+	unsigned int inner = libgtr_read_begin(gtr);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	libgtr_read_end(gtr, inner);
+	libgtr_read_end(gtr, outer);
+
+	/* Reloading must not wait for sections that have ended. */
+	cl_must_pass(libgtr_reload_domain(gtr,
+		"domain", CLAR_RESOURCES "/header.mo")
+		);
+}
@@ -0,0 +1,192 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+#include "../../src/gtrP.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define CATALOG "shmindex.mo"
+
+static libgtr_t *gtr;
+
+void test_shmindex__initialize(void)
+{
+	char buf[4096];
+	size_t len = read_file(CLAR_RESOURCES "/plurals-complex.mo",
+		buf, sizeof(buf));
+	write_file(CATALOG, buf, len);
+	libgtr_remove_shared_index(CATALOG);
+
+	cl_assert(NULL != (gtr = libgtr_new()));
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_SHARED_INDEX));
+}
+
+void test_shmindex__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+	libgtr_remove_shared_index(CATALOG);
+	remove(CATALOG);
+}
+
+/* Load the catalog into an instance, and check that its index is in
+shared memory. */
+static void load(libgtr_t *instance)
+{
+	cl_must_pass(libgtr_load_msgcat_file(instance, "domain", CATALOG));
+
+	libgtr_domain_t *dom = instance->domains;
+	cl_assert(dom->mph != NULL);
+	cl_assert(dom->index_map != NULL);
+	cl_assert_equal_i(GTR_INDEX_READY, dom->index_state);
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(instance, "domain", "test 1", 1));
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(instance, "domain", "test 3", 12));
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(instance, "domain", "test 4", 1));
+}
+
+void test_shmindex__published_and_attached(void)
+{
+	load(gtr);
+
+	/* A second instance maps the same index. */
+	libgtr_t *other = libgtr_new();
+	cl_assert(other != NULL);
+	cl_must_pass(libgtr_set_flags(other, GTRF_SHARED_INDEX));
+	load(other);
+	cl_assert(other->domains->index_map != gtr->domains->index_map);
+	cl_assert_equal_i(0, memcmp(other->domains->index_map,
+		gtr->domains->index_map, gtr->domains->index_map_size));
+	libgtr_destroy(other);
+
+	/* Removing the index doesn't affect instances that use it. */
+	cl_must_pass(libgtr_remove_shared_index(CATALOG));
+	cl_assert_equal_i(GTRENOENT, libgtr_remove_shared_index(CATALOG));
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+}
+
+void test_shmindex__changed_catalog(void)
+{
+	load(gtr);
+
+	/* Change a translation without changing the size of the catalog. */
+	char buf[4096];
+	size_t len = read_file(CATALOG, buf, sizeof(buf));
+	char *str = NULL;
+	for (size_t i = 0; i + 18 <= len && !str; ++i)
+	{
+		if (memcmp(buf + i, "test 1 translation", 18) == 0)
+			str = buf + i;
+	}
+	cl_assert(str != NULL);
+	str[0] = 'T';
+	write_file(CATALOG, buf, len);
+
+	/* The outdated index is replaced. */
+	cl_must_pass(libgtr_reload_domain(gtr, "domain", CATALOG));
+	cl_assert(gtr->domains->index_map != NULL);
+	cl_assert_equal_s("Test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	cl_must_pass(libgtr_remove_shared_index(CATALOG));
+}
+
+void test_shmindex__across_processes(void)
+{
+#if defined(__unix__)
+	libgtr_destroy(gtr);
+	gtr = NULL;
+
+	/* The index outlives the process that published it. */
+	pid_t pid = fork();
+	cl_assert(pid >= 0);
+	if (pid == 0)
+	{
+		libgtr_t *child = libgtr_new();
+		libgtr_set_flags(child, GTRF_SHARED_INDEX);
+		int ok = child &&
+			libgtr_load_msgcat_file(child, "domain", CATALOG) == GTREOK &&
+			child->domains->index_map != NULL;
+		_exit(ok ? 0 : 1);
+	}
+	int status;
+	cl_assert_equal_i(pid, waitpid(pid, &status, 0));
+	cl_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	cl_assert(NULL != (gtr = libgtr_new()));
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_SHARED_INDEX));
+	load(gtr);
+	cl_must_pass(libgtr_remove_shared_index(CATALOG));
+#endif
+}
+
+void test_shmindex__writable_by_others(void)
+{
+#if defined(__unix__)
+	/* Shared memory by the name of the index that others could have
+	written, and that never gets finished. */
+	char name[64];
+	char *path = realpath(CATALOG, NULL);
+	cl_assert(path != NULL);
+	snprintf(name, sizeof(name), "/libgtr-%lu-%016llx",
+		(unsigned long)geteuid(),
+		(unsigned long long)_gtr_hash(path, strlen(path)));
+	free(path);
+	int fh = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	cl_assert(fh >= 0);
+	cl_assert_equal_i(0, fchmod(fh, 0666));
+	cl_assert_equal_i(0, ftruncate(fh, 4096));
+	close(fh);
+
+	/* It is neither used nor waited for, nor removed. */
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "domain", CATALOG));
+	libgtr_domain_t *dom = gtr->domains;
+	cl_assert(dom->mph != NULL);
+	cl_assert(dom->index_map == NULL);
+	cl_assert_equal_s("test 3 translation 2",
+		libgtr_get_translation(gtr, "domain", "test 3", 12));
+	fh = shm_open(name, O_RDONLY, 0);
+	cl_assert(fh >= 0);
+	close(fh);
+	shm_unlink(name);
+#endif
+}
+
+void test_shmindex__not_for_memory_catalogs(void)
+{
+	char buf[4096];
+	size_t len = read_file(CATALOG, buf, sizeof(buf));
+	cl_must_pass(libgtr_load_msgcat_mem(gtr, "domain", len, buf));
+	cl_assert(gtr->domains->index_map == NULL);
+	cl_assert_equal_i(GTRENOENT, libgtr_remove_shared_index(CATALOG));
+}
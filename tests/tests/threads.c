@@ -0,0 +1,311 @@
+/* Copyright (c) 2015 Nicolas Hake <nh@nosebud.de>
+*
+* Permission to use, copy, modify, and / or distribute this software
+* for any purpose with or without fee is hereby granted, provided that
+* the above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS.IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+* OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "clar.h"
+
+#include "gtr.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE thread_t;
+#else
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_t thread_t;
+#endif
+
+#define READERS 4
+
+static libgtr_t *gtr;
+static volatile int stop;
+
+typedef struct reader
+{
+	libgtr_domain_ref_t *ref;
+	unsigned int lookups;
+	unsigned int wrong;
+	volatile int started;
+} reader_t;
+
+static void yield(void)
+{
+#if defined(_WIN32)
+	Sleep(0);
+#else
+	sched_yield();
+#endif
+}
+
+/* Look up strings until told to stop. Depending on what the writer is
+doing, "domain" may or may not be loaded; translations from it may be
+unloaded right after they are returned, so only "other", which stays
+loaded, is checked for content. */
+#if defined(_WIN32)
+static DWORD WINAPI read_strings(LPVOID arg)
+#else
+static void *read_strings(void *arg)
+#endif
+{
+	reader_t *r = arg;
+	while (!stop)
+	{
+		if (r->ref)
+			libgtr_get_translation_ref(gtr, r->ref, "test 1", 1);
+		else
+			libgtr_get_translation(gtr, "domain", "test 1", 1);
+		const char *t = libgtr_get_translation(gtr, "other", "test 2", 1);
+		if (t == NULL || strcmp(t, "test 2 translation") != 0)
+			++r->wrong;
+		++r->lookups;
+	}
+	return 0;
+}
+
+/* Look up a string that is reloaded from different catalogs, and check
+its content inside a read section. The domain is always loaded. */
+#if defined(_WIN32)
+static DWORD WINAPI read_reloaded(LPVOID arg)
+#else
+static void *read_reloaded(void *arg)
+#endif
+{
+	reader_t *r = arg;
+	while (!stop)
+	{
+		unsigned int token = libgtr_read_begin(gtr);
+		const char *t = libgtr_get_translation(gtr, "domain", "test 2", 1);
+		if (t == NULL || (strcmp(t, "test 2 translation") != 0 &&
+			strcmp(t, "test 2 translation 0") != 0))
+		{
+			++r->wrong;
+		}
+		libgtr_read_end(gtr, token);
+		++r->lookups;
+	}
+	return 0;
+}
+
+static reader_t *loading_readers;
+static volatile int loader_calls;
+static volatile int in_loader;
+static volatile int release_loader;
+
+/* Load a catalog once all readers are running, or once released. */
+static int slow_loader(libgtr_t *gtr, const char *domain, void *opaque)
+{
+	++loader_calls;
+	in_loader = 1;
+	if (loading_readers)
+	{
+		for (int i = 0; i < READERS; ++i)
+		{
+			while (!loading_readers[i].started)
+				yield();
+		}
+	}
+	else
+	{
+		while (!release_loader)
+			yield();
+	}
+	return libgtr_load_msgcat_file(gtr, domain, CLAR_RESOURCES "/basic.mo");
+}
+
+/* Look up a string from a domain that is loaded on demand. */
+#if defined(_WIN32)
+static DWORD WINAPI read_cold(LPVOID arg)
+#else
+static void *read_cold(void *arg)
+#endif
+{
+	reader_t *r = arg;
+	r->started = 1;
+	const char *t = libgtr_get_translation(gtr, "domain", "test 1", 1);
+	if (t == NULL || strcmp(t, "test 1 translation") != 0)
+		++r->wrong;
+	return 0;
+}
+
+#if defined(_WIN32)
+typedef LPTHREAD_START_ROUTINE thread_fn;
+#else
+typedef void *(*thread_fn)(void*);
+#endif
+
+static void start_thread(thread_t *thread, thread_fn fn, reader_t *reader)
+{
+#if defined(_WIN32)
+	*thread = CreateThread(NULL, 0, fn, reader, 0, NULL);
+	cl_assert(*thread != NULL);
+#else
+	cl_assert(pthread_create(thread, NULL, fn, reader) == 0);
+#endif
+}
+
+static void join_thread(thread_t thread)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+void test_threads__initialize(void)
+{
+	cl_assert(NULL != (gtr = libgtr_new()));
+	stop = 0;
+	loading_readers = NULL;
+	loader_calls = 0;
+	in_loader = 0;
+	release_loader = 0;
+}
+
+void test_threads__cleanup(void)
+{
+	libgtr_destroy(gtr);
+	gtr = NULL;
+}
+
+void test_threads__lookups_during_reload(void)
+{
+	thread_t threads[READERS];
+	reader_t readers[READERS];
+	memset(readers, 0, sizeof(readers));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"other", CLAR_RESOURCES "/basic.mo")
+		);
+
+	for (int i = 0; i < READERS; ++i)
+	{
+		/* Half of the readers go through a handle, half by name. */
+		if (i % 2)
+			readers[i].ref = libgtr_domain_ref(gtr, "domain");
+		start_thread(&threads[i], read_strings, &readers[i]);
+	}
+
+	for (int i = 0; i < 200; ++i)
+	{
+		cl_must_pass(libgtr_load_msgcat_file(gtr,
+			"domain", CLAR_RESOURCES "/basic.mo")
+			);
+		/* Create new handles while readers are looking for others. */
+		char name[32];
+		sprintf(name, "domain %d", i);
+		cl_assert(libgtr_domain_ref(gtr, name) != NULL);
+		cl_must_pass(libgtr_unload_domain(gtr, "domain"));
+	}
+
+	stop = 1;
+	for (int i = 0; i < READERS; ++i)
+	{
+		join_thread(threads[i]);
+		cl_assert_equal_i(0, readers[i].wrong);
+	}
+}
+
+void test_threads__lookups_during_hot_reload(void)
+{
+	thread_t threads[READERS];
+	reader_t readers[READERS];
+	memset(readers, 0, sizeof(readers));
+	cl_must_pass(libgtr_load_msgcat_file(gtr,
+		"domain", CLAR_RESOURCES "/basic.mo")
+		);
+
+	for (int i = 0; i < READERS; ++i)
+		start_thread(&threads[i], read_reloaded, &readers[i]);
+
+	for (int i = 0; i < 200; ++i)
+	{
+		cl_must_pass(libgtr_reload_domain(gtr, "domain", i % 2 ?
+			CLAR_RESOURCES "/basic.mo" :
+			CLAR_RESOURCES "/plurals-complex.mo")
+			);
+	}
+
+	stop = 1;
+	for (int i = 0; i < READERS; ++i)
+	{
+		join_thread(threads[i]);
+		cl_assert_equal_i(0, readers[i].wrong);
+	}
+}
+
+void test_threads__single_flight_loading(void)
+{
+	thread_t threads[READERS];
+	reader_t readers[READERS];
+	memset(readers, 0, sizeof(readers));
+	loading_readers = readers;
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, slow_loader, NULL));
+	cl_must_pass(libgtr_set_load_timeout(gtr, LIBGTR_WAIT_FOREVER));
+
+	for (int i = 0; i < READERS; ++i)
+		start_thread(&threads[i], read_cold, &readers[i]);
+	for (int i = 0; i < READERS; ++i)
+	{
+		join_thread(threads[i]);
+		cl_assert_equal_i(0, readers[i].wrong);
+	}
+	cl_assert_equal_i(1, loader_calls);
+}
+
+void test_threads__loader_nowait(void)
+{
+	thread_t thread;
+	reader_t reader;
+	memset(&reader, 0, sizeof(reader));
+	cl_must_pass(libgtr_set_msgcat_loader(gtr, slow_loader, NULL));
+
+	start_thread(&thread, read_cold, &reader);
+	while (!in_loader)
+		yield();
+	/* The other thread is still loading the domain, and lookups don't
+	wait for it by default. */
+	cl_assert_equal_s(NULL,
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	release_loader = 1;
+	join_thread(thread);
+	cl_assert_equal_i(0, reader.wrong);
+
+	cl_assert_equal_s("test 1 translation",
+		libgtr_get_translation(gtr, "domain", "test 1", 1));
+	cl_assert_equal_i(1, loader_calls);
+}
+
+void test_threads__lazy_index(void)
+{
+	/* The first lookups race to build the index. */
+	cl_must_pass(libgtr_set_flags(gtr, GTRF_LAZY_INDEX));
+	cl_must_pass(libgtr_load_msgcat_file(gtr, "domain",
+		CLAR_RESOURCES "/basic.mo"));
+
+	reader_t readers[READERS];
+	thread_t threads[READERS];
+	memset(readers, 0, sizeof(readers));
+	for (int i = 0; i < READERS; ++i)
+		start_thread(&threads[i], read_cold, &readers[i]);
+	for (int i = 0; i < READERS; ++i)
+		join_thread(threads[i]);
+	for (int i = 0; i < READERS; ++i)
+		cl_assert_equal_i(0, readers[i].wrong);
+}